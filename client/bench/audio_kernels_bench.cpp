@@ -0,0 +1,162 @@
+// Cycles per frame of every audio kernel set this CPU supports, on the buffer
+// sizes the audio callbacks see. Also checks each set against the scalar one,
+// then times the resampler presets and the DSP chain stages. Built with
+// -DPERRY_BUILD_BENCHMARKS=ON.
+#include "audio_kernels.h"
+#include "dsp_chain.h"
+#include "resampler.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define BENCH_TSC // Reference cycles, close to core cycles at a fixed clock
+#endif
+
+#define FRAMES 480 // A 10ms device period
+#define ITERATIONS 20000
+#define DOT_TAPS 64 // The longest resampler filter, dot is timed as one output sample per frame
+
+static uint64_t now_ticks() {
+#ifdef BENCH_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+template <typename F> static double per_frame(F &&run) {
+    for (int i = 0; i < ITERATIONS / 10; i++) {
+        run();
+    }
+
+    uint64_t start = now_ticks();
+    for (int i = 0; i < ITERATIONS; i++) {
+        run();
+    }
+    return (double)(now_ticks() - start) / ITERATIONS / FRAMES;
+}
+
+static bool same(const std::vector<float> &a, const std::vector<float> &b, float tolerance = 1e-6f) {
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::fabs(a[i] - b[i]) > tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const AudioKernelSet *sets[8];
+    int count = AudioKernels::available(sets, 8);
+
+    std::vector<float> stereo(FRAMES * 2), mono(FRAMES), out_stereo(FRAMES * 2), out_mono(FRAMES);
+    for (int i = 0; i < FRAMES * 2; i++) {
+        stereo[i] = std::sin(i * 0.01f);
+    }
+    for (int i = 0; i < FRAMES; i++) {
+        mono[i] = std::cos(i * 0.02f);
+    }
+
+    // Reference results from the scalar set
+    std::vector<float> ref_downmix(FRAMES), ref_fanout(FRAMES * 2);
+    sets[0]->downmix(stereo.data(), 2, FRAMES, ref_downmix.data());
+    sets[0]->fanout(mono.data(), FRAMES, 2, ref_fanout.data());
+    std::vector<float> ref_ramp(mono);
+    sets[0]->ramp(ref_ramp.data(), FRAMES, 0.5f, 1.0f / FRAMES);
+    float ref_peak = sets[0]->peak(stereo.data(), FRAMES * 2);
+    std::vector<float> ref_dot(FRAMES - DOT_TAPS);
+    for (int i = 0; i < FRAMES - DOT_TAPS; i++) {
+        ref_dot[i] = sets[0]->dot(mono.data(), stereo.data() + i, DOT_TAPS);
+    }
+
+    std::printf("%s per frame, %d frames, stereo device (active set: %s)\n",
+#ifdef BENCH_TSC
+                "Cycles",
+#else
+                "Nanoseconds",
+#endif
+                FRAMES, AudioKernels::active().name);
+    std::printf("%-8s %10s %10s %10s %10s %10s %10s %10s  %s\n", "set", "downmix", "fanout", "gain", "ramp", "peak", "silence", "dot",
+                "matches scalar");
+
+    for (int s = 0; s < count; s++) {
+        const AudioKernelSet &k = *sets[s];
+
+        double downmix = per_frame([&] { k.downmix(stereo.data(), 2, FRAMES, out_mono.data()); });
+        bool ok = same(out_mono, ref_downmix);
+
+        double fanout = per_frame([&] { k.fanout(mono.data(), FRAMES, 2, out_stereo.data()); });
+        ok = ok && same(out_stereo, ref_fanout);
+
+        // Alternating gains so the buffer neither blows up nor underflows
+        bool up = false;
+        double gain = per_frame([&] {
+            k.gain(out_mono.data(), FRAMES, up ? 1.25f : 0.8f);
+            up = !up;
+        });
+        double ramp = per_frame([&] {
+            k.ramp(out_mono.data(), FRAMES, up ? 1.25f : 0.8f, 0.0f);
+            up = !up;
+        });
+        std::vector<float> ramped(mono);
+        k.ramp(ramped.data(), FRAMES, 0.5f, 1.0f / FRAMES);
+        ok = ok && same(ramped, ref_ramp);
+
+        float peak_value = 0.0f;
+        double peak = per_frame([&] { peak_value = k.peak(stereo.data(), FRAMES); });
+        ok = ok && k.peak(stereo.data(), FRAMES * 2) == ref_peak;
+
+        double silence = per_frame([&] { k.silence(out_stereo.data(), FRAMES * 2); });
+
+        // Summation order differs between sets, so only close
+        std::vector<float> dots(FRAMES - DOT_TAPS);
+        double dot = per_frame([&] {
+            for (int i = 0; i < FRAMES - DOT_TAPS; i++) {
+                dots[i] = k.dot(mono.data(), stereo.data() + i, DOT_TAPS);
+            }
+        });
+        ok = ok && same(dots, ref_dot, 1e-4f);
+
+        std::printf("%-8s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f  %s\n", k.name, downmix, fanout, gain, ramp, peak, silence, dot,
+                    ok ? "yes" : "NO");
+    }
+
+    // Resampler presets on the active set, per input frame of a 44.1kHz device
+    std::printf("\nResampler 44100 -> 48000 (%s)\n", AudioKernels::active().name);
+    const char *names[] = {"low", "medium", "high"};
+    for (int q = 0; q < 3; q++) {
+        Resampler r;
+        r.init(44100, 48000, (ResampleQuality)q, FRAMES);
+        std::vector<float> out(r.maxOutput(FRAMES));
+        double cost = per_frame([&] { r.process(mono.data(), FRAMES, out.data()); });
+        std::printf("%-8s %10.3f\n", names[q], cost);
+    }
+
+    // One stage at a time, then the whole chain, on a 10ms frame of speech level audio
+    std::printf("\nDSP chain (%s)\n", AudioKernels::active().name);
+    const char *stages[] = {"high-pass", "noise gate", "agc", "all"};
+    for (int st = 0; st < 4; st++) {
+        DspSettings settings;
+        settings.high_pass = st == 0 || st == 3;
+        settings.noise_gate = st == 1 || st == 3;
+        settings.agc = st == 2 || st == 3;
+
+        DspChain chain;
+        chain.init(48000);
+        chain.configure(settings);
+        std::vector<float> frame(FRAMES);
+        double cost = per_frame([&] {
+            for (int i = 0; i < FRAMES; i++) {
+                frame[i] = 0.1f * mono[i];
+            }
+            chain.process(frame.data(), FRAMES);
+        });
+        std::printf("%-10s %10.3f\n", stages[st], cost);
+    }
+
+    return 0;
+}
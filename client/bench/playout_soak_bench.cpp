@@ -0,0 +1,250 @@
+// Long sessions of the receiving side in simulated time. One speaker's packets
+// reach a jitter buffer through a network with delay jitter, the drift
+// compensator feeds the playback ring, and libsoundio's dummy backend on its
+// virtual clock plays it. Sender, mixer and device each run on their own
+// skewed clock, so hours of drift and jitter take seconds. Runs are
+// deterministic. Built with -DPERRY_BUILD_BENCHMARKS=ON.
+//
+// playout_soak_bench [hours] [device_ppm] [sender_ppm] [jitter_ms]
+#include "drift_compensator.h"
+#include "frame_queue.h"
+#include "jitter_buffer.h"
+#include "voice_packets.h"
+#include <soundio/soundio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <opus.h>
+#include <vector>
+
+#define SAMPLE_RATE 48000
+#define TICK 480               // The mixer's 10ms
+#define SW_LATENCY 0.005       // As the voice engine opens the device for 10ms frames
+#define RING_FRAMES 7200       // 150ms
+#define NETWORK_DELAY_NS 20000000LL
+#define TALK_FRAMES 300        // 3s talkspurts
+#define PAUSE_FRAMES 100       // 1s pauses between them
+#define REPORT_NS 600000000000LL // Every 10 simulated minutes
+#define MAX_PACKET 1276
+
+static FrameQueue<float> ring;
+static uint64_t underflows = 0;
+static uint64_t silence_frames = 0; // Written short once audio had started
+static bool played = false;
+
+static void write_callback(struct SoundIoOutStream *outstream, int frame_count_min, int frame_count_max) {
+    int frames_left = frame_count_max;
+    while (frames_left > 0) {
+        struct SoundIoChannelArea *areas;
+        int frame_count = frames_left;
+        if (soundio_outstream_begin_write(outstream, &areas, &frame_count) || frame_count == 0) {
+            return;
+        }
+
+        int copy_frames = std::min(ring.readable(), frame_count);
+        const float *buffer = ring.peek(copy_frames);
+        for (int i = 0; i < frame_count; i++) {
+            *(float *)(areas[0].ptr + areas[0].step * i) = i < copy_frames ? buffer[i] : 0.0f;
+        }
+        ring.release(copy_frames);
+        played = played || copy_frames > 0;
+        if (played) {
+            silence_frames += frame_count - copy_frames;
+        }
+
+        soundio_outstream_end_write(outstream);
+        frames_left -= frame_count;
+    }
+}
+
+static void underflow_callback(struct SoundIoOutStream *) {
+    underflows++;
+}
+
+// Same sequence on every run
+static uint32_t rng_state = 0x9e3779b9;
+static double uniform() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state / 4294967296.0;
+}
+
+// Correction the compensator applied over a report interval, its instantaneous
+// value swings with every device read
+struct DriftWindow {
+    uint64_t ticks = 0;
+    uint64_t written = 0;
+    double min_ppm = 1e9;
+    double max_ppm = -1e9;
+
+    void add(int samples, double ppm) {
+        ticks++;
+        written += samples;
+        min_ppm = std::min(min_ppm, ppm);
+        max_ppm = std::max(max_ppm, ppm);
+    }
+
+    double ppm() const {
+        return ticks ? ((double)ticks * TICK / written - 1.0) * 1e6 : 0.0;
+    }
+};
+
+struct InFlight {
+    int64_t arrival_ns;
+    uint16_t seq;
+    uint32_t timestamp;
+    uint8_t flags;
+    int len;
+    unsigned char data[MAX_PACKET];
+};
+
+static void print_line(const char *label, int64_t now_ns, const DriftWindow &window, const DriftCompensator &drift,
+                       const JitterStats &j, uint64_t dropped) {
+    std::printf("%-4s %6.1fmin  drift %+7.1fppm (%+.0f..%+.0f)  ring %5.1fms  depth %3dms target %3dms  late %llu "
+                "lost %llu concealed %llu skipped %llu  underflows %llu silence %.1fms  mix dropped %llu\n",
+                label, now_ns / 60e9, window.ppm(), window.min_ppm, window.max_ppm,
+                drift.smoothedFill() * 1000.0 / SAMPLE_RATE, j.depth_ms,
+                j.target_ms, (unsigned long long)j.late, (unsigned long long)j.lost, (unsigned long long)j.concealed,
+                (unsigned long long)j.skipped, (unsigned long long)underflows, silence_frames * 1000.0 / SAMPLE_RATE,
+                (unsigned long long)dropped);
+}
+
+int main(int argc, char **argv) {
+    double hours = argc > 1 ? std::atof(argv[1]) : 1.0;
+    double device_ppm = argc > 2 ? std::atof(argv[2]) : 300.0; // Device clock fast of the host's
+    double sender_ppm = argc > 3 ? std::atof(argv[3]) : -150.0; // Sender clock fast of the device's
+    double jitter_ms = argc > 4 ? std::atof(argv[4]) : 30.0;    // Most of it small, a long tail
+
+    // Virtual time is the device's clock, the others tick a little off it
+    const int64_t end_ns = (int64_t)(hours * 3600e9);
+    const double tick_ns = 1e9 * TICK / SAMPLE_RATE * (1.0 + device_ppm * 1e-6);
+    const double frame_ns = 1e9 * TICK / SAMPLE_RATE / (1.0 + sender_ppm * 1e-6);
+
+    struct SoundIo *soundio = soundio_create();
+    if (!soundio || soundio_connect_backend(soundio, SoundIoBackendDummy) ||
+        soundio_dummy_set_virtual_clock(soundio, true)) {
+        std::fprintf(stderr, "No dummy backend with a virtual clock\n");
+        return 1;
+    }
+    soundio_flush_events(soundio);
+
+    struct SoundIoDevice *device = soundio_get_output_device(soundio, soundio_default_output_device_index(soundio));
+    struct SoundIoOutStream *outstream = soundio_outstream_create(device);
+    outstream->format = SoundIoFormatFloat32NE;
+    outstream->sample_rate = SAMPLE_RATE;
+    outstream->layout = *soundio_channel_layout_get_default(1);
+    outstream->software_latency = SW_LATENCY;
+    outstream->write_callback = write_callback;
+    outstream->underflow_callback = underflow_callback;
+
+    int err;
+    OpusEncoder *encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &err);
+    JitterBuffer jitter;
+    if (soundio_outstream_open(outstream) || !ring.init(RING_FRAMES) || err != OPUS_OK || !jitter.init()) {
+        std::fprintf(stderr, "Setup failed\n");
+        return 1;
+    }
+
+    DriftCompensator drift;
+    drift.init(TICK, TICK + (int)(2 * SW_LATENCY * SAMPLE_RATE));
+    std::vector<float> mixed(TICK);
+    std::vector<float> voice(TICK);
+    std::deque<InFlight> network;
+    const auto epoch = std::chrono::steady_clock::time_point();
+
+    std::printf("%.1fh simulated, device %+.0fppm, sender %+.0fppm, jitter up to %.0fms\n", hours, device_ppm, sender_ppm,
+                jitter_ms);
+    auto wall_start = std::chrono::steady_clock::now();
+    soundio_outstream_start(outstream);
+
+    uint64_t frames_sent = 0;
+    uint64_t ticks = 0;
+    uint64_t dropped = 0;
+    DriftWindow window, total;
+    uint16_t seq = 0;
+    uint32_t timestamp = 0;
+    double phase = 0.0;
+    int64_t now_ns = 0;
+    int64_t next_report = REPORT_NS;
+
+    while (now_ns < end_ns) {
+        int64_t send_at = (int64_t)(frames_sent * frame_ns);
+        int64_t tick_at = (int64_t)((ticks + 1) * tick_ns);
+        int64_t next = std::min(send_at, tick_at);
+        soundio_dummy_advance(soundio, (next - now_ns) / 1e9);
+        now_ns = next;
+
+        if (send_at <= tick_at) {
+            // Talkspurts of a tone, one silence frame as each ends, nothing during the pause
+            int position = (int)(frames_sent++ % (TALK_FRAMES + PAUSE_FRAMES));
+            if (position <= TALK_FRAMES) {
+                InFlight p;
+                p.seq = seq++;
+                p.timestamp = timestamp;
+                p.flags = position == 0 ? VOICE_FLAG_TALKSPURT : position == TALK_FRAMES ? VOICE_FLAG_SILENCE : 0;
+                for (int i = 0; i < TICK; i++) {
+                    voice[i] = position < TALK_FRAMES ? 0.3f * (float)std::sin(phase) : 0.0f;
+                    phase = std::fmod(phase + 2.0 * M_PI * 440.0 / SAMPLE_RATE, 2.0 * M_PI);
+                }
+                p.len = opus_encode_float(encoder, voice.data(), TICK, p.data, MAX_PACKET);
+
+                double u = uniform();
+                p.arrival_ns = now_ns + NETWORK_DELAY_NS + (int64_t)(jitter_ms * 1e6 * u * u * u);
+                if (p.len > 0) {
+                    network.insert(std::upper_bound(network.begin(), network.end(), p.arrival_ns,
+                                                    [](int64_t t, const InFlight &q) { return t < q.arrival_ns; }),
+                                   p);
+                }
+            }
+            timestamp += TICK;
+            continue;
+        }
+
+        // A mixer tick: take in what arrived, play out one tick, refill the ring
+        ticks++;
+        while (!network.empty() && network.front().arrival_ns <= now_ns) {
+            const InFlight &p = network.front();
+            jitter.push(p.seq, p.timestamp, p.flags, p.data, p.len, opus_packet_samples(p.data, p.len),
+                        epoch + std::chrono::nanoseconds(p.arrival_ns));
+            network.pop_front();
+        }
+
+        int n = jitter.read(mixed.data(), TICK);
+        std::fill(mixed.begin() + std::max(n, 0), mixed.end(), 0.0f);
+
+        float *buffer = ring.reserve(DriftCompensator::maxOutput(TICK));
+        if (!buffer) {
+            dropped++;
+            continue;
+        }
+        int written = drift.process(mixed.data(), TICK, buffer);
+        ring.commit(written);
+        window.add(written, drift.ppm());
+        total.add(written, drift.ppm());
+        drift.update(ring.fill(), TICK);
+
+        if (now_ns >= next_report) {
+            print_line("", now_ns, window, drift, jitter.stats(), dropped);
+            window = DriftWindow();
+            next_report += REPORT_NS;
+        }
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    print_line("all", now_ns, total, drift, jitter.stats(), dropped);
+    std::printf("%.0fx real time, the drift correction should average %+.0fppm\n", end_ns / 1e9 / wall, -device_ppm);
+
+    soundio_outstream_destroy(outstream);
+    soundio_device_unref(device);
+    soundio_destroy(soundio);
+    opus_encoder_destroy(encoder);
+    jitter.destroy();
+    ring.destroy();
+    return 0;
+}
@@ -0,0 +1,348 @@
+// Mouth-to-ear latency of the whole voice path without audio hardware. Two
+// pipelines run on libsoundio's dummy backend and talk through a minimal relay
+// over loopback. The talker's microphone is replaced by tone bursts on a fixed
+// schedule, the listener's speaker output is watched for them, and the gap is
+// the latency. Each pipeline is its own process since the voice code keeps its
+// state in globals. The relay can impair the network both ways, see
+// net_impairment.h. Built with -DPERRY_BUILD_BENCHMARKS=ON, Linux only.
+//
+// voice_loopback_bench [seconds] [low_latency|efficiency] [impairments, e.g. loss=2,jitter=20]
+#include "latency_histogram.h"
+#include "logger.h"
+#include "net_impairment.h"
+#include "voice_chat.h"
+#include "voice_packets.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define RUN_SECONDS 20
+#define WARMUP_SAMPLES 96000  // 2s before the first burst, both ends are connected by then
+#define BURST_INTERVAL 14520  // ~300ms, not a whole number of frames so bursts land at every frame phase
+#define BURST_SAMPLES 480     // 10ms of tone
+#define BURST_HZ 1000.0f
+#define BURST_LEVEL 0.3f
+#define DETECT_LEVEL 0.05f    // Onset threshold on the listener's output
+#define REARM_SAMPLES 4800    // 100ms below the threshold before the next onset counts
+#define MAX_EVENTS 4096
+#define LISTENER_LINGER_S 1   // The listener outlasts the talker so the last burst can arrive
+
+#define TALKER_SSRC 1
+#define LISTENER_SSRC 2
+
+// Steady clock times of burst onsets, written on the audio thread and read once the engine is down
+static int64_t events[MAX_EVENTS];
+static std::atomic<int> event_count{0};
+
+static void record_event(int64_t us) {
+    int n = event_count.load(std::memory_order_relaxed);
+    if (n < MAX_EVENTS) {
+        events[n] = us;
+        event_count.store(n + 1, std::memory_order_release);
+    }
+}
+
+// Talker: bursts on a fixed sample schedule, silence in between
+static int64_t talker_position = 0;
+
+static void talker_capture(float *mono, int frames, int rate, int64_t captured_us) {
+    for (int i = 0; i < frames; i++, talker_position++) {
+        int64_t t = talker_position - WARMUP_SAMPLES;
+        float v = 0.0f;
+        if (t >= 0) {
+            int64_t phase = t % BURST_INTERVAL;
+            if (phase == 0) {
+                record_event(captured_us + (int64_t)i * 1000000 / rate);
+            }
+            if (phase < BURST_SAMPLES) {
+                v = BURST_LEVEL * std::sin(2.0f * (float)M_PI * BURST_HZ * phase / rate);
+            }
+        }
+        mono[i] = v;
+    }
+}
+
+// Listener: a quiet microphone, and onsets picked out of what reaches the speaker
+static bool listener_armed = true;
+static int listener_quiet = 0;
+
+static void listener_capture(float *mono, int frames, int, int64_t) {
+    std::memset(mono, 0, frames * sizeof(float));
+}
+
+static void listener_playback(const float *mono, int frames, int rate, int64_t audible_us) {
+    for (int i = 0; i < frames; i++) {
+        float v = mono ? std::fabs(mono[i]) : 0.0f;
+        if (v > DETECT_LEVEL) {
+            if (listener_armed) {
+                record_event(audible_us + (int64_t)i * 1000000 / rate);
+                listener_armed = false;
+            }
+            listener_quiet = 0;
+        } else if (!listener_armed && ++listener_quiet >= REARM_SAMPLES) {
+            listener_armed = true;
+        }
+    }
+}
+
+// What a client process hands back to the harness through its pipe, followed by the events
+struct ClientReport {
+    VoicePipelineStats stats;
+    int events;
+};
+
+static void run_client(bool talker, int port, int seconds, const VoiceCodecParams &codec, int out_fd) {
+    Logger::init("", LogLevel::WARNING);
+
+    VoiceProbe probe;
+    probe.dummy_backend = true;
+    probe.capture = talker ? talker_capture : listener_capture;
+    probe.playback = talker ? nullptr : listener_playback;
+    VoiceChat::setProbe(probe);
+
+    VoiceSessionInfo session = {};
+    session.channel = 1;
+    session.ssrc = talker ? TALKER_SSRC : LISTENER_SSRC;
+    session.codec = codec;
+
+    VoiceChat chat;
+    chat.init("127.0.0.1", port, session, ResampleQuality::MEDIUM, false);
+    std::this_thread::sleep_for(std::chrono::seconds(seconds + (talker ? 0 : LISTENER_LINGER_S)));
+    chat.stop();
+    VoiceChat::shutdown();
+
+    ClientReport report;
+    report.stats = VoiceChat::pipelineStats();
+    report.events = event_count.load(std::memory_order_acquire);
+    write(out_fd, &report, sizeof(report));
+    write(out_fd, events, report.events * sizeof(int64_t));
+    close(out_fd);
+}
+
+static bool read_report(int fd, ClientReport &report, std::vector<int64_t> &times) {
+    if (read(fd, &report, sizeof(report)) != (ssize_t)sizeof(report)) {
+        return false;
+    }
+    times.resize(report.events);
+    size_t want = times.size() * sizeof(int64_t);
+    size_t got = 0;
+    while (got < want) {
+        ssize_t n = read(fd, (char *)times.data() + got, want - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Just enough of the server's relay: acknowledges hellos and forwards every
+// frame to the other peer, stamped with the sender as speaker. Audio and
+// reports go through each peer's impaired path to the relay and back out,
+// the handshake doesn't so the clients never fall back to TCP.
+struct Peer {
+    uint32_t ssrc;
+    sockaddr_in addr;
+    NetImpairer up;
+    NetImpairer down;
+};
+
+// Routes in the delay line: ssrc * 2 on the way in, +1 on the way out
+static Peer *find_peer(std::vector<Peer> &peers, uint32_t ssrc) {
+    auto it = std::find_if(peers.begin(), peers.end(), [&](const Peer &p) { return p.ssrc == ssrc; });
+    return it == peers.end() ? nullptr : &*it;
+}
+
+static void relay(int sock, int children, const NetImpairment &impairment, std::vector<Peer> &peers) {
+    char frame[VOICE_MAX_FRAME];
+    NetDelayLine line;
+    NetDelayLine::Packet due;
+
+    while (children > 0) {
+        pollfd pfd = {sock, POLLIN, 0};
+        int64_t next = line.nextDue();
+        int timeout = next < 0 ? 100 : (int)std::clamp<int64_t>((next - now_us()) / 1000, 0, 100);
+        if (poll(&pfd, 1, timeout) > 0) {
+            sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = recvfrom(sock, frame, sizeof(frame), 0, (sockaddr *)&from, &from_len);
+            if (n >= (ssize_t)sizeof(VoicePacketHeader)) {
+                VoicePacketHeader *header = reinterpret_cast<VoicePacketHeader *>(frame);
+                uint32_t ssrc = ntohl(header->ssrc);
+
+                switch (static_cast<VoicePacketType>(header->type)) {
+                case VoicePacketType::HELLO: {
+                    if (!find_peer(peers, ssrc)) {
+                        Peer peer;
+                        peer.ssrc = ssrc;
+                        peer.up.init(impairment, ssrc * 2);
+                        peer.down.init(impairment, ssrc * 2 + 1);
+                        peers.push_back(std::move(peer));
+                    }
+                    find_peer(peers, ssrc)->addr = from;
+
+                    VoicePacketHeader ack = {};
+                    ack.type = static_cast<uint8_t>(VoicePacketType::HELLO_ACK);
+                    ack.ssrc = header->ssrc;
+                    sendto(sock, &ack, sizeof(ack), 0, (sockaddr *)&from, sizeof(from));
+                    break;
+                }
+                case VoicePacketType::AUDIO:
+                case VoicePacketType::REPORT: {
+                    header->speaker = htonl(ssrc);
+                    Peer *sender = find_peer(peers, ssrc);
+                    int64_t deliver;
+                    if (sender && sender->up.admit(frame, n, now_us(), deliver)) {
+                        line.push(deliver, (int)ssrc * 2, frame, n);
+                    }
+                    break;
+                }
+                case VoicePacketType::BYE:
+                    // Kept for its counters, nothing is sent to it any more
+                    if (Peer *p = find_peer(peers, ssrc)) {
+                        p->addr.sin_port = 0;
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        int64_t now = now_us();
+        while (line.pop(now, due)) {
+            uint32_t ssrc = (uint32_t)due.route / 2;
+            if (due.route % 2 == 0) {
+                // Reached the relay, out to everyone else
+                for (Peer &p : peers) {
+                    int64_t deliver;
+                    if (p.ssrc != ssrc && p.addr.sin_port != 0 && p.down.admit(due.data.data(), due.data.size(), now, deliver)) {
+                        line.push(deliver, (int)p.ssrc * 2 + 1, due.data.data(), due.data.size());
+                    }
+                }
+            } else if (Peer *p = find_peer(peers, ssrc); p && p->addr.sin_port != 0) {
+                sendto(sock, due.data.data(), due.data.size(), 0, (const sockaddr *)&p->addr, sizeof(p->addr));
+            }
+        }
+
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {
+            children--;
+        }
+    }
+}
+
+static void print_stats(const char *who, const VoicePipelineStats &s, Peer *peer) {
+    std::printf("%-8s underflows %d, capture overruns %llu, capture dropped %llu samples, mix dropped %llu ticks\n", who,
+                s.underflows, (unsigned long long)s.capture_overruns, (unsigned long long)s.capture_dropped,
+                (unsigned long long)s.mix_dropped);
+    const JitterStats &j = s.heard;
+    std::printf("         heard %llu played, %llu late, %llu lost, %llu concealed, %llu recovered, %llu skipped\n",
+                (unsigned long long)j.played, (unsigned long long)j.late, (unsigned long long)j.lost,
+                (unsigned long long)j.concealed, (unsigned long long)j.recovered, (unsigned long long)j.skipped);
+    if (peer) {
+        std::printf("         up   %s\n         down %s\n", peer->up.summary().c_str(), peer->down.summary().c_str());
+    }
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? std::atoi(argv[1]) : RUN_SECONDS;
+    VoiceProfile profile = VoiceProfile::LOW_LATENCY;
+    if (argc > 2 && !voice_profile_from_name(argv[2], profile)) {
+        std::fprintf(stderr, "Unknown profile %s\n", argv[2]);
+        return 2;
+    }
+    VoiceCodecParams codec = voice_profile_params(profile);
+    NetImpairment impairment;
+    if (argc > 3 && !net_impairment_parse(argv[3], impairment)) {
+        std::fprintf(stderr, "Bad impairments %s\n", argv[3]);
+        return 2;
+    }
+
+    // Relay socket first, so both clients know where to go
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (sock < 0 || bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(sock, (sockaddr *)&addr, &addr_len) < 0) {
+        std::perror("relay socket");
+        return 1;
+    }
+    int port = ntohs(addr.sin_port);
+
+    // Forked before any thread exists in this process
+    int pipes[2][2];
+    for (int role = 0; role < 2; role++) {
+        if (pipe(pipes[role]) < 0) {
+            std::perror("pipe");
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            close(sock);
+            close(pipes[role][0]);
+            run_client(role == 0, port, seconds, codec, pipes[role][1]);
+            _exit(0);
+        }
+        close(pipes[role][1]);
+    }
+
+    std::printf("Loopback on the dummy backend, %u sample frames, %us\n", codec.frame_samples, seconds);
+    std::printf("Network %s\n", net_impairment_describe(impairment).c_str());
+    std::vector<Peer> peers;
+    relay(sock, 2, impairment, peers);
+    close(sock);
+
+    ClientReport talker, listener;
+    std::vector<int64_t> sent, heard;
+    if (!read_report(pipes[0][0], talker, sent) || !read_report(pipes[1][0], listener, heard)) {
+        std::fprintf(stderr, "A client exited without reporting\n");
+        return 1;
+    }
+
+    // Each burst is matched with the first onset heard after it, within one burst interval
+    const int64_t window_us = (int64_t)BURST_INTERVAL * 1000000 / 48000;
+    LatencyHistogram latency(100, 5000);
+    size_t next = 0;
+    int missing = 0;
+    for (int64_t t : sent) {
+        while (next < heard.size() && heard[next] < t) {
+            next++;
+        }
+        if (next < heard.size() && heard[next] - t < window_us) {
+            latency.record(heard[next] - t);
+            next++;
+        } else {
+            missing++;
+        }
+    }
+
+    std::printf("Mouth to ear %s\n", latency.summary().c_str());
+    std::printf("Bursts sent %zu, heard %llu, missing %d, spurious %llu\n", sent.size(), (unsigned long long)latency.count(),
+                missing, (unsigned long long)(heard.size() - latency.count()));
+    print_stats("talker", talker.stats, find_peer(peers, TALKER_SSRC));
+    print_stats("listener", listener.stats, find_peer(peers, LISTENER_SSRC));
+
+    return latency.count() > 0 ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+// A UDP proxy that puts a bad network between voice clients and the relay.
+// Point the client's server_port_voice at it and it forwards every client to
+// the server through its own impaired path, both ways: loss, burst loss,
+// latency, jitter, reordering and a bandwidth cap. Every packet it drops,
+// holds back or queues is recorded and can be written out as CSV. UDP only, a
+// client that falls back to TCP bypasses it. Built with -DPERRY_BUILD_BENCHMARKS=ON.
+//
+// voice_netsim <listen_port> <server_ip> <server_port> [impairments] [seconds, 0 until Ctrl+C] [alterations.csv]
+// Impairments as in net_impairment.h, e.g. loss=2,burst=1:5,latency=40,jitter=20
+#include "net_impairment.h"
+#include "voice_packets.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <vector>
+
+#define CLIENT_IDLE_S 60 // A client's upstream socket is closed after this long without traffic
+#define REPORT_S 10
+
+static std::atomic<bool> running{true};
+
+static void on_signal(int) {
+    running.store(false);
+}
+
+// Since the proxy started, which is also what the alterations log counts from
+static const auto epoch = std::chrono::steady_clock::now();
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// One client's path to the server, impaired separately each way
+struct Client {
+    sockaddr_in addr;
+    int upstream = -1; // Connected to the server, so it sees each client on its own port
+    int64_t last_seen_us = 0;
+    NetImpairer up;
+    NetImpairer down;
+};
+
+static NetImpairmentStats add(NetImpairmentStats a, const NetImpairmentStats &b) {
+    a.packets += b.packets;
+    a.bytes += b.bytes;
+    a.lost += b.lost;
+    a.burst_lost += b.burst_lost;
+    a.queue_dropped += b.queue_dropped;
+    a.reordered += b.reordered;
+    a.throttled += b.throttled;
+    return a;
+}
+
+static void report(const std::vector<Client> &clients) {
+    for (size_t i = 0; i < clients.size(); i++) {
+        std::printf("client %zu %s:%u\n  up   %s\n  down %s\n", i, inet_ntoa(clients[i].addr.sin_addr),
+                    ntohs(clients[i].addr.sin_port), clients[i].up.summary().c_str(), clients[i].down.summary().c_str());
+    }
+
+    NetImpairmentStats up, down;
+    for (const Client &c : clients) {
+        up = add(up, c.up.stats());
+        down = add(down, c.down.stats());
+    }
+    for (const auto &[name, s] : {std::pair{"up", up}, std::pair{"down", down}}) {
+        std::printf("total %-4s %llu packets %llu bytes, lost %llu + %llu in bursts, queue dropped %llu, reordered %llu, "
+                    "throttled %llu\n",
+                    name, (unsigned long long)s.packets, (unsigned long long)s.bytes, (unsigned long long)s.lost,
+                    (unsigned long long)s.burst_lost, (unsigned long long)s.queue_dropped,
+                    (unsigned long long)s.reordered, (unsigned long long)s.throttled);
+    }
+    std::fflush(stdout);
+}
+
+static bool write_log(const std::string &path, const std::vector<Client> &clients) {
+    FILE *f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+
+    std::fprintf(f, "time_us,client,direction,type,ssrc,seq,action,delay_us\n");
+    for (size_t i = 0; i < clients.size(); i++) {
+        for (const auto &[direction, impairer] : {std::pair{"up", &clients[i].up}, std::pair{"down", &clients[i].down}}) {
+            for (const NetAlteration &a : impairer->alterations()) {
+                std::fprintf(f, "%lld,%zu,%s,%u,%u,%u,%s,%d\n", (long long)a.time_us, i, direction, a.type, a.ssrc, a.seq,
+                             net_action_name(a.action), a.delay_us);
+            }
+        }
+    }
+    std::fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::fprintf(stderr, "voice_netsim <listen_port> <server_ip> <server_port> [impairments] [seconds] [alterations.csv]\n");
+        return 2;
+    }
+
+    NetImpairment settings;
+    if (argc > 4 && !net_impairment_parse(argv[4], settings)) {
+        std::fprintf(stderr, "Bad impairments %s\n", argv[4]);
+        return 2;
+    }
+    int seconds = argc > 5 ? std::atoi(argv[5]) : 0;
+    std::string log_path = argc > 6 ? argv[6] : "";
+
+    sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)std::atoi(argv[3]));
+    if (inet_pton(AF_INET, argv[2], &server.sin_addr) != 1) {
+        std::fprintf(stderr, "Bad server address %s\n", argv[2]);
+        return 2;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)std::atoi(argv[1]));
+    if (sock < 0 || bind(sock, (sockaddr *)&local, sizeof(local)) < 0) {
+        std::perror("listen socket");
+        return 1;
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::printf("Forwarding :%s to %s:%s with %s\n", argv[1], argv[2], argv[3], net_impairment_describe(settings).c_str());
+
+    // Routes in the delay line are client * 2, +1 on the way back
+    std::vector<Client> clients;
+    NetDelayLine line;
+    NetDelayLine::Packet due;
+    char frame[VOICE_MAX_FRAME];
+    int64_t last_report = 0;
+
+    while (running.load() && (seconds <= 0 || now_us() < (int64_t)seconds * 1000000)) {
+        // Wake for the next packet due, rounded down and spinning out the rest
+        std::vector<pollfd> fds = {{sock, POLLIN, 0}};
+        for (const Client &c : clients) {
+            fds.push_back({c.upstream, (short)(c.upstream >= 0 ? POLLIN : 0), 0});
+        }
+        int64_t next = line.nextDue();
+        int timeout = next < 0 ? 100 : (int)std::min<int64_t>(100, std::max<int64_t>(0, (next - now_us()) / 1000));
+        poll(fds.data(), fds.size(), timeout);
+        int64_t now = now_us();
+
+        if (fds[0].revents & POLLIN) {
+            sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = recvfrom(sock, frame, sizeof(frame), 0, (sockaddr *)&from, &from_len);
+
+            size_t id = 0;
+            while (id < clients.size() && !(clients[id].addr.sin_addr.s_addr == from.sin_addr.s_addr &&
+                                            clients[id].addr.sin_port == from.sin_port && clients[id].upstream >= 0)) {
+                id++;
+            }
+            if (n > 0 && id == clients.size()) {
+                Client c;
+                c.addr = from;
+                c.upstream = socket(AF_INET, SOCK_DGRAM, 0);
+                if (c.upstream < 0 || connect(c.upstream, (sockaddr *)&server, sizeof(server)) < 0) {
+                    std::perror("upstream socket");
+                    return 1;
+                }
+                c.up.init(settings, (uint32_t)id * 2);
+                c.down.init(settings, (uint32_t)id * 2 + 1);
+                clients.push_back(std::move(c));
+                std::printf("client %zu %s:%u\n", id, inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+            }
+
+            int64_t deliver;
+            if (n > 0) {
+                clients[id].last_seen_us = now;
+                if (clients[id].up.admit(frame, n, now, deliver)) {
+                    line.push(deliver, (int)id * 2, frame, n);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (fds[i + 1].revents & POLLIN) {
+                ssize_t n = recv(clients[i].upstream, frame, sizeof(frame), 0);
+                int64_t deliver;
+                if (n > 0 && clients[i].down.admit(frame, n, now, deliver)) {
+                    line.push(deliver, (int)i * 2 + 1, frame, n);
+                }
+            }
+        }
+
+        while (line.pop(now_us(), due)) {
+            Client &c = clients[due.route / 2];
+            if (c.upstream < 0) {
+                continue;
+            }
+            if (due.route % 2 == 0) {
+                send(c.upstream, due.data.data(), due.data.size(), 0);
+            } else {
+                sendto(sock, due.data.data(), due.data.size(), 0, (sockaddr *)&c.addr, sizeof(c.addr));
+            }
+        }
+
+        for (Client &c : clients) {
+            if (c.upstream >= 0 && now - c.last_seen_us > (int64_t)CLIENT_IDLE_S * 1000000) {
+                close(c.upstream);
+                c.upstream = -1;
+            }
+        }
+
+        if (now - last_report > (int64_t)REPORT_S * 1000000) {
+            report(clients);
+            last_report = now;
+        }
+    }
+
+    report(clients);
+    if (!log_path.empty()) {
+        if (!write_log(log_path, clients)) {
+            std::perror(log_path.c_str());
+            return 1;
+        }
+        std::printf("Alterations written to %s\n", log_path.c_str());
+    }
+
+    for (Client &c : clients) {
+        if (c.upstream >= 0) {
+            close(c.upstream);
+        }
+    }
+    close(sock);
+    return 0;
+}
@@ -780,6 +780,36 @@ SOUNDIO_EXPORT void soundio_wakeup(struct SoundIo *soundio);
 SOUNDIO_EXPORT void soundio_force_device_scan(struct SoundIo *soundio);
 
 
+// Dummy Backend Virtual Clock
+
+/// Drives the dummy backend's streams from a virtual clock instead of the wall
+/// clock. Streams started afterwards get no thread of their own; time stands
+/// still until ::soundio_dummy_advance moves it, which runs their callbacks on
+/// the calling thread. Runs are deterministic and as fast as the callbacks
+/// allow. The clock starts at 0 each time this is called.
+///
+/// Call after ::soundio_connect_backend with #SoundIoBackendDummy, while no
+/// stream is started.
+/// Possible errors:
+/// * #SoundIoErrorInvalid - not connected to the dummy backend, or streams are
+///   running on the virtual clock
+SOUNDIO_EXPORT int soundio_dummy_set_virtual_clock(struct SoundIo *soundio, bool enabled);
+
+/// Moves the virtual clock forward by `seconds`. Every stream period that
+/// falls due in that time runs in order before this returns, output streams
+/// before input streams when they fall due together.
+///
+/// Not to be called from stream callbacks. Neither are ::soundio_dummy_get_time
+/// or the destroy functions of dummy streams, which would wait on the clock.
+/// Possible errors:
+/// * #SoundIoErrorInvalid - the virtual clock is not enabled, or `seconds` is
+///   negative
+SOUNDIO_EXPORT int soundio_dummy_advance(struct SoundIo *soundio, double seconds);
+
+/// Seconds on the virtual clock since ::soundio_dummy_set_virtual_clock.
+SOUNDIO_EXPORT double soundio_dummy_get_time(struct SoundIo *soundio);
+
+
 // Channel Layouts
 
 /// Returns whether the channel count field and each channel id matches in
@@ -11,8 +11,8 @@
 #include <stdio.h>
 #include <string.h>
 
-static void playback_thread_run(void *arg) {
-    struct SoundIoOutStreamPrivate *os = (struct SoundIoOutStreamPrivate *)arg;
+// Fills the whole buffer and starts the playback clock at now
+static void playback_prime(struct SoundIoOutStreamPrivate *os, double now) {
     struct SoundIoOutStream *outstream = &os->pub;
     struct SoundIoOutStreamDummy *osd = &os->backend_data.dummy;
 
@@ -22,104 +22,125 @@ static void playback_thread_run(void *arg) {
     osd->frames_left = free_frames;
     if (free_frames > 0)
         outstream->write_callback(outstream, 0, free_frames);
-    double start_time = soundio_os_get_time();
-    long frames_consumed = 0;
+    osd->start_time = now;
+    osd->frames_consumed = 0;
+}
+
+// One playback period at now, on either clock
+static void playback_period(struct SoundIoOutStreamPrivate *os, double now) {
+    struct SoundIoOutStream *outstream = &os->pub;
+    struct SoundIoOutStreamDummy *osd = &os->backend_data.dummy;
+
+    if (!SOUNDIO_ATOMIC_FLAG_TEST_AND_SET(osd->clear_buffer_flag)) {
+        soundio_ring_buffer_clear(&osd->ring_buffer);
+        int free_bytes = soundio_ring_buffer_capacity(&osd->ring_buffer);
+        int free_frames = free_bytes / outstream->bytes_per_frame;
+        osd->frames_left = free_frames;
+        if (free_frames > 0)
+            outstream->write_callback(outstream, 0, free_frames);
+        osd->frames_consumed = 0;
+        osd->start_time = now;
+        return;
+    }
+
+    if (SOUNDIO_ATOMIC_LOAD(osd->pause_requested)) {
+        osd->start_time = now;
+        osd->frames_consumed = 0;
+        return;
+    }
+
+    int fill_bytes = soundio_ring_buffer_fill_count(&osd->ring_buffer);
+    int fill_frames = fill_bytes / outstream->bytes_per_frame;
+    int free_bytes = soundio_ring_buffer_capacity(&osd->ring_buffer) - fill_bytes;
+    int free_frames = free_bytes / outstream->bytes_per_frame;
+
+    double total_time = now - osd->start_time;
+    long total_frames = total_time * outstream->sample_rate;
+    int frames_to_kill = total_frames - osd->frames_consumed;
+    int read_count = soundio_int_min(frames_to_kill, fill_frames);
+    int byte_count = read_count * outstream->bytes_per_frame;
+    soundio_ring_buffer_advance_read_ptr(&osd->ring_buffer, byte_count);
+    osd->frames_consumed += read_count;
+
+    if (frames_to_kill > fill_frames) {
+        outstream->underflow_callback(outstream);
+        osd->frames_left = free_frames;
+        if (free_frames > 0)
+            outstream->write_callback(outstream, 0, free_frames);
+        osd->frames_consumed = 0;
+        osd->start_time = now;
+    } else if (free_frames > 0) {
+        osd->frames_left = free_frames;
+        outstream->write_callback(outstream, 0, free_frames);
+    }
+}
+
+static void playback_thread_run(void *arg) {
+    struct SoundIoOutStreamPrivate *os = (struct SoundIoOutStreamPrivate *)arg;
+    struct SoundIoOutStreamDummy *osd = &os->backend_data.dummy;
+
+    playback_prime(os, soundio_os_get_time());
 
     while (SOUNDIO_ATOMIC_FLAG_TEST_AND_SET(osd->abort_flag)) {
         double now = soundio_os_get_time();
-        double time_passed = now - start_time;
-        double next_period = start_time +
+        double time_passed = now - osd->start_time;
+        double next_period = osd->start_time +
             ceil_dbl(time_passed / osd->period_duration) * osd->period_duration;
         double relative_time = next_period - now;
         soundio_os_cond_timed_wait(osd->cond, NULL, relative_time);
-        if (!SOUNDIO_ATOMIC_FLAG_TEST_AND_SET(osd->clear_buffer_flag)) {
-            soundio_ring_buffer_clear(&osd->ring_buffer);
-            int free_bytes = soundio_ring_buffer_capacity(&osd->ring_buffer);
-            int free_frames = free_bytes / outstream->bytes_per_frame;
-            osd->frames_left = free_frames;
-            if (free_frames > 0)
-                outstream->write_callback(outstream, 0, free_frames);
-            frames_consumed = 0;
-            start_time = soundio_os_get_time();
-            continue;
-        }
+        playback_period(os, soundio_os_get_time());
+    }
+}
 
-        if (SOUNDIO_ATOMIC_LOAD(osd->pause_requested)) {
-            start_time = now;
-            frames_consumed = 0;
-            continue;
-        }
+// One capture period at now, on either clock
+static void capture_period(struct SoundIoInStreamPrivate *is, double now) {
+    struct SoundIoInStream *instream = &is->pub;
+    struct SoundIoInStreamDummy *isd = &is->backend_data.dummy;
 
-        int fill_bytes = soundio_ring_buffer_fill_count(&osd->ring_buffer);
-        int fill_frames = fill_bytes / outstream->bytes_per_frame;
-        int free_bytes = soundio_ring_buffer_capacity(&osd->ring_buffer) - fill_bytes;
-        int free_frames = free_bytes / outstream->bytes_per_frame;
+    if (SOUNDIO_ATOMIC_LOAD(isd->pause_requested)) {
+        isd->start_time = now;
+        isd->frames_consumed = 0;
+        return;
+    }
 
-        double total_time = soundio_os_get_time() - start_time;
-        long total_frames = total_time * outstream->sample_rate;
-        int frames_to_kill = total_frames - frames_consumed;
-        int read_count = soundio_int_min(frames_to_kill, fill_frames);
-        int byte_count = read_count * outstream->bytes_per_frame;
-        soundio_ring_buffer_advance_read_ptr(&osd->ring_buffer, byte_count);
-        frames_consumed += read_count;
-
-        if (frames_to_kill > fill_frames) {
-            outstream->underflow_callback(outstream);
-            osd->frames_left = free_frames;
-            if (free_frames > 0)
-                outstream->write_callback(outstream, 0, free_frames);
-            frames_consumed = 0;
-            start_time = soundio_os_get_time();
-        } else if (free_frames > 0) {
-            osd->frames_left = free_frames;
-            outstream->write_callback(outstream, 0, free_frames);
-        }
+    int fill_bytes = soundio_ring_buffer_fill_count(&isd->ring_buffer);
+    int free_bytes = soundio_ring_buffer_capacity(&isd->ring_buffer) - fill_bytes;
+    int fill_frames = fill_bytes / instream->bytes_per_frame;
+    int free_frames = free_bytes / instream->bytes_per_frame;
+
+    double total_time = now - isd->start_time;
+    long total_frames = total_time * instream->sample_rate;
+    int frames_to_kill = total_frames - isd->frames_consumed;
+    int write_count = soundio_int_min(frames_to_kill, free_frames);
+    int byte_count = write_count * instream->bytes_per_frame;
+    soundio_ring_buffer_advance_write_ptr(&isd->ring_buffer, byte_count);
+    isd->frames_consumed += write_count;
+
+    if (frames_to_kill > free_frames) {
+        instream->overflow_callback(instream);
+        isd->frames_consumed = 0;
+        isd->start_time = now;
+    }
+    if (fill_frames > 0) {
+        isd->frames_left = fill_frames;
+        instream->read_callback(instream, 0, fill_frames);
     }
 }
 
 static void capture_thread_run(void *arg) {
     struct SoundIoInStreamPrivate *is = (struct SoundIoInStreamPrivate *)arg;
-    struct SoundIoInStream *instream = &is->pub;
     struct SoundIoInStreamDummy *isd = &is->backend_data.dummy;
 
-    long frames_consumed = 0;
-    double start_time = soundio_os_get_time();
+    isd->frames_consumed = 0;
+    isd->start_time = soundio_os_get_time();
     while (SOUNDIO_ATOMIC_FLAG_TEST_AND_SET(isd->abort_flag)) {
         double now = soundio_os_get_time();
-        double time_passed = now - start_time;
-        double next_period = start_time +
+        double time_passed = now - isd->start_time;
+        double next_period = isd->start_time +
             ceil_dbl(time_passed / isd->period_duration) * isd->period_duration;
         double relative_time = next_period - now;
         soundio_os_cond_timed_wait(isd->cond, NULL, relative_time);
-
-        if (SOUNDIO_ATOMIC_LOAD(isd->pause_requested)) {
-            start_time = now;
-            frames_consumed = 0;
-            continue;
-        }
-
-        int fill_bytes = soundio_ring_buffer_fill_count(&isd->ring_buffer);
-        int free_bytes = soundio_ring_buffer_capacity(&isd->ring_buffer) - fill_bytes;
-        int fill_frames = fill_bytes / instream->bytes_per_frame;
-        int free_frames = free_bytes / instream->bytes_per_frame;
-
-        double total_time = soundio_os_get_time() - start_time;
-        long total_frames = total_time * instream->sample_rate;
-        int frames_to_kill = total_frames - frames_consumed;
-        int write_count = soundio_int_min(frames_to_kill, free_frames);
-        int byte_count = write_count * instream->bytes_per_frame;
-        soundio_ring_buffer_advance_write_ptr(&isd->ring_buffer, byte_count);
-        frames_consumed += write_count;
-
-        if (frames_to_kill > free_frames) {
-            instream->overflow_callback(instream);
-            frames_consumed = 0;
-            start_time = soundio_os_get_time();
-        }
-        if (fill_frames > 0) {
-            isd->frames_left = fill_frames;
-            instream->read_callback(instream, 0, fill_frames);
-        }
+        capture_period(is, soundio_os_get_time());
     }
 }
 
@@ -158,8 +179,18 @@ static void force_device_scan_dummy(struct SoundIoPrivate *si) {
 }
 
 static void outstream_destroy_dummy(struct SoundIoPrivate *si, struct SoundIoOutStreamPrivate *os) {
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
     struct SoundIoOutStreamDummy *osd = &os->backend_data.dummy;
 
+    soundio_os_mutex_lock(sid->mutex);
+    for (struct SoundIoOutStreamPrivate **p = &sid->virtual_outstreams; *p; p = &(*p)->backend_data.dummy.virtual_next) {
+        if (*p == os) {
+            *p = osd->virtual_next;
+            break;
+        }
+    }
+    soundio_os_mutex_unlock(sid->mutex);
+
     if (osd->thread) {
         SOUNDIO_ATOMIC_FLAG_CLEAR(osd->abort_flag);
         soundio_os_cond_signal(osd->cond, NULL);
@@ -213,9 +244,24 @@ static int outstream_pause_dummy(struct SoundIoPrivate *si, struct SoundIoOutStr
 }
 
 static int outstream_start_dummy(struct SoundIoPrivate *si, struct SoundIoOutStreamPrivate *os) {
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
     struct SoundIoOutStreamDummy *osd = &os->backend_data.dummy;
     struct SoundIo *soundio = &si->pub;
     assert(!osd->thread);
+
+    soundio_os_mutex_lock(sid->mutex);
+    bool virtual_clock = sid->virtual_clock;
+    if (virtual_clock) {
+        // Primed by the next soundio_dummy_advance
+        osd->primed = false;
+        osd->next_period = sid->virtual_time;
+        osd->virtual_next = sid->virtual_outstreams;
+        sid->virtual_outstreams = os;
+    }
+    soundio_os_mutex_unlock(sid->mutex);
+    if (virtual_clock)
+        return 0;
+
     SOUNDIO_ATOMIC_FLAG_TEST_AND_SET(osd->abort_flag);
     int err;
     if ((err = soundio_os_thread_create(playback_thread_run, os,
@@ -272,8 +318,18 @@ static int outstream_get_latency_dummy(struct SoundIoPrivate *si, struct SoundIo
 }
 
 static void instream_destroy_dummy(struct SoundIoPrivate *si, struct SoundIoInStreamPrivate *is) {
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
     struct SoundIoInStreamDummy *isd = &is->backend_data.dummy;
 
+    soundio_os_mutex_lock(sid->mutex);
+    for (struct SoundIoInStreamPrivate **p = &sid->virtual_instreams; *p; p = &(*p)->backend_data.dummy.virtual_next) {
+        if (*p == is) {
+            *p = isd->virtual_next;
+            break;
+        }
+    }
+    soundio_os_mutex_unlock(sid->mutex);
+
     if (isd->thread) {
         SOUNDIO_ATOMIC_FLAG_CLEAR(isd->abort_flag);
         soundio_os_cond_signal(isd->cond, NULL);
@@ -328,9 +384,24 @@ static int instream_pause_dummy(struct SoundIoPrivate *si, struct SoundIoInStrea
 }
 
 static int instream_start_dummy(struct SoundIoPrivate *si, struct SoundIoInStreamPrivate *is) {
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
     struct SoundIoInStreamDummy *isd = &is->backend_data.dummy;
     struct SoundIo *soundio = &si->pub;
     assert(!isd->thread);
+
+    soundio_os_mutex_lock(sid->mutex);
+    bool virtual_clock = sid->virtual_clock;
+    if (virtual_clock) {
+        isd->frames_consumed = 0;
+        isd->start_time = sid->virtual_time;
+        isd->next_period = sid->virtual_time + isd->period_duration;
+        isd->virtual_next = sid->virtual_instreams;
+        sid->virtual_instreams = is;
+    }
+    soundio_os_mutex_unlock(sid->mutex);
+    if (virtual_clock)
+        return 0;
+
     SOUNDIO_ATOMIC_FLAG_TEST_AND_SET(isd->abort_flag);
     int err;
     if ((err = soundio_os_thread_create(capture_thread_run, is,
@@ -568,3 +639,94 @@ int soundio_dummy_init(struct SoundIoPrivate *si) {
 
     return 0;
 }
+
+int soundio_dummy_set_virtual_clock(struct SoundIo *soundio, bool enabled) {
+    struct SoundIoPrivate *si = (struct SoundIoPrivate *)soundio;
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
+
+    if (soundio->current_backend != SoundIoBackendDummy)
+        return SoundIoErrorInvalid;
+
+    soundio_os_mutex_lock(sid->mutex);
+    if (sid->virtual_outstreams || sid->virtual_instreams) {
+        soundio_os_mutex_unlock(sid->mutex);
+        return SoundIoErrorInvalid;
+    }
+    sid->virtual_clock = enabled;
+    sid->virtual_time = 0.0;
+    soundio_os_mutex_unlock(sid->mutex);
+    return 0;
+}
+
+int soundio_dummy_advance(struct SoundIo *soundio, double seconds) {
+    struct SoundIoPrivate *si = (struct SoundIoPrivate *)soundio;
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
+
+    if (soundio->current_backend != SoundIoBackendDummy || seconds < 0.0)
+        return SoundIoErrorInvalid;
+
+    soundio_os_mutex_lock(sid->mutex);
+    if (!sid->virtual_clock) {
+        soundio_os_mutex_unlock(sid->mutex);
+        return SoundIoErrorInvalid;
+    }
+
+    // Every period that falls due runs in time order. Ties go to output
+    // streams first, so a period's playback is refilled before capture.
+    double target = sid->virtual_time + seconds;
+    for (;;) {
+        struct SoundIoOutStreamPrivate *next_os = NULL;
+        struct SoundIoInStreamPrivate *next_is = NULL;
+        double next = target;
+        for (struct SoundIoOutStreamPrivate *os = sid->virtual_outstreams; os; os = os->backend_data.dummy.virtual_next) {
+            double due = os->backend_data.dummy.next_period;
+            if (due < next || (due == next && !next_os)) {
+                next_os = os;
+                next = due;
+            }
+        }
+        for (struct SoundIoInStreamPrivate *is = sid->virtual_instreams; is; is = is->backend_data.dummy.virtual_next) {
+            double due = is->backend_data.dummy.next_period;
+            if (due < next || (due == next && !next_os && !next_is)) {
+                next_os = NULL;
+                next_is = is;
+                next = due;
+            }
+        }
+        if (!next_os && !next_is)
+            break;
+
+        sid->virtual_time = next;
+        if (next_os) {
+            struct SoundIoOutStreamDummy *osd = &next_os->backend_data.dummy;
+            if (osd->primed) {
+                playback_period(next_os, next);
+            } else {
+                playback_prime(next_os, next);
+                osd->primed = true;
+            }
+            osd->next_period = next + osd->period_duration;
+        } else {
+            struct SoundIoInStreamDummy *isd = &next_is->backend_data.dummy;
+            capture_period(next_is, next);
+            isd->next_period = next + isd->period_duration;
+        }
+    }
+    sid->virtual_time = target;
+
+    soundio_os_mutex_unlock(sid->mutex);
+    return 0;
+}
+
+double soundio_dummy_get_time(struct SoundIo *soundio) {
+    struct SoundIoPrivate *si = (struct SoundIoPrivate *)soundio;
+    struct SoundIoDummy *sid = &si->backend_data.dummy;
+
+    if (soundio->current_backend != SoundIoBackendDummy)
+        return 0.0;
+
+    soundio_os_mutex_lock(sid->mutex);
+    double time = sid->virtual_time;
+    soundio_os_mutex_unlock(sid->mutex);
+    return time;
+}
@@ -16,10 +16,20 @@
 struct SoundIoPrivate;
 int soundio_dummy_init(struct SoundIoPrivate *si);
 
+struct SoundIoOutStreamPrivate;
+struct SoundIoInStreamPrivate;
+
 struct SoundIoDummy {
     struct SoundIoOsMutex *mutex;
     struct SoundIoOsCond *cond;
     bool devices_emitted;
+
+    // Virtual clock, streams are run by soundio_dummy_advance instead of threads.
+    // The lists and the time are protected by mutex.
+    bool virtual_clock;
+    double virtual_time;
+    struct SoundIoOutStreamPrivate *virtual_outstreams;
+    struct SoundIoInStreamPrivate *virtual_instreams;
 };
 
 struct SoundIoDeviceDummy { int make_the_struct_not_empty; };
@@ -34,9 +44,15 @@ struct SoundIoOutStreamDummy {
     int write_frame_count;
     struct SoundIoRingBuffer ring_buffer;
     double playback_start_time;
+    double start_time;
+    long frames_consumed;
     struct SoundIoAtomicFlag clear_buffer_flag;
     struct SoundIoAtomicBool pause_requested;
     struct SoundIoChannelArea areas[SOUNDIO_MAX_CHANNELS];
+    // Virtual clock only
+    bool primed;
+    double next_period;
+    struct SoundIoOutStreamPrivate *virtual_next;
 };
 
 struct SoundIoInStreamDummy {
@@ -48,8 +64,13 @@ struct SoundIoInStreamDummy {
     int read_frame_count;
     int buffer_frame_count;
     struct SoundIoRingBuffer ring_buffer;
+    double start_time;
+    long frames_consumed;
     struct SoundIoAtomicBool pause_requested;
     struct SoundIoChannelArea areas[SOUNDIO_MAX_CHANNELS];
+    // Virtual clock only
+    double next_period;
+    struct SoundIoInStreamPrivate *virtual_next;
 };
 
 #endif
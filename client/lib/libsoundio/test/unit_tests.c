@@ -211,6 +211,105 @@ static void test_nearest_sample_rate(void) {
     assert(soundio_device_nearest_sample_rate(&device, 9999999) == 96000);
 }
 
+static long virtual_frames_written;
+static long virtual_frames_read;
+static int virtual_underflows;
+static int virtual_overflows;
+
+static void virtual_write_callback(struct SoundIoOutStream *outstream, int frame_count_min, int frame_count_max) {
+    int frames_left = frame_count_max;
+    while (frames_left > 0) {
+        struct SoundIoChannelArea *areas;
+        int frame_count = frames_left;
+        ok_or_panic(soundio_outstream_begin_write(outstream, &areas, &frame_count));
+        if (!frame_count)
+            break;
+        for (int frame = 0; frame < frame_count; frame += 1)
+            *(float *)(areas[0].ptr + areas[0].step * frame) = 0.0f;
+        ok_or_panic(soundio_outstream_end_write(outstream));
+        frames_left -= frame_count;
+        virtual_frames_written += frame_count;
+    }
+}
+
+static void virtual_read_callback(struct SoundIoInStream *instream, int frame_count_min, int frame_count_max) {
+    int frames_left = frame_count_max;
+    while (frames_left > 0) {
+        struct SoundIoChannelArea *areas;
+        int frame_count = frames_left;
+        ok_or_panic(soundio_instream_begin_read(instream, &areas, &frame_count));
+        if (!frame_count)
+            break;
+        ok_or_panic(soundio_instream_end_read(instream));
+        frames_left -= frame_count;
+        virtual_frames_read += frame_count;
+    }
+}
+
+static void virtual_underflow_callback(struct SoundIoOutStream *outstream) {
+    virtual_underflows += 1;
+}
+
+static void virtual_overflow_callback(struct SoundIoInStream *instream) {
+    virtual_overflows += 1;
+}
+
+static void test_dummy_virtual_clock(void) {
+    struct SoundIo *soundio = soundio_create();
+    assert(soundio);
+    ok_or_panic(soundio_connect_backend(soundio, SoundIoBackendDummy));
+    soundio_flush_events(soundio);
+    ok_or_panic(soundio_dummy_set_virtual_clock(soundio, true));
+
+    struct SoundIoDevice *out_device = soundio_get_output_device(soundio, soundio_default_output_device_index(soundio));
+    struct SoundIoDevice *in_device = soundio_get_input_device(soundio, soundio_default_input_device_index(soundio));
+    assert(out_device && in_device);
+
+    struct SoundIoOutStream *outstream = soundio_outstream_create(out_device);
+    outstream->format = SoundIoFormatFloat32NE;
+    outstream->sample_rate = 48000;
+    outstream->layout = *soundio_channel_layout_get_default(1);
+    outstream->software_latency = 0.02;
+    outstream->write_callback = virtual_write_callback;
+    outstream->underflow_callback = virtual_underflow_callback;
+    ok_or_panic(soundio_outstream_open(outstream));
+
+    struct SoundIoInStream *instream = soundio_instream_create(in_device);
+    instream->format = SoundIoFormatFloat32NE;
+    instream->sample_rate = 48000;
+    instream->layout = *soundio_channel_layout_get_default(1);
+    instream->software_latency = 0.02;
+    instream->read_callback = virtual_read_callback;
+    instream->overflow_callback = virtual_overflow_callback;
+    ok_or_panic(soundio_instream_open(instream));
+
+    ok_or_panic(soundio_outstream_start(outstream));
+    ok_or_panic(soundio_instream_start(instream));
+    // Nothing happens until the clock moves
+    assert(virtual_frames_written == 0);
+    assert(soundio_dummy_set_virtual_clock(soundio, false) == SoundIoErrorInvalid);
+
+    // An hour, in steps of a millisecond and then all at once
+    for (int i = 0; i < 1000; i += 1)
+        ok_or_panic(soundio_dummy_advance(soundio, 0.001));
+    ok_or_panic(soundio_dummy_advance(soundio, 3599.0));
+    assert(soundio_dummy_get_time(soundio) > 3599.999 && soundio_dummy_get_time(soundio) < 3600.001);
+
+    // Written ahead by at most the buffer, read behind by at most a period
+    long hour = 3600L * 48000;
+    long buffer_frames = outstream->software_latency * 48000 + 1;
+    assert(virtual_frames_written >= hour && virtual_frames_written <= hour + buffer_frames);
+    assert(virtual_frames_read <= hour && virtual_frames_read >= hour - 2 * 0.02 * 48000);
+    assert(virtual_underflows == 0);
+    assert(virtual_overflows == 0);
+
+    soundio_instream_destroy(instream);
+    soundio_outstream_destroy(outstream);
+    soundio_device_unref(in_device);
+    soundio_device_unref(out_device);
+    soundio_destroy(soundio);
+}
+
 struct Test {
     const char *name;
     void (*fn)(void);
@@ -223,6 +322,7 @@ static struct Test tests[] = {
     {"soundio_device_nearest_sample_rate", test_nearest_sample_rate},
     {"ring buffer basic", test_ring_buffer_basic},
     {"ring buffer threaded", test_ring_buffer_threaded},
+    {"dummy virtual clock", test_dummy_virtual_clock},
     {NULL, NULL},
 };
 
@@ -1,5 +1,6 @@
 #include "config.h"
 #include "logger.h"
+#include "voice_packets.h"
 #include <yaml-cpp/yaml.h>
 
 namespace Config {
@@ -9,6 +10,10 @@ std::string server_addr;
 uint server_port_text = 7065;
 uint server_port_voice = 7066;
 std::string avatar_path;
+VoiceCodecParams voice_codec = voice_profile_params(VoiceProfile::LOW_LATENCY);
+ResampleQuality resample_quality = ResampleQuality::MEDIUM;
+bool audio_realtime = false;
+DspSettings dsp;
 
 bool init(const std::string &configPath) {
     return readConfig(configPath);
@@ -24,6 +29,46 @@ bool readConfig(const std::string &configPath) {
         server_port_text = configFile["server_port_text"].as<uint>();
         server_port_voice = configFile["server_port_voice"].as<uint>();
         avatar_path = configFile["avatar_path"].as<std::string>();
+
+        // Optional voice codec settings, a profile first and then individual overrides
+        if (configFile["voice_profile"]) {
+            VoiceProfile profile;
+            std::string name = configFile["voice_profile"].as<std::string>();
+            if (voice_profile_from_name(name, profile)) {
+                voice_codec = voice_profile_params(profile);
+            } else {
+                LOG_WARNING("Unknown voice profile " + name);
+            }
+        }
+        if (configFile["voice_frame_ms"]) {
+            voice_codec.frame_samples = (uint)(configFile["voice_frame_ms"].as<double>() * 48);
+        }
+        if (configFile["voice_bitrate"]) {
+            voice_codec.bitrate = configFile["voice_bitrate"].as<uint>();
+        }
+        if (configFile["voice_complexity"]) {
+            voice_codec.complexity = configFile["voice_complexity"].as<uint>();
+        }
+        voice_codec = voice_codec_sanitize(voice_codec);
+
+        if (configFile["audio_resample_quality"]) {
+            std::string name = configFile["audio_resample_quality"].as<std::string>();
+            if (!resample_quality_from_name(name, resample_quality)) {
+                LOG_WARNING("Unknown resample quality " + name);
+            }
+        }
+        if (configFile["audio_realtime"]) {
+            audio_realtime = configFile["audio_realtime"].as<bool>();
+        }
+        if (configFile["audio_high_pass"]) {
+            dsp.high_pass = configFile["audio_high_pass"].as<bool>();
+        }
+        if (configFile["audio_noise_gate"]) {
+            dsp.noise_gate = configFile["audio_noise_gate"].as<bool>();
+        }
+        if (configFile["audio_agc"]) {
+            dsp.agc = configFile["audio_agc"].as<bool>();
+        }
         return true;
     } catch (YAML::BadFile) {
         LOG_ERROR("Corrupted file");
@@ -1,4 +1,7 @@
 #pragma once
+#include "common_data.h"
+#include "workers/dsp_chain.h"
+#include "workers/resampler.h"
 #include <string>
 
 typedef unsigned int uint;
@@ -10,6 +13,10 @@ extern std::string server_addr;
 extern uint server_port_text;
 extern uint server_port_voice;
 extern std::string avatar_path;
+extern VoiceCodecParams voice_codec; // What we ask the server for, it may settle on something else
+extern ResampleQuality resample_quality; // For audio devices that don't run at 48kHz
+extern bool audio_realtime;              // Real-time priority and locked memory for the audio threads
+extern DspSettings dsp;                  // Microphone processing before the encoder
 
 bool init(const std::string &configPath);
 bool readConfig(const std::string &configPath);
@@ -6,6 +6,7 @@
 #include "workers/periodic_10.h"
 #include "workers/socket_reader.h"
 #include "workers/socket_sender.h"
+#include "workers/voice_chat.h"
 #include <QApplication>
 #include <QStyleFactory>
 #include <QThread>
@@ -43,6 +44,7 @@ void startWorkers(int sock, MainWindow &mainwindow) {
     QObject::connect(receiver, &SocketReader::usersReady, &mainwindow, &MainWindow::updateUsers);
     QObject::connect(receiver, &SocketReader::newMessage, &mainwindow, &MainWindow::addMessage);
     QObject::connect(receiver, &SocketReader::usersImgsReady, &mainwindow, &MainWindow::onUsersImgsReady);
+    QObject::connect(receiver, &SocketReader::voiceSessionReady, &mainwindow, &MainWindow::onVoiceSessionReady);
     QObject::connect(thread2, &QThread::started, [receiver, sock]() {
         receiver->init(sock);
     });
@@ -221,7 +223,12 @@ QScrollBar::down-arrow:vertical {
     startWorkers(sock, window);
     window.init();
     window.show();
+
+    // Open the audio devices now so the first voice channel join is quick
+    VoiceChat::configureDsp(Config::dsp);
+    VoiceChat::warmUp(Config::voice_codec, Config::resample_quality, Config::audio_realtime);
     app.exec();
+    VoiceChat::shutdown();
 
     crossSockets::closeSocket(sock);
 
@@ -68,6 +68,20 @@ void MainWindow::requestChannelMessages() {
     emit sendPacket(h, payload);
 }
 
+void MainWindow::requestVoiceSession() {
+    std::vector<char> payload;
+    payload.reserve(sizeof(currentVoiceChannel) + sizeof(VoiceCodecParams));
+
+    const char *p_chId = reinterpret_cast<const char *>(&currentVoiceChannel);
+    payload.insert(payload.end(), p_chId, p_chId + sizeof(currentVoiceChannel));
+
+    const char *p_codec = reinterpret_cast<const char *>(&Config::voice_codec);
+    payload.insert(payload.end(), p_codec, p_codec + sizeof(VoiceCodecParams));
+
+    PacketHeader h = {(uint8_t)PacketType::VOICE_SESSION, static_cast<uint32_t>(payload.size())};
+    emit sendPacket(h, payload);
+}
+
 void MainWindow::requestUserImages() {
     PacketHeader h = {(uint8_t)PacketType::LIST_USER_IMGS, 0};
     emit sendPacket(h);
@@ -147,14 +161,14 @@ void MainWindow::addMessage(const MessageInfo &m) {
     ui->chatAreaLayout->addWidget(msg);
 }
 
-void MainWindow::startVoiceThread() {
+void MainWindow::startVoiceThread(const VoiceSessionInfo &session) {
     QThread *thread = new QThread();
     VoiceChat *vi = new VoiceChat();
 
     vi->moveToThread(thread);
 
-    QObject::connect(thread, &QThread::started, [vi, this]() {
-        vi->init(Config::server_addr, Config::server_port_voice, currentVoiceChannel);
+    QObject::connect(thread, &QThread::started, [vi, session]() {
+        vi->init(Config::server_addr, Config::server_port_voice, session, Config::resample_quality, Config::audio_realtime);
     });
 
     QObject::connect(this, &MainWindow::stopVC, vi, &VoiceChat::stop);
@@ -181,8 +195,9 @@ void MainWindow::switchChannel(QListWidgetItem *ch) {
             }
         }
 
+        // The voice thread starts once the server hands out a session
         currentVoiceChannel = ch->data(ChannelListRoles::ID).toInt();
-        startVoiceThread();
+        requestVoiceSession();
         ui->closeCall->setVisible(true);
     } else {
         currentChannel = ch->data(ChannelListRoles::ID).toInt();
@@ -210,6 +225,15 @@ void MainWindow::onVcClosed() {
     currentVoiceChannel = -1;
 }
 
+void MainWindow::onVoiceSessionReady(const VoiceSessionInfo &session) {
+    // Stale answer for a channel we already left
+    if ((int)session.channel != currentVoiceChannel) {
+        return;
+    }
+
+    startVoiceThread(session);
+}
+
 void MainWindow::onUsersImgsReady(const std::unordered_map<uint32_t, QPixmap> &m) {
     m_usersImgs = m;
 }
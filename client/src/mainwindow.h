@@ -39,8 +39,9 @@ class MainWindow : public QMainWindow {
     std::unordered_map<uint32_t, QPixmap> m_usersImgs;
 
     void requestChannelMessages();
+    void requestVoiceSession();
     void populateUsers();
-    void startVoiceThread();
+    void startVoiceThread(const VoiceSessionInfo &session);
     void requestUserImages();
 
   protected:
@@ -52,6 +53,7 @@ class MainWindow : public QMainWindow {
     void updateUsers(const std::vector<UserInfo> &u);
     void onUsersImgsReady(const std::unordered_map<uint32_t, QPixmap> &m);
     void onVcClosed();
+    void onVoiceSessionReady(const VoiceSessionInfo &session);
 
   private slots:
     void onReturnPressed();
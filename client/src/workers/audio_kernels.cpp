@@ -0,0 +1,416 @@
+#include "audio_kernels.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNELS_AVX2 // Built per function, the rest of the program doesn't need -mavx2
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Scalar, also finishes the tails of the SIMD versions
+
+void downmixScalar(const float *in, int channels, int frames, float *out) {
+    const float scale = 1.0f / channels;
+    for (int i = 0; i < frames; i++) {
+        float sum = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            sum += in[i * channels + c];
+        }
+        out[i] = sum * scale;
+    }
+}
+
+void fanoutScalar(const float *in, int frames, int channels, float *out) {
+    for (int i = 0; i < frames; i++) {
+        for (int c = 0; c < channels; c++) {
+            out[i * channels + c] = in[i];
+        }
+    }
+}
+
+void gainScalar(float *buf, int n, float g) {
+    for (int i = 0; i < n; i++) {
+        buf[i] *= g;
+    }
+}
+
+void rampScalar(float *buf, int n, float from, float step) {
+    for (int i = 0; i < n; i++) {
+        buf[i] *= from + step * i;
+    }
+}
+
+float peakScalar(const float *buf, int n) {
+    float peak = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float v = buf[i] < 0.0f ? -buf[i] : buf[i];
+        peak = v > peak ? v : peak;
+    }
+    return peak;
+}
+
+// libc already picks a vector memset, nothing to gain over it
+void silenceAll(float *out, int n) {
+    std::memset(out, 0, n * sizeof(float));
+}
+
+float dotScalar(const float *a, const float *b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+const AudioKernelSet scalar_set = {"scalar", downmixScalar, fanoutScalar, gainScalar, rampScalar, peakScalar, silenceAll, dotScalar};
+
+#ifdef KERNELS_X86
+
+void downmixSse2(const float *in, int channels, int frames, float *out) {
+    int i = 0;
+    if (channels == 1) {
+        std::memcpy(out, in, frames * sizeof(float));
+        return;
+    }
+    if (channels == 2) {
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; i + 4 <= frames; i += 4) {
+            __m128 a = _mm_loadu_ps(in + 2 * i);     // L0 R0 L1 R1
+            __m128 b = _mm_loadu_ps(in + 2 * i + 4); // L2 R2 L3 R3
+            __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+        }
+    }
+    downmixScalar(in + i * channels, channels, frames - i, out + i);
+}
+
+void fanoutSse2(const float *in, int frames, int channels, float *out) {
+    int i = 0;
+    if (channels == 1) {
+        std::memcpy(out, in, frames * sizeof(float));
+        return;
+    }
+    if (channels == 2) {
+        for (; i + 4 <= frames; i += 4) {
+            __m128 x = _mm_loadu_ps(in + i);
+            _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(x, x));
+            _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(x, x));
+        }
+    }
+    fanoutScalar(in + i, frames - i, channels, out + i * channels);
+}
+
+void gainSse2(float *buf, int n, float g) {
+    int i = 0;
+    const __m128 vg = _mm_set1_ps(g);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), vg));
+    }
+    gainScalar(buf + i, n - i, g);
+}
+
+// Gain is worked out from the index rather than accumulated, so it matches the scalar version
+void rampSse2(float *buf, int n, float from, float step) {
+    int i = 0;
+    const __m128 vfrom = _mm_set1_ps(from);
+    const __m128 vstep = _mm_set1_ps(step);
+    __m128 idx = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 g = _mm_add_ps(vfrom, _mm_mul_ps(vstep, idx));
+        _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+        idx = _mm_add_ps(idx, four);
+    }
+    for (; i < n; i++) {
+        buf[i] *= from + step * i;
+    }
+}
+
+float peakSse2(const float *buf, int n) {
+    int i = 0;
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_max_ps(acc, _mm_and_ps(_mm_loadu_ps(buf + i), abs_mask));
+    }
+    acc = _mm_max_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_max_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    float tail = peakScalar(buf + i, n - i);
+    float peak = _mm_cvtss_f32(acc);
+    return tail > peak ? tail : peak;
+}
+
+float dotSse2(const float *a, const float *b, int n) {
+    int i = 0;
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc) + dotScalar(a + i, b + i, n - i);
+}
+
+const AudioKernelSet sse2_set = {"sse2", downmixSse2, fanoutSse2, gainSse2, rampSse2, peakSse2, silenceAll, dotSse2};
+
+#ifdef KERNELS_AVX2
+
+// Tails stay inline, calling into the SSE versions with dirty upper halves costs more than the loop
+
+__attribute__((target("avx2"))) void downmixAvx2(const float *in, int channels, int frames, float *out) {
+    if (channels != 2) {
+        downmixSse2(in, channels, frames, out);
+        return;
+    }
+
+    int i = 0;
+    const __m256 half = _mm256_set1_ps(0.5f);
+    for (; i + 8 <= frames; i += 8) {
+        __m256 a = _mm256_loadu_ps(in + 2 * i);
+        __m256 b = _mm256_loadu_ps(in + 2 * i + 8);
+        // Shuffles stay within 128 bit lanes, so the sum comes out as frames 0 1 4 5 2 3 6 7
+        __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 sum = _mm256_mul_ps(_mm256_add_ps(l, r), half);
+        sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(out + i, sum);
+    }
+    for (; i < frames; i++) {
+        out[i] = (in[2 * i] + in[2 * i + 1]) * 0.5f;
+    }
+}
+
+__attribute__((target("avx2"))) void fanoutAvx2(const float *in, int frames, int channels, float *out) {
+    if (channels != 2) {
+        fanoutSse2(in, frames, channels, out);
+        return;
+    }
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 x = _mm256_loadu_ps(in + i);
+        __m256 lo = _mm256_unpacklo_ps(x, x); // 0 0 1 1 | 4 4 5 5
+        __m256 hi = _mm256_unpackhi_ps(x, x); // 2 2 3 3 | 6 6 7 7
+        _mm256_storeu_ps(out + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(out + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    for (; i < frames; i++) {
+        out[2 * i] = out[2 * i + 1] = in[i];
+    }
+}
+
+__attribute__((target("avx2"))) void gainAvx2(float *buf, int n, float g) {
+    int i = 0;
+    const __m256 vg = _mm256_set1_ps(g);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(buf + i, _mm256_mul_ps(_mm256_loadu_ps(buf + i), vg));
+    }
+    for (; i < n; i++) {
+        buf[i] *= g;
+    }
+}
+
+__attribute__((target("avx2"))) void rampAvx2(float *buf, int n, float from, float step) {
+    int i = 0;
+    const __m256 vfrom = _mm256_set1_ps(from);
+    const __m256 vstep = _mm256_set1_ps(step);
+    __m256 idx = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 eight = _mm256_set1_ps(8.0f);
+    for (; i + 8 <= n; i += 8) {
+        __m256 g = _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, idx));
+        _mm256_storeu_ps(buf + i, _mm256_mul_ps(_mm256_loadu_ps(buf + i), g));
+        idx = _mm256_add_ps(idx, eight);
+    }
+    for (; i < n; i++) {
+        buf[i] *= from + step * i;
+    }
+}
+
+__attribute__((target("avx2"))) float peakAvx2(const float *buf, int n) {
+    int i = 0;
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 acc8 = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc8 = _mm256_max_ps(acc8, _mm256_and_ps(_mm256_loadu_ps(buf + i), abs_mask));
+    }
+    __m128 acc = _mm_max_ps(_mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1));
+    acc = _mm_max_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_max_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    float peak = _mm_cvtss_f32(acc);
+    for (; i < n; i++) {
+        float v = buf[i] < 0.0f ? -buf[i] : buf[i];
+        peak = v > peak ? v : peak;
+    }
+    return peak;
+}
+
+__attribute__((target("avx2"))) float dotAvx2(const float *a, const float *b, int n) {
+    int i = 0;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+    __m256 acc8 = _mm256_add_ps(acc0, acc1);
+    __m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    float sum = _mm_cvtss_f32(acc);
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+const AudioKernelSet avx2_set = {"avx2", downmixAvx2, fanoutAvx2, gainAvx2, rampAvx2, peakAvx2, silenceAll, dotAvx2};
+
+#endif // KERNELS_AVX2
+#endif // KERNELS_X86
+
+#ifdef KERNELS_NEON
+
+void downmixNeon(const float *in, int channels, int frames, float *out) {
+    int i = 0;
+    if (channels == 1) {
+        std::memcpy(out, in, frames * sizeof(float));
+        return;
+    }
+    if (channels == 2) {
+        for (; i + 4 <= frames; i += 4) {
+            float32x4x2_t lr = vld2q_f32(in + 2 * i); // Deinterleaves on load
+            vst1q_f32(out + i, vmulq_n_f32(vaddq_f32(lr.val[0], lr.val[1]), 0.5f));
+        }
+    }
+    downmixScalar(in + i * channels, channels, frames - i, out + i);
+}
+
+void fanoutNeon(const float *in, int frames, int channels, float *out) {
+    int i = 0;
+    if (channels == 1) {
+        std::memcpy(out, in, frames * sizeof(float));
+        return;
+    }
+    if (channels == 2) {
+        for (; i + 4 <= frames; i += 4) {
+            float32x4_t x = vld1q_f32(in + i);
+            float32x4x2_t lr = {{x, x}};
+            vst2q_f32(out + 2 * i, lr); // Interleaves on store
+        }
+    }
+    fanoutScalar(in + i, frames - i, channels, out + i * channels);
+}
+
+void gainNeon(float *buf, int n, float g) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(buf + i, vmulq_n_f32(vld1q_f32(buf + i), g));
+    }
+    gainScalar(buf + i, n - i, g);
+}
+
+void rampNeon(float *buf, int n, float from, float step) {
+    int i = 0;
+    const float32x4_t vfrom = vdupq_n_f32(from);
+    const float init[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float32x4_t idx = vld1q_f32(init);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t g = vaddq_f32(vfrom, vmulq_n_f32(idx, step));
+        vst1q_f32(buf + i, vmulq_f32(vld1q_f32(buf + i), g));
+        idx = vaddq_f32(idx, vdupq_n_f32(4.0f));
+    }
+    for (; i < n; i++) {
+        buf[i] *= from + step * i;
+    }
+}
+
+float peakNeon(const float *buf, int n) {
+    int i = 0;
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        acc = vmaxq_f32(acc, vabsq_f32(vld1q_f32(buf + i)));
+    }
+    float32x2_t pair = vpmax_f32(vget_low_f32(acc), vget_high_f32(acc));
+    float peak = vget_lane_f32(vpmax_f32(pair, pair), 0);
+    float tail = peakScalar(buf + i, n - i);
+    return tail > peak ? tail : peak;
+}
+
+float dotNeon(const float *a, const float *b, int n) {
+    int i = 0;
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0) + dotScalar(a + i, b + i, n - i);
+}
+
+const AudioKernelSet neon_set = {"neon", downmixNeon, fanoutNeon, gainNeon, rampNeon, peakNeon, silenceAll, dotNeon};
+
+#endif // KERNELS_NEON
+
+const AudioKernelSet &pick() {
+#ifdef KERNELS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2_set;
+    }
+#endif
+#if defined(KERNELS_X86)
+    return sse2_set; // Baseline on x86-64
+#elif defined(KERNELS_NEON)
+    return neon_set; // Baseline on AArch64
+#else
+    return scalar_set;
+#endif
+}
+
+// Chosen before main, so the audio threads never race on it
+const AudioKernelSet &chosen = pick();
+
+} // namespace
+
+namespace AudioKernels {
+
+const AudioKernelSet &active() {
+    return chosen;
+}
+
+int available(const AudioKernelSet **sets, int max) {
+    int n = 0;
+    auto add = [&](const AudioKernelSet &s) {
+        if (n < max) {
+            sets[n++] = &s;
+        }
+    };
+
+    add(scalar_set);
+#ifdef KERNELS_X86
+    add(sse2_set);
+#ifdef KERNELS_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        add(avx2_set);
+    }
+#endif
+#endif
+#ifdef KERNELS_NEON
+    add(neon_set);
+#endif
+    return n;
+}
+
+} // namespace AudioKernels
@@ -0,0 +1,45 @@
+#pragma once
+
+// Sample loops run on the real-time audio threads. Every kernel has a scalar
+// version and SIMD ones (SSE2, AVX2, NEON), the best one the CPU supports is
+// picked once at startup. Buffers are float32, interleaved where there is more
+// than one channel, and need no particular alignment.
+struct AudioKernelSet {
+    const char *name;
+    void (*downmix)(const float *in, int channels, int frames, float *out); // Average of the channels
+    void (*fanout)(const float *in, int frames, int channels, float *out);  // Mono sample to every channel
+    void (*gain)(float *buf, int n, float gain);
+    void (*ramp)(float *buf, int n, float from, float step); // Gain of from + step * i on sample i
+    float (*peak)(const float *buf, int n);                   // Largest absolute value
+    void (*silence)(float *out, int n);
+    float (*dot)(const float *a, const float *b, int n); // FIR taps
+};
+
+namespace AudioKernels {
+const AudioKernelSet &active();
+
+// Every set this CPU can run, scalar first, for benchmarks
+int available(const AudioKernelSet **sets, int max);
+
+inline void downmix(const float *in, int channels, int frames, float *out) {
+    active().downmix(in, channels, frames, out);
+}
+inline void fanout(const float *in, int frames, int channels, float *out) {
+    active().fanout(in, frames, channels, out);
+}
+inline void gain(float *buf, int n, float g) {
+    active().gain(buf, n, g);
+}
+inline void ramp(float *buf, int n, float from, float step) {
+    active().ramp(buf, n, from, step);
+}
+inline float peak(const float *buf, int n) {
+    return active().peak(buf, n);
+}
+inline void silence(float *out, int n) {
+    active().silence(out, n);
+}
+inline float dot(const float *a, const float *b, int n) {
+    return active().dot(a, b, n);
+}
+} // namespace AudioKernels
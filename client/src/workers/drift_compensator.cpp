@@ -0,0 +1,76 @@
+#include "drift_compensator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define SAMPLE_RATE 48000
+#define HISTORY 3 // Samples kept from the previous block for cubic interpolation
+
+#define MAX_CORRECTION 0.002 // 2000 ppm, far past real clock drift and still inaudible
+#define FILL_SMOOTHING 1.0   // s, averages out the device's bursty reads
+
+// PI gains on the fill error in seconds
+#define DRIFT_KP 0.1
+#define DRIFT_KI 0.01
+
+void DriftCompensator::init(int max_frames, int target_fill) {
+    target = target_fill;
+    fill = -1.0;
+    integral = 0.0;
+    step = 1.0;
+    buf.assign(HISTORY + max_frames, 0.0f);
+    pos = -2.0;
+}
+
+int DriftCompensator::maxOutput(int frames) {
+    return (int)(frames / (1.0 - MAX_CORRECTION)) + 2;
+}
+
+// Catmull-Rom between buf[i] and buf[i + 1] of the block, which starts HISTORY samples in.
+// At a ratio this close to 1 it is transparent for speech and costs a few flops per sample
+int DriftCompensator::process(const float *in, int frames, float *out) {
+    std::memcpy(buf.data() + HISTORY, in, frames * sizeof(float));
+    const float *x = buf.data() + HISTORY;
+
+    int n = 0;
+    while (pos < frames - 2) {
+        int i = (int)std::floor(pos);
+        float f = (float)(pos - i);
+        float ym1 = x[i - 1], y0 = x[i], y1 = x[i + 1], y2 = x[i + 2];
+
+        float c1 = 0.5f * (y1 - ym1);
+        float c2 = ym1 - 2.5f * y0 + 2.0f * y1 - 0.5f * y2;
+        float c3 = 0.5f * (y2 - ym1) + 1.5f * (y0 - y1);
+        out[n++] = ((c3 * f + c2) * f + c1) * f + y0;
+
+        pos += step;
+    }
+
+    pos -= frames;
+    std::memmove(buf.data(), buf.data() + frames, HISTORY * sizeof(float));
+    return n;
+}
+
+void DriftCompensator::update(int current, int elapsed) {
+    if (fill < 0.0) {
+        fill = current;
+        return;
+    }
+
+    double dt = (double)elapsed / SAMPLE_RATE;
+    fill += (current - fill) * std::min(1.0, dt / FILL_SMOOTHING);
+
+    // Too full means the device is slower than us: consume input faster, produce less
+    double error = (fill - target) / SAMPLE_RATE;
+    integral = std::clamp(integral + error * dt, -MAX_CORRECTION / DRIFT_KI, MAX_CORRECTION / DRIFT_KI);
+    double correction = std::clamp(DRIFT_KP * error + DRIFT_KI * integral, -MAX_CORRECTION, MAX_CORRECTION);
+    step = 1.0 + correction;
+}
+
+double DriftCompensator::ppm() const {
+    return (step - 1.0) * 1e6;
+}
+
+int DriftCompensator::smoothedFill() const {
+    return (int)fill;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+
+// Keeps the playback ring at a steady fill although the device plays on its
+// own clock. The fill level is smoothed into a drift estimate that nudges the
+// rate of a fine-grained resampler sitting between the mixer and the ring, so
+// a few hundred ppm of clock difference never piles up into drops or underflows.
+class DriftCompensator {
+  public:
+    void init(int max_frames, int target_fill); // Largest block process() gets, fill to hold in samples
+    int process(const float *in, int frames, float *out); // Writes at most maxOutput(frames) samples
+    void update(int fill, int elapsed);                   // Ring fill after a write, elapsed samples since the last one
+    static int maxOutput(int frames);
+
+    double ppm() const; // Current correction, positive when the device plays slower than we mix
+    int smoothedFill() const;
+
+  private:
+    int target = 0;
+    double fill = -1.0; // Smoothed, negative until the first update
+    double integral = 0.0;
+    double step = 1.0; // Input samples consumed per output sample
+
+    // Resampler
+    std::vector<float> buf; // 3 samples of history, then the current block
+    double pos = -2.0;      // Next output position, in samples of the current block
+};
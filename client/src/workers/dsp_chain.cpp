@@ -0,0 +1,224 @@
+#include "dsp_chain.h"
+#include "audio_kernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#define HIGH_PASS_HZ 80.0f
+
+// Noise gate, levels are mean square over a block
+#define GATE_BLOCK 120            // 2.5ms, how often the gate decides
+#define GATE_OPEN 1.6e-5f         // -48dBFS
+#define GATE_CLOSE 4.0e-6f        // -54dBFS, stays open down to here
+#define GATE_HOLD 4800            // 100ms open after the last loud block
+#define GATE_FLOOR 0.0316f        // -30dB while closed, quieter than that sounds like a dropout
+#define GATE_RELEASE_SAMPLES 2400 // 50ms to close all the way
+
+// AGC
+#define AGC_TARGET 0.01f          // -20dBFS RMS, as mean square
+#define AGC_MIN_LEVEL 1.0e-5f     // -50dBFS, never adapt to anything quieter
+#define AGC_MIN_GAIN 0.25f        // -12dB
+#define AGC_MAX_GAIN 8.0f         // +18dB
+#define AGC_ATTACK_SAMPLES 4800   // 100ms, coming down on a loud talker
+#define AGC_RELEASE_SAMPLES 96000 // 2s, creeping back up
+#define AGC_CEILING 0.95f         // Peaks are held under this
+
+static const char *stage_names[] = {"high-pass", "noise gate", "agc"};
+static_assert(sizeof(stage_names) / sizeof(stage_names[0]) == (int)DspStage::COUNT, "A name for every stage");
+
+void HighPassFilter::init(float cutoff_hz, int sample_rate) {
+    // RBJ cookbook high-pass at Q = 1/sqrt(2)
+    float w0 = 2.0f * (float)M_PI * cutoff_hz / sample_rate;
+    float cosw = std::cos(w0);
+    float alpha = std::sin(w0) / (2.0f * (float)M_SQRT1_2);
+    float a0 = 1.0f + alpha;
+
+    b0 = (1.0f + cosw) / 2.0f / a0;
+    b1 = -(1.0f + cosw) / a0;
+    b2 = b0;
+    a1 = -2.0f * cosw / a0;
+    a2 = (1.0f - alpha) / a0;
+    reset();
+}
+
+void HighPassFilter::process(float *pcm, int n) {
+    float s1 = z1, s2 = z2;
+    for (int i = 0; i < n; i++) {
+        float x = pcm[i];
+        float y = b0 * x + s1;
+        s1 = b1 * x - a1 * y + s2;
+        s2 = b2 * x - a2 * y;
+        pcm[i] = y;
+    }
+
+    // Silence would otherwise decay the state into denormals, which are slow on x86
+    z1 = std::fabs(s1) < 1e-20f ? 0.0f : s1;
+    z2 = std::fabs(s2) < 1e-20f ? 0.0f : s2;
+}
+
+void HighPassFilter::reset() {
+    z1 = z2 = 0.0f;
+}
+
+void NoiseGate::process(float *pcm, int n) {
+    for (int i = 0; i < n; i += GATE_BLOCK) {
+        float *block = pcm + i;
+        int m = std::min(GATE_BLOCK, n - i);
+        float level = AudioKernels::dot(block, block, m) / m;
+
+        if (level > GATE_OPEN || (hold > 0 && level > GATE_CLOSE)) {
+            hold = GATE_HOLD;
+        } else {
+            hold = std::max(0, hold - m);
+        }
+
+        // Open within a block, close over the release time
+        float next = 1.0f;
+        if (hold == 0) {
+            next = std::max(GATE_FLOOR, gain * std::exp(std::log(GATE_FLOOR) * m / GATE_RELEASE_SAMPLES));
+        }
+
+        if (gain != 1.0f || next != 1.0f) {
+            AudioKernels::ramp(block, m, gain, (next - gain) / m);
+        }
+        gain = next;
+    }
+}
+
+void NoiseGate::reset() {
+    gain = 1.0f;
+    hold = 0;
+}
+
+bool NoiseGate::open() const {
+    return hold > 0;
+}
+
+void AutoGain::process(float *pcm, int n, bool speech) {
+    float next = gain;
+
+    // Only speech moves the gain, so pauses don't get pumped up to speech level
+    float level = AudioKernels::dot(pcm, pcm, n) / n;
+    if (speech && level > AGC_MIN_LEVEL) {
+        float wanted = std::clamp(std::sqrt(AGC_TARGET / level), AGC_MIN_GAIN, AGC_MAX_GAIN);
+        int time = wanted < gain ? AGC_ATTACK_SAMPLES : AGC_RELEASE_SAMPLES;
+        next = gain + (wanted - gain) * (1.0f - std::exp(-(float)n / time));
+    }
+
+    // Attack instantly when a peak would clip, ramp otherwise
+    float start = gain;
+    float peak = AudioKernels::peak(pcm, n);
+    if (peak * next > AGC_CEILING) {
+        next = AGC_CEILING / peak;
+        start = std::min(start, next);
+    }
+
+    if (start != 1.0f || next != 1.0f) {
+        AudioKernels::ramp(pcm, n, start, (next - start) / n);
+    }
+    gain = next;
+}
+
+void AutoGain::reset() {
+    gain = 1.0f;
+}
+
+float AutoGain::gainDb() const {
+    return 20.0f * std::log10(gain);
+}
+
+void DspChain::init(int sample_rate) {
+    high_pass.init(HIGH_PASS_HZ, sample_rate);
+    reset();
+}
+
+void DspChain::configure(const DspSettings &settings) {
+    timing[(int)DspStage::HIGH_PASS].enabled.store(settings.high_pass);
+    timing[(int)DspStage::NOISE_GATE].enabled.store(settings.noise_gate);
+    timing[(int)DspStage::AGC].enabled.store(settings.agc);
+}
+
+void DspChain::run(DspStage stage, float *pcm, int n) {
+    switch (stage) {
+    case DspStage::HIGH_PASS:
+        high_pass.process(pcm, n);
+        break;
+    case DspStage::NOISE_GATE:
+        gate.process(pcm, n);
+        break;
+    case DspStage::AGC:
+        // Without the gate there is nothing to tell pauses apart, AGC falls back on its level floor
+        agc.process(pcm, n, !timing[(int)DspStage::NOISE_GATE].enabled.load(std::memory_order_relaxed) || gate.open());
+        break;
+    default:
+        break;
+    }
+}
+
+void DspChain::process(float *pcm, int n) {
+    for (int i = 0; i < (int)DspStage::COUNT; i++) {
+        Timing &t = timing[i];
+        bool enabled = t.enabled.load(std::memory_order_relaxed);
+
+        // A stage coming back starts from scratch rather than from whatever it last saw
+        if (enabled && !t.was_enabled) {
+            resetStage((DspStage)i);
+        }
+        t.was_enabled = enabled;
+        if (!enabled) {
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        run((DspStage)i, pcm, n);
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        t.frames++;
+        t.total_ns += ns;
+        t.max_ns = std::max(t.max_ns, ns);
+    }
+}
+
+void DspChain::resetStage(DspStage stage) {
+    switch (stage) {
+    case DspStage::HIGH_PASS:
+        high_pass.reset();
+        break;
+    case DspStage::NOISE_GATE:
+        gate.reset();
+        break;
+    case DspStage::AGC:
+        agc.reset();
+        break;
+    default:
+        break;
+    }
+}
+
+void DspChain::reset() {
+    for (int i = 0; i < (int)DspStage::COUNT; i++) {
+        resetStage((DspStage)i);
+        timing[i].was_enabled = timing[i].enabled.load();
+    }
+}
+
+std::vector<DspStageStats> DspChain::stats() {
+    std::vector<DspStageStats> all;
+    for (int i = 0; i < (int)DspStage::COUNT; i++) {
+        Timing &t = timing[i];
+        DspStageStats s;
+        s.name = stage_names[i];
+        s.enabled = t.enabled.load(std::memory_order_relaxed);
+        s.frames = t.frames;
+        s.avg_us = t.frames ? t.total_ns / 1000.0 / t.frames : 0.0;
+        s.max_us = t.max_ns / 1000.0;
+        all.push_back(s);
+
+        t.frames = t.total_ns = t.max_ns = 0;
+    }
+    return all;
+}
+
+float DspChain::agcGainDb() const {
+    return agc.gainDb();
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Stages in the order they run
+enum class DspStage { HIGH_PASS, NOISE_GATE, AGC, COUNT };
+
+struct DspSettings {
+    bool high_pass = true;  // Rumble, handling noise and mains hum below ~80Hz
+    bool noise_gate = true; // Keyboard and room noise between words
+    bool agc = true;        // Evens out quiet and loud microphones
+};
+
+struct DspStageStats {
+    const char *name;
+    bool enabled;
+    uint64_t frames; // Processed since the last call
+    double avg_us;
+    double max_us;
+};
+
+// Second order Butterworth high-pass. The one stage that can't be vectorized,
+// each output depends on the last, but it is only a handful of flops per sample.
+class HighPassFilter {
+  public:
+    void init(float cutoff_hz, int sample_rate);
+    void process(float *pcm, int n);
+    void reset();
+
+  private:
+    float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+    float z1 = 0.0f, z2 = 0.0f; // Transposed direct form II state
+};
+
+// Attenuates the microphone while it stays below a level, measured over short
+// blocks with hysteresis and a hold so words aren't chopped.
+class NoiseGate {
+  public:
+    void process(float *pcm, int n);
+    void reset();
+    bool open() const;
+
+  private:
+    float gain = 1.0f;
+    int hold = 0; // Samples left before the gate may start closing
+};
+
+// Slow automatic gain towards a speech level, never boosting while the gate
+// holds the signal down and never pushing peaks into clipping.
+class AutoGain {
+  public:
+    void process(float *pcm, int n, bool speech);
+    void reset();
+    float gainDb() const;
+
+  private:
+    float gain = 1.0f;
+};
+
+// Processing between capture and the encoder: high-pass, noise gate, then AGC.
+// Runs in place on the sender thread one encoder frame at a time and never
+// allocates. Stages can be switched off from any thread, and each times itself
+// so the chain can be held against the frame budget.
+class DspChain {
+  public:
+    void init(int sample_rate);
+    void configure(const DspSettings &settings); // Any thread, applies from the next frame
+    void process(float *pcm, int n);
+    void reset(); // New session, not while process() runs
+    std::vector<DspStageStats> stats(); // Since the last call, same thread as process()
+    float agcGainDb() const;
+
+  private:
+    struct Timing {
+        std::atomic<bool> enabled{true};
+        bool was_enabled = true; // As of the last frame, only seen by process()
+        uint64_t frames = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+    };
+
+    HighPassFilter high_pass;
+    NoiseGate gate;
+    AutoGain agc;
+    std::array<Timing, (int)DspStage::COUNT> timing;
+
+    void run(DspStage stage, float *pcm, int n);
+    void resetStage(DspStage stage);
+};
@@ -0,0 +1,124 @@
+#include "encoder_control.h"
+#include "crossSockets.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#define ADJUST_INTERVAL_MS 1000 // Reports come in about once a second
+#define MIN_BITRATE 12000       // Below this speech falls apart
+#define FEC_MIN_FRAME 480       // In-band FEC needs SILK, which needs 10ms+ frames
+
+// Loss thresholds
+#define LOSS_HIGH 0.10f    // Back off the bitrate above this
+#define LOSS_LOW 0.02f     // Grow the bitrate below this, FEC turns on above it
+#define LOSS_FEC_OFF 0.005f
+#define MAX_LOSS_PERC 30
+
+#define BITRATE_DECREASE 0.85f
+#define BITRATE_INCREASE 0.05f // Of the negotiated bitrate per adjustment
+#define LOSS_RELEASE 0.2f      // Loss estimate falls this fraction of the way per adjustment
+
+static inline int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EncoderControl::init(const VoiceCodecParams &codec) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    negotiated = codec;
+    settings = {codec.bitrate, codec.frame_samples, false, 0};
+    changed = false;
+    smoothed_loss = 0.0f;
+    worst_loss = 0.0f;
+    last_adjust = std::chrono::steady_clock::now();
+    rtt_ms = -1;
+    for (auto &t : sent_us) {
+        t.store(0, std::memory_order_relaxed);
+    }
+}
+
+void EncoderControl::onSent(uint16_t seq) {
+    sent_us[seq % sent_us.size()].store(now_us(), std::memory_order_relaxed);
+}
+
+void EncoderControl::onReport(const VoiceReportBlock &block) {
+    // Round trip: since we sent their newest packet, minus how long they sat on it
+    int64_t sent = sent_us[ntohs(block.last_seq) % sent_us.size()].load(std::memory_order_relaxed);
+    int64_t rtt = sent ? now_us() - sent - (int64_t)ntohl(block.delay) : -1;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (rtt >= 0) {
+        rtt_ms = (int)(rtt / 1000);
+    }
+
+    worst_loss = std::max(worst_loss, block.loss / 256.0f);
+
+    if (std::chrono::steady_clock::now() - last_adjust >= std::chrono::milliseconds(ADJUST_INTERVAL_MS)) {
+        adjust();
+    }
+}
+
+// Loss attacks at once and releases slowly, so one clean report doesn't undo the protection
+void EncoderControl::adjust() {
+    if (worst_loss > smoothed_loss) {
+        smoothed_loss = worst_loss;
+    } else {
+        smoothed_loss += (worst_loss - smoothed_loss) * LOSS_RELEASE;
+    }
+    worst_loss = 0.0f;
+    last_adjust = std::chrono::steady_clock::now();
+
+    EncoderSettings next = settings;
+
+    if (smoothed_loss > LOSS_HIGH) {
+        next.bitrate = std::max<uint32_t>(MIN_BITRATE, (uint32_t)(next.bitrate * BITRATE_DECREASE));
+    } else if (smoothed_loss < LOSS_LOW) {
+        next.bitrate = std::min(negotiated.bitrate, next.bitrate + (uint32_t)(negotiated.bitrate * BITRATE_INCREASE));
+    }
+    next.bitrate = std::min(next.bitrate, negotiated.bitrate);
+
+    if (smoothed_loss > LOSS_LOW) {
+        next.fec = true;
+    } else if (smoothed_loss < LOSS_FEC_OFF) {
+        next.fec = false;
+    }
+
+    next.loss_perc = next.fec ? std::min(MAX_LOSS_PERC, (int)std::ceil(smoothed_loss * 100.0f)) : 0;
+    next.frame_samples = next.fec ? std::max<uint32_t>(negotiated.frame_samples, FEC_MIN_FRAME) : negotiated.frame_samples;
+
+    if (next.bitrate != settings.bitrate || next.fec != settings.fec || next.loss_perc != settings.loss_perc ||
+        next.frame_samples != settings.frame_samples) {
+        LOG_DEBUG("Encoder: loss " + std::to_string(smoothed_loss * 100.0f) + "% -> " + std::to_string(next.bitrate) +
+                  "bps, FEC " + (next.fec ? "on (" + std::to_string(next.loss_perc) + "%)" : std::string("off")) +
+                  ", " + std::to_string(next.frame_samples) + " sample frames");
+        settings = next;
+        changed = true;
+    }
+}
+
+bool EncoderControl::poll(EncoderSettings &out) {
+    // Polled by the sender every frame, a change can wait for the next one rather than block it
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return false;
+    }
+
+    if (!changed) {
+        return false;
+    }
+    out = settings;
+    changed = false;
+    return true;
+}
+
+float EncoderControl::loss() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return smoothed_loss;
+}
+
+int EncoderControl::rttMs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return rtt_ms;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "common_data.h"
+#include "voice_packets.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+struct EncoderSettings {
+    uint32_t bitrate = 0;
+    uint32_t frame_samples = 0;
+    bool fec = false;
+    int loss_perc = 0; // Expected loss handed to Opus, sizes the FEC it adds
+};
+
+// Steers our encoder from the receiver reports listeners send back about us.
+// Loss pulls the bitrate down and turns on in-band FEC, a clean path lets both
+// recover. onSent() is called by the sender, onReport() by the network thread
+// and poll() by the sender once per frame.
+class EncoderControl {
+  public:
+    void init(const VoiceCodecParams &negotiated);
+    void onSent(uint16_t seq);
+    void onReport(const VoiceReportBlock &block);
+    bool poll(EncoderSettings &settings); // True when the encoder should change
+    float loss();  // Smoothed, 0..1
+    int rttMs();   // Last round trip measured through a report, -1 before one arrives
+
+  private:
+    std::mutex mutex;
+    VoiceCodecParams negotiated{};
+    EncoderSettings settings;
+    bool changed = false;
+
+    float smoothed_loss = 0.0f;
+    float worst_loss = 0.0f; // Worst listener since the last adjustment
+    std::chrono::steady_clock::time_point last_adjust;
+    int rtt_ms = -1;
+
+    // Send times by sequence number, for the round trip
+    std::array<std::atomic<int64_t>, 1024> sent_us{};
+
+    void adjust();
+};
@@ -0,0 +1,139 @@
+#include "frame_queue.h"
+#include "logger.h"
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static size_t granularity() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+bool MirroredMemory::init(size_t min_bytes) {
+    size_t page = granularity();
+    size_t bytes = (min_bytes + page - 1) / page * page;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)(bytes * 2), NULL);
+    if (!file) {
+        LOG_ERROR("CreateFileMapping failed");
+        return false;
+    }
+
+    // Find a hole big enough for both views, then map into it. Another thread
+    // may take the hole in between, in which case look for a new one
+    for (;;) {
+        char *hole = (char *)MapViewOfFile(file, FILE_MAP_ALL_ACCESS, 0, 0, bytes * 2);
+        if (!hole) {
+            LOG_ERROR("MapViewOfFile failed");
+            CloseHandle(file);
+            return false;
+        }
+        UnmapViewOfFile(hole);
+
+        char *first = (char *)MapViewOfFileEx(file, FILE_MAP_ALL_ACCESS, 0, 0, bytes, hole);
+        if (first != hole) {
+            if (GetLastError() == ERROR_INVALID_ADDRESS) {
+                continue;
+            }
+            LOG_ERROR("MapViewOfFileEx failed");
+            CloseHandle(file);
+            return false;
+        }
+
+        char *second = (char *)MapViewOfFileEx(file, FILE_MAP_ALL_ACCESS, 0, 0, bytes, hole + bytes);
+        if (second != hole + bytes) {
+            UnmapViewOfFile(first);
+            if (GetLastError() == ERROR_INVALID_ADDRESS) {
+                continue;
+            }
+            LOG_ERROR("MapViewOfFileEx failed");
+            CloseHandle(file);
+            return false;
+        }
+
+        base = hole;
+        mapping = file;
+        break;
+    }
+#else
+    // An unlinked file gives the pages something to map twice
+    char shm_path[] = "/dev/shm/perry-XXXXXX";
+    char tmp_path[] = "/tmp/perry-XXXXXX";
+    char *path = shm_path;
+    int fd = mkstemp(shm_path);
+    if (fd < 0) {
+        path = tmp_path;
+        fd = mkstemp(tmp_path);
+    }
+    if (fd < 0) {
+        LOG_ERROR("Could not create the backing file of a frame queue");
+        return false;
+    }
+    unlink(path);
+
+    if (ftruncate(fd, bytes)) {
+        LOG_ERROR("Could not size the backing file of a frame queue");
+        close(fd);
+        return false;
+    }
+
+    // Reserve the address range for both halves, then put the file over each
+    char *hole = (char *)mmap(nullptr, bytes * 2, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (hole == MAP_FAILED) {
+        LOG_ERROR("Could not reserve memory for a frame queue");
+        close(fd);
+        return false;
+    }
+
+    if (mmap(hole, bytes, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0) != hole ||
+        mmap(hole + bytes, bytes, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0) != hole + bytes) {
+        LOG_ERROR("Could not mirror the memory of a frame queue");
+        munmap(hole, bytes * 2);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    base = hole;
+#endif
+
+    size = bytes;
+    return true;
+}
+
+void MirroredMemory::destroy() {
+    if (!base) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    UnmapViewOfFile(base + size);
+    CloseHandle(mapping);
+    mapping = nullptr;
+#else
+    munmap(base, size * 2);
+#endif
+
+    base = nullptr;
+    size = 0;
+}
+
+char *MirroredMemory::address() const {
+    return base;
+}
+
+size_t MirroredMemory::capacity() const {
+    return size;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "realtime.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#define CACHE_LINE 64
+
+// The same pages mapped twice back to back, so anything starting inside the
+// buffer can run past its end and land at the start (as in libsoundio's ring buffer)
+class MirroredMemory {
+  public:
+    bool init(size_t min_bytes); // Rounded up to the allocation granularity
+    void destroy();
+    char *address() const;
+    size_t capacity() const;
+
+  private:
+    char *base = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void *mapping = nullptr;
+#endif
+};
+
+// Lock-free single producer, single consumer queue of frames over mirrored
+// memory. Both sides get a contiguous pointer for as many frames as are
+// free/queued, so they can fill or consume it in place and then commit/release
+// the batch. Each index sits on its own cache line next to the side's cached
+// copy of the other one, which is only reloaded when it looks too short.
+template <typename T> class FrameQueue {
+    static_assert(std::is_trivially_copyable_v<T>, "Frames are moved around as raw memory");
+
+  public:
+    bool init(int min_frames) {
+        if (!mem.init(min_frames * sizeof(T)) || mem.capacity() % sizeof(T) != 0) {
+            mem.destroy();
+            return false;
+        }
+        frames = (int)(mem.capacity() / sizeof(T));
+        producer.write.store(0, std::memory_order_relaxed);
+        producer.cached_read = 0;
+        consumer.read.store(0, std::memory_order_relaxed);
+        consumer.cached_write = 0;
+        return true;
+    }
+
+    void destroy() {
+        mem.destroy();
+        frames = 0;
+    }
+
+    int capacity() const {
+        return frames;
+    }
+
+    // Keeps the pages in RAM in real-time mode
+    void lockMemory() const {
+        Realtime::lockMemory(mem.address(), mem.capacity() * 2);
+    }
+
+    // Queued frames, from either side
+    int fill() const {
+        uint64_t read = consumer.read.load(std::memory_order_acquire);
+        uint64_t write = producer.write.load(std::memory_order_acquire);
+        return (int)(write - read);
+    }
+
+    // Producer side
+
+    int writable() {
+        uint64_t write = producer.write.load(std::memory_order_relaxed);
+        producer.cached_read = consumer.read.load(std::memory_order_acquire);
+        return frames - (int)(write - producer.cached_read);
+    }
+
+    // Room for count frames, or null if there isn't enough yet
+    T *reserve(int count) {
+        uint64_t write = producer.write.load(std::memory_order_relaxed);
+        if (frames - (int)(write - producer.cached_read) < count && writable() < count) {
+            return nullptr;
+        }
+        return slot(write);
+    }
+
+    void commit(int count) {
+        producer.write.store(producer.write.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Consumer side
+
+    int readable() {
+        uint64_t read = consumer.read.load(std::memory_order_relaxed);
+        consumer.cached_write = producer.write.load(std::memory_order_acquire);
+        return (int)(consumer.cached_write - read);
+    }
+
+    // The next count frames, or null if fewer are queued
+    const T *peek(int count) {
+        uint64_t read = consumer.read.load(std::memory_order_relaxed);
+        if ((int)(consumer.cached_write - read) < count && readable() < count) {
+            return nullptr;
+        }
+        return slot(read);
+    }
+
+    void release(int count) {
+        consumer.read.store(consumer.read.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+  private:
+    struct alignas(CACHE_LINE) Producer {
+        std::atomic<uint64_t> write{0};
+        uint64_t cached_read = 0;
+    };
+    struct alignas(CACHE_LINE) Consumer {
+        std::atomic<uint64_t> read{0};
+        uint64_t cached_write = 0;
+    };
+
+    Producer producer;
+    Consumer consumer;
+    MirroredMemory mem;
+    int frames = 0;
+
+    T *slot(uint64_t index) const {
+        return reinterpret_cast<T *>(mem.address()) + index % frames;
+    }
+};
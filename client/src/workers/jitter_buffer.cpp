@@ -0,0 +1,290 @@
+#include "jitter_buffer.h"
+#include "crossSockets.h"
+#include "logger.h"
+#include "realtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#define SAMPLE_RATE 48000
+#define MAX_PACKET_SAMPLES 5760 // 120ms, the longest Opus packet
+#define DEFAULT_FRAME 120       // Assumed packet length until one is decoded
+
+// Playout delay bounds, in samples
+#define MIN_DELAY 240  // 5ms
+#define MAX_DELAY 9600 // 200ms
+
+#define JITTER_FACTOR 3.0f            // Delay kept above a frame, in multiples of the measured jitter
+#define LATE_DECAY_SAMPLES (5 * 48000) // Extra delay from late packets fades over ~5s of audio
+#define QUIET_LEVEL 1e-4f             // Mean square below which a frame may be skipped (-40dBFS)
+
+static_assert(65536 % JITTER_SLOTS == 0, "Slot index must survive sequence number wrap");
+
+bool JitterBuffer::init() {
+    int err;
+    decoder = opus_decoder_create(SAMPLE_RATE, 1, &err);
+    if (err != OPUS_OK) {
+        LOG_ERROR("opus_decoder_create failed: " + std::string(opus_strerror(err)));
+        decoder = nullptr;
+        return false;
+    }
+
+    pcm.assign(MAX_PACKET_SAMPLES * 2, 0.0f);
+    target = MIN_DELAY;
+    return true;
+}
+
+void JitterBuffer::destroy() {
+    if (decoder) {
+        opus_decoder_destroy(decoder);
+        decoder = nullptr;
+    }
+}
+
+void JitterBuffer::clear() {
+    opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+    reset(0);
+    started = false;
+    last_samples = 0;
+    pcm_len = 0;
+    has_transit = false;
+    last_transit = 0;
+    jitter = 0.0f;
+    late_penalty = 0.0f;
+    target = MIN_DELAY;
+    counters = {};
+    reported = {};
+    has_highest = false;
+    highest_seq = 0;
+}
+
+void JitterBuffer::lockMemory() const {
+    Realtime::lockMemory(decoder, opus_decoder_get_size(1));
+    Realtime::lockMemory(pcm.data(), pcm.size() * sizeof(float));
+}
+
+void JitterBuffer::reset(uint16_t seq) {
+    for (Slot &slot : packets) {
+        slot.filled = false;
+    }
+
+    next_seq = seq;
+    queued = 0;
+    queued_samples = 0;
+    playing = false;
+    has_spurt = false;
+}
+
+void JitterBuffer::updateTarget() {
+    int frame = last_samples ? last_samples : DEFAULT_FRAME;
+    int t = frame + (int)(JITTER_FACTOR * jitter + late_penalty);
+    target = std::clamp(t, MIN_DELAY, MAX_DELAY);
+}
+
+void JitterBuffer::push(uint16_t seq, uint32_t timestamp, uint8_t flags, const unsigned char *payload, int len, int samples,
+                        std::chrono::steady_clock::time_point now) {
+    counters.received++;
+
+    // Interarrival jitter as in RFC 3550, transit times in samples
+    uint32_t arrival = (uint32_t)(std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count() * SAMPLE_RATE / 1000000);
+    uint32_t transit = arrival - timestamp;
+    if (has_transit) {
+        int32_t d = (int32_t)(transit - last_transit);
+        jitter += (std::abs((float)d) - jitter) / 16.0f;
+    }
+    last_transit = transit;
+    has_transit = true;
+
+    if (!has_highest || static_cast<int16_t>(seq - highest_seq) > 0) {
+        highest_seq = seq;
+        highest_arrival = now;
+        has_highest = true;
+    }
+
+    if (!started) {
+        reset(seq);
+        started = true;
+    }
+
+    int16_t ahead = static_cast<int16_t>(seq - next_seq);
+
+    // Its turn already passed, play further behind from now on
+    if (ahead < 0) {
+        counters.late++;
+        late_penalty = std::min(late_penalty + samples, (float)MAX_DELAY);
+        updateTarget();
+        return;
+    }
+
+    // Too far ahead to hold, the stream jumped so start over from here
+    if (ahead >= JITTER_SLOTS) {
+        reset(seq);
+    }
+
+    // The speaker was silent, frames between the last one we have and this one were never sent
+    if ((flags & VOICE_FLAG_TALKSPURT) && ahead > 0) {
+        counters.talkspurts++;
+        if (queued == 0) {
+            reset(seq);
+        } else {
+            has_spurt = true;
+            spurt_seq = seq;
+        }
+    }
+
+    Slot &slot = packets[seq % JITTER_SLOTS];
+    if (slot.filled) {
+        return;
+    }
+
+    slot.filled = true;
+    slot.seq = seq;
+    slot.len = len;
+    slot.samples = samples;
+    std::memcpy(slot.data, payload, len);
+
+    queued++;
+    queued_samples += samples;
+    updateTarget();
+}
+
+// Whether any queued packet comes before seq
+bool JitterBuffer::pendingBefore(uint16_t seq) const {
+    for (const Slot &slot : packets) {
+        if (slot.filled && static_cast<int16_t>(slot.seq - seq) < 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes the packet whose turn it is, or makes one up if it never came.
+// Returns 0 when the buffer ran dry.
+int JitterBuffer::decodeNext(float *dst) {
+    // Skip over the silence up to the next talkspurt, once the previous one has played out
+    Slot &current = packets[next_seq % JITTER_SLOTS];
+    if (has_spurt && !(current.filled && current.seq == next_seq) && !pendingBefore(spurt_seq)) {
+        next_seq = spurt_seq;
+    }
+    if (has_spurt && next_seq == spurt_seq) {
+        has_spurt = false;
+    }
+
+    Slot &slot = packets[next_seq % JITTER_SLOTS];
+    int decoded;
+
+    if (slot.filled && slot.seq == next_seq) {
+        decoded = opus_decode_float(decoder, slot.data, slot.len, dst, MAX_PACKET_SAMPLES, 0);
+        slot.filled = false;
+        queued--;
+        queued_samples -= slot.samples;
+        counters.played++;
+    } else if (queued > 0) {
+        // A later packet is here, so this one is lost
+        counters.lost++;
+        int frame = last_samples ? last_samples : DEFAULT_FRAME;
+        uint16_t after_seq = next_seq + 1;
+        Slot &after = packets[after_seq % JITTER_SLOTS];
+
+        if (after.filled && after.seq == after_seq) {
+            // The next packet may carry a lower quality copy of this one
+            decoded = opus_decode_float(decoder, after.data, after.len, dst, frame, 1);
+            counters.recovered++;
+        } else {
+            decoded = opus_decode_float(decoder, nullptr, 0, dst, frame, 0);
+            counters.concealed++;
+        }
+    } else {
+        // Ran dry, buffer up again before resuming
+        playing = false;
+        return 0;
+    }
+
+    next_seq++;
+
+    // Counted rather than logged, this runs on the audio path
+    if (decoded < 0) {
+        counters.errors++;
+        return -1;
+    }
+
+    last_samples = decoded;
+    late_penalty -= late_penalty * decoded / LATE_DECAY_SAMPLES;
+    return decoded;
+}
+
+int JitterBuffer::read(float *out, int frames) {
+    frames = std::min(frames, MAX_PACKET_SAMPLES);
+
+    while (pcm_len < frames) {
+        if (!playing) {
+            if (queued == 0 || queued_samples < target) {
+                break;
+            }
+            playing = true;
+        }
+
+        float *dst = pcm.data() + pcm_len;
+        int n = decodeNext(dst);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            continue;
+        }
+
+        // Too far behind, shrink the delay by skipping a quiet frame (or any frame when way off)
+        if (queued_samples > target + 2 * n) {
+            float energy = 0.0f;
+            for (int i = 0; i < n; i++) {
+                energy += dst[i] * dst[i];
+            }
+
+            if (energy / n < QUIET_LEVEL || queued_samples > 2 * target) {
+                counters.skipped++;
+                continue;
+            }
+        }
+
+        pcm_len += n;
+    }
+
+    int n = std::min(pcm_len, frames);
+    std::memcpy(out, pcm.data(), n * sizeof(float));
+    pcm_len -= n;
+    std::memmove(pcm.data(), pcm.data() + n, pcm_len * sizeof(float));
+    return n;
+}
+
+bool JitterBuffer::idle() const {
+    return queued == 0 && pcm_len == 0;
+}
+
+bool JitterBuffer::report(VoiceReportBlock &block) {
+    if (!has_highest || counters.received == reported.received) {
+        return false;
+    }
+
+    // Loss as the listener heard it: late packets were already counted as lost in their turn
+    uint64_t lost = counters.lost - reported.lost;
+    uint64_t due = lost + counters.played - reported.played;
+    block.loss = due ? (uint8_t)std::min<uint64_t>(255, lost * 256 / due) : 0;
+
+    block.jitter = htons((uint16_t)std::min(jitter, 65535.0f));
+    block.last_seq = htons(highest_seq);
+    auto held = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - highest_arrival);
+    block.delay = htonl((uint32_t)held.count());
+
+    reported = counters;
+    return true;
+}
+
+JitterStats JitterBuffer::stats() const {
+    JitterStats s = counters;
+    s.depth_ms = (queued_samples + pcm_len) * 1000 / SAMPLE_RATE;
+    s.target_ms = target * 1000 / SAMPLE_RATE;
+    s.jitter_ms = jitter * 1000.0f / SAMPLE_RATE;
+    return s;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "voice_packets.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <opus.h>
+#include <vector>
+
+// Packets held per speaker, covers the longest delay with 2.5ms frames
+#define JITTER_SLOTS 128
+
+struct JitterStats {
+    int depth_ms = 0;  // Audio waiting to be played
+    int target_ms = 0; // Delay the buffer is aiming for
+    float jitter_ms = 0.0f;
+    uint64_t received = 0;
+    uint64_t played = 0;    // Decoded in their turn
+    uint64_t late = 0;      // Arrived after their turn to play
+    uint64_t lost = 0;      // Missing when their turn came
+    uint64_t concealed = 0; // Filled in by Opus PLC
+    uint64_t recovered = 0; // Rebuilt from the next packet's in-band FEC
+    uint64_t skipped = 0;   // Dropped on purpose to shrink the delay
+    uint64_t errors = 0;    // Opus couldn't decode them
+    uint64_t talkspurts = 0;
+};
+
+// Reorders one speaker's packets by sequence number and decodes them at a
+// delay that follows the jitter measured from their timestamps.
+class JitterBuffer {
+  public:
+    bool init();
+    void destroy();
+    void clear(); // Back to how init() left it, for another speaker. Keeps the allocations
+    void lockMemory() const;
+    void push(uint16_t seq, uint32_t timestamp, uint8_t flags, const unsigned char *payload, int len, int samples,
+              std::chrono::steady_clock::time_point arrival);
+    int read(float *out, int frames); // Fewer than asked while (re)buffering
+    bool idle() const;
+    JitterStats stats() const;
+    bool report(VoiceReportBlock &block); // Everything but the ssrc, false if nothing arrived since the last one
+
+  private:
+    struct Slot {
+        bool filled = false;
+        uint16_t seq = 0;
+        uint16_t len = 0;
+        int samples = 0;
+        unsigned char data[VOICE_MAX_PAYLOAD];
+    };
+
+    OpusDecoder *decoder = nullptr;
+    std::array<Slot, JITTER_SLOTS> packets;
+    bool started = false;
+    bool playing = false; // False while (re)buffering
+    uint16_t next_seq = 0;
+    int queued = 0;         // Packets waiting to be decoded
+    int queued_samples = 0; // Audio they hold
+    int last_samples = 0;   // Duration of the last decoded packet, for concealment
+    bool has_spurt = false; // A talkspurt starts at spurt_seq, what the sender skipped before it isn't lost
+    uint16_t spurt_seq = 0;
+
+    std::vector<float> pcm; // Decoded, not yet read
+    int pcm_len = 0;
+
+    // Delay estimation, all in samples
+    bool has_transit = false;
+    uint32_t last_transit = 0;
+    float jitter = 0.0f;
+    float late_penalty = 0.0f;
+    int target = 0;
+
+    JitterStats counters;
+
+    // For receiver reports
+    bool has_highest = false;
+    uint16_t highest_seq = 0;
+    std::chrono::steady_clock::time_point highest_arrival;
+    JitterStats reported; // Counters as of the last report
+
+    void reset(uint16_t seq);
+    void updateTarget();
+    bool pendingBefore(uint16_t seq) const;
+    int decodeNext(float *dst);
+};
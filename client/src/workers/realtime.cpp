@@ -0,0 +1,191 @@
+#include "realtime.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#if defined(PERRY_RT_CHECKS) && defined(__linux__)
+#include <dlfcn.h>
+#endif
+
+#define STACK_PREFAULT (128 * 1024) // More than the audio threads ever use
+#define NICE_FALLBACK -11           // What desktop sound servers ask for without real-time
+
+namespace Realtime {
+static std::atomic<bool> on{false};
+static std::atomic<int> promoted{0};
+static std::atomic<int> raised{0};
+static std::atomic<int> refused{0};
+static std::atomic<size_t> locked_bytes{0};
+static std::atomic<bool> lock_failed{false};
+static std::atomic<uint64_t> violations{0};
+static thread_local int audio_depth = 0;
+
+void setEnabled(bool enable) {
+    on.store(enable);
+}
+
+bool enabled() {
+    return on.load();
+}
+
+bool promoteThread(int priority) {
+    if (!enabled()) {
+        return false;
+    }
+
+#ifdef _WIN32
+    if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        promoted++;
+        return true;
+    }
+#else
+    // Some backends already run their callbacks real-time
+    int policy;
+    sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0 && (policy == SCHED_FIFO || policy == SCHED_RR)) {
+        promoted++;
+        return true;
+    }
+
+    param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+        promoted++;
+        return true;
+    }
+
+#ifdef __linux__
+    // Not allowed (no CAP_SYS_NICE or rtprio limit), a better nice value still helps against the UI
+    if (setpriority(PRIO_PROCESS, gettid(), NICE_FALLBACK) == 0) {
+        raised++;
+        return false;
+    }
+#endif
+#endif
+
+    refused++;
+    return false;
+}
+
+// Never inlined, so the array really lives below the caller's frame
+__attribute__((noinline)) void prefaultStack() {
+    if (!enabled()) {
+        return;
+    }
+
+    volatile char stack[STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+void lockMemory(const void *addr, size_t len) {
+    if (!enabled() || !addr || len == 0) {
+        return;
+    }
+
+#ifdef _WIN32
+    bool ok = VirtualLock(const_cast<void *>(addr), len);
+#else
+    bool ok = mlock(addr, len) == 0;
+#endif
+
+    if (ok) {
+        locked_bytes += len;
+    } else {
+        lock_failed.store(true);
+    }
+}
+
+Status status() {
+    Status s;
+    s.promoted = promoted.load();
+    s.raised = raised.load();
+    s.refused = refused.load();
+    s.locked_bytes = locked_bytes.load();
+    s.lock_failed = lock_failed.load();
+    s.violations = violations.load();
+    return s;
+}
+
+AudioScope::AudioScope() {
+    audio_depth++;
+}
+
+AudioScope::~AudioScope() {
+    audio_depth--;
+}
+
+#ifdef PERRY_RT_CHECKS
+// Straight to stderr, the logger allocates
+static void violation(const char *what) {
+    if (audio_depth == 0) {
+        return;
+    }
+    violations++;
+
+    // Report once per thread, then just count
+    static thread_local bool reported = false;
+    if (!reported) {
+        reported = true;
+        const char prefix[] = "RT check: ";
+#ifndef _WIN32
+        (void)!write(2, prefix, sizeof(prefix) - 1);
+        (void)!write(2, what, std::strlen(what));
+        (void)!write(2, "\n", 1);
+#endif
+    }
+}
+#endif
+} // namespace Realtime
+
+#ifdef PERRY_RT_CHECKS
+// Every other form of new and delete ends up in these two
+void *operator new(size_t size) {
+    Realtime::violation("heap allocation on the audio path");
+    void *p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    if (p) {
+        Realtime::violation("heap free on the audio path");
+    }
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+#ifdef __linux__
+// std::mutex and friends go through here. A try_lock doesn't block, so it isn't checked
+extern "C" int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    using LockFn = int (*)(pthread_mutex_t *);
+    static std::atomic<LockFn> real{nullptr};
+
+    LockFn fn = real.load(std::memory_order_relaxed);
+    if (!fn) {
+        fn = reinterpret_cast<LockFn>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        real.store(fn, std::memory_order_relaxed);
+    }
+
+    Realtime::violation("blocking lock on the audio path");
+    return fn(mutex);
+}
+#endif
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in real-time mode for the audio threads: higher scheduling priority,
+// buffers locked in RAM and stacks faulted in up front. Built with
+// PERRY_RT_CHECKS, heap allocation and blocking on a mutex inside an
+// AudioScope are reported, which is how the audio path is kept clean.
+namespace Realtime {
+void setEnabled(bool on);
+bool enabled();
+
+// All no-ops unless enabled. None of them log, so they are safe in the audio callbacks
+bool promoteThread(int priority);              // For the calling thread, SCHED_FIFO where allowed
+void prefaultStack();                          // Touches the calling thread's stack ahead of time
+void lockMemory(const void *addr, size_t len); // Keeps it from being paged out
+
+// What the calls above managed, for the log
+struct Status {
+    int promoted = 0; // Threads running real-time
+    int raised = 0;   // Threads that only got a better nice value
+    int refused = 0;  // Threads the OS kept at normal priority
+    size_t locked_bytes = 0;
+    bool lock_failed = false; // Usually RLIMIT_MEMLOCK
+    uint64_t violations = 0;  // Allocations and locks seen on the audio path, always 0 without PERRY_RT_CHECKS
+};
+Status status();
+
+// Marks the calling thread as on the audio path for its lifetime
+class AudioScope {
+  public:
+    AudioScope();
+    ~AudioScope();
+    AudioScope(const AudioScope &) = delete;
+    AudioScope &operator=(const AudioScope &) = delete;
+};
+} // namespace Realtime
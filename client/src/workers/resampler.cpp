@@ -0,0 +1,127 @@
+#include "resampler.h"
+#include "audio_kernels.h"
+#include "logger.h"
+#include "realtime.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#define MAX_PHASES 1024 // 44.1k family to 48k needs 160, 11.025k needs 640
+#define PASSBAND 0.9    // Of the lower Nyquist frequency kept flat
+
+bool resample_quality_from_name(const std::string &name, ResampleQuality &quality) {
+    if (name == "low") {
+        quality = ResampleQuality::LOW;
+    } else if (name == "medium") {
+        quality = ResampleQuality::MEDIUM;
+    } else if (name == "high") {
+        quality = ResampleQuality::HIGH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+bool Resampler::init(int in_rate, int out_rate, ResampleQuality quality, int max_frames) {
+    int g = std::gcd(in_rate, out_rate);
+    up = out_rate / g;
+    down = in_rate / g;
+    if (up > MAX_PHASES) {
+        LOG_ERROR("Can't resample " + std::to_string(in_rate) + "Hz to " + std::to_string(out_rate) + "Hz");
+        return false;
+    }
+
+    double beta;
+    switch (quality) {
+    case ResampleQuality::LOW:
+        taps = 16;
+        beta = 5.0;
+        break;
+    case ResampleQuality::MEDIUM:
+        taps = 32;
+        beta = 7.0;
+        break;
+    default:
+        taps = 64;
+        beta = 9.0;
+        break;
+    }
+
+    // Prototype low pass at the upsampled rate, cut below whichever Nyquist is lower
+    int length = up * taps;
+    double cutoff = PASSBAND * 0.5 / std::max(up, down); // Cycles per upsampled sample
+    double center = (length - 1) / 2.0;
+    std::vector<double> h(length);
+    double sum = 0.0;
+    for (int k = 0; k < length; k++) {
+        double t = k - center;
+        double sinc = t == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double r = t / (length / 2.0);
+        double window = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / bessel_i0(beta);
+        h[k] = sinc * window;
+        sum += h[k];
+    }
+
+    // Split into phases, each reversed so process() is one contiguous dot product. Unity gain after upsampling
+    coefs.assign(length, 0.0f);
+    for (int p = 0; p < up; p++) {
+        for (int j = 0; j < taps; j++) {
+            coefs[p * taps + (taps - 1 - j)] = (float)(h[p + up * j] * up / sum);
+        }
+    }
+
+    buf.assign(taps - 1 + max_frames, 0.0f);
+    phase = 0;
+    pos = 0;
+    return true;
+}
+
+bool Resampler::active() const {
+    return up != down;
+}
+
+void Resampler::reset() {
+    std::fill(buf.begin(), buf.end(), 0.0f);
+    phase = 0;
+    pos = 0;
+}
+
+void Resampler::lockMemory() const {
+    Realtime::lockMemory(coefs.data(), coefs.size() * sizeof(float));
+    Realtime::lockMemory(buf.data(), buf.size() * sizeof(float));
+}
+
+int Resampler::maxOutput(int frames) const {
+    return (int)(((long long)frames * up + down - 1) / down) + 1;
+}
+
+int Resampler::process(const float *in, int frames, float *out) {
+    const int history = taps - 1;
+    std::memcpy(buf.data() + history, in, frames * sizeof(float));
+
+    // Output n sits at n * down in the upsampled stream: input pos, phase within it
+    int n = 0;
+    while (pos < frames) {
+        const float *window = buf.data() + history + pos - (taps - 1);
+        out[n++] = AudioKernels::dot(coefs.data() + phase * taps, window, taps);
+
+        phase += down;
+        pos += phase / up;
+        phase %= up;
+    }
+
+    pos -= frames;
+    std::memmove(buf.data(), buf.data() + frames, history * sizeof(float));
+    return n;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Filter length against CPU
+enum class ResampleQuality {
+    LOW,    // 16 taps per phase
+    MEDIUM, // 32 taps
+    HIGH,   // 64 taps
+};
+
+bool resample_quality_from_name(const std::string &name, ResampleQuality &quality); // "low", "medium" or "high"
+
+// Rational polyphase resampler with a Kaiser windowed sinc, for devices that
+// don't run at 48kHz. Everything is allocated in init(), process() is safe on
+// the audio thread and does its filtering through the SIMD dot product kernel.
+class Resampler {
+  public:
+    bool init(int in_rate, int out_rate, ResampleQuality quality, int max_frames);
+    int process(const float *in, int frames, float *out); // Writes at most maxOutput(frames) samples
+    int maxOutput(int frames) const;
+    bool active() const; // False when both rates match and nothing needs doing
+    void reset();        // Forgets the history, for a new stream
+    void lockMemory() const;
+
+  private:
+    int up = 1;   // L, interpolation factor
+    int down = 1; // M, decimation factor
+    int taps = 0;
+    std::vector<float> coefs; // up phases of taps each, reversed so they line up with the input
+    std::vector<float> buf;   // taps - 1 samples of history, then the current block
+    int phase = 0;            // Of the next output, 0..up-1
+    int pos = 0;              // Newest input sample the next output uses, in the current block
+};
@@ -39,6 +39,10 @@ void SocketReader::run() {
             handler_ListUserImgs();
             break;
         }
+        case PacketType::VOICE_SESSION: {
+            handler_VoiceSession();
+            break;
+        }
         default:
             LOG_WARNING("Unknown packet type");
             break;
@@ -102,4 +106,16 @@ void SocketReader::handler_ListUserImgs() {
     }
 
     emit usersImgsReady(userImageMap);
+}
+
+void SocketReader::handler_VoiceSession() {
+    VoiceSessionInfo session;
+    recv_uint(sock, session.channel);
+    recv_uint(sock, session.ssrc);
+    recv_uint64(sock, session.key);
+    recv_uint(sock, session.codec.frame_samples);
+    recv_uint(sock, session.codec.bitrate);
+    recv_uint(sock, session.codec.complexity);
+
+    emit voiceSessionReady(session);
 }
\ No newline at end of file
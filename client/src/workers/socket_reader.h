@@ -13,6 +13,7 @@ class SocketReader : public QObject {
     void usersReady(const std::vector<UserInfo> &users);
     void newMessage(const MessageInfo &msg);
     void usersImgsReady(const std::unordered_map<uint32_t, QPixmap> &m);
+    void voiceSessionReady(const VoiceSessionInfo &session);
 
   private:
     int sock;
@@ -22,4 +23,5 @@ class SocketReader : public QObject {
     void handler_ListUsers();
     void handler_Message();
     void handler_ListUserImgs();
+    void handler_VoiceSession();
 };
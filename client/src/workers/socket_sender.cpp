@@ -1,5 +1,6 @@
 #include "socket_sender.h"
 #include "logger.h"
+#include "common_data.h"
 #include "packets.h"
 #include <QTimer>
 #include <cstdint>
@@ -42,6 +43,10 @@ void SocketSender::run() {
         send_packet(sock, PacketType::LIST_USER_IMGS, NULL, 0);
         break;
     }
+    case PacketType::VOICE_SESSION: {
+        handleVoiceSession(header);
+        break;
+    }
     default:
         LOG_WARNING("Packet Type not recognized");
     }
@@ -117,4 +122,37 @@ void SocketSender::handleListMessages(const PacketHeader &header) {
     // Send packet
     send_packet(sock, PacketType::LIST_MESSAGES, NULL, 0);
     send_packet(sock, PacketType::UINT, channelId);
+}
+
+void SocketSender::handleVoiceSession(const PacketHeader &header) {
+    if (header.length < sizeof(uint32_t) + sizeof(VoiceCodecParams)) {
+        LOG_ERROR("invalid header.length < sizeof(uint32_t) + sizeof(VoiceCodecParams)");
+        return;
+    }
+    if (payload_fifo.size() < header.length) {
+        LOG_ERROR("not enough payload bytes yet");
+        return;
+    }
+
+    // Read channelId
+    uint32_t channelId;
+    char tmp[sizeof(channelId)];
+    std::copy(payload_fifo.begin(), payload_fifo.begin() + sizeof(channelId), tmp);
+    std::memcpy(&channelId, tmp, sizeof(channelId));
+
+    // Read the codec settings we'd like
+    VoiceCodecParams codec;
+    char tmp_codec[sizeof(codec)];
+    std::copy(payload_fifo.begin() + sizeof(channelId), payload_fifo.begin() + sizeof(channelId) + sizeof(codec), tmp_codec);
+    std::memcpy(&codec, tmp_codec, sizeof(codec));
+
+    // Erase all bytes for this packet
+    payload_fifo.erase(payload_fifo.begin(), payload_fifo.begin() + header.length);
+
+    // Send packet
+    send_packet(sock, PacketType::VOICE_SESSION, NULL, 0);
+    send_packet(sock, PacketType::UINT, channelId);
+    send_packet(sock, PacketType::UINT, codec.frame_samples);
+    send_packet(sock, PacketType::UINT, codec.bitrate);
+    send_packet(sock, PacketType::UINT, codec.complexity);
 }
\ No newline at end of file
@@ -20,6 +20,7 @@ class SocketSender : public QObject {
 
     void handleMessage(const PacketHeader &header);
     void handleListMessages(const PacketHeader &header);
+    void handleVoiceSession(const PacketHeader &header);
 
   private slots:
     void run();
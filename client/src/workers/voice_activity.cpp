@@ -0,0 +1,37 @@
+#include "voice_activity.h"
+#include <algorithm>
+#include <cmath>
+
+#define SPEECH_MARGIN_DB 10.0f // Above the noise floor
+#define MIN_SPEECH_DB -55.0f   // Never speech below this, whatever the floor
+#define NOISE_RISE_DB 0.00004f // Per sample the floor may climb, ~2dB per second
+#define NOISE_FALL 0.5f        // Fraction of the way down to a quieter frame
+#define HANGOVER_SAMPLES 14400 // 300ms at 48kHz
+
+bool VoiceActivityDetector::process(const float *samples, int n) {
+    float energy = 0.0f;
+    for (int i = 0; i < n; i++) {
+        energy += samples[i] * samples[i];
+    }
+    float db = 10.0f * std::log10(energy / n + 1e-13f);
+    last_db = db;
+
+    // Drop quickly to quieter backgrounds, creep up slowly so speech doesn't become the floor
+    if (db < noise_floor) {
+        noise_floor += (db - noise_floor) * NOISE_FALL;
+    } else {
+        noise_floor = std::min(db, noise_floor + NOISE_RISE_DB * n);
+    }
+
+    if (db > noise_floor + SPEECH_MARGIN_DB && db > MIN_SPEECH_DB) {
+        hangover = HANGOVER_SAMPLES;
+    } else {
+        hangover = std::max(0, hangover - n);
+    }
+
+    return hangover > 0;
+}
+
+uint8_t VoiceActivityDetector::level() const {
+    return (uint8_t)std::clamp(-last_db, 0.0f, 127.0f);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+// Energy based voice activity detector. Follows the background noise level and
+// flags frames that stand clearly above it, holding on for a moment after
+// speech ends so word endings are not clipped.
+class VoiceActivityDetector {
+  public:
+    bool process(const float *samples, int n); // True while the user is talking
+    uint8_t level() const;                     // Of the last frame, in -dBov (0 loudest, 127 silent)
+
+  private:
+    float noise_floor = -60.0f; // dBFS
+    int hangover = 0;           // Samples left before we call it silence
+    float last_db = -127.0f;
+};
@@ -1,11 +1,27 @@
 #include "voice_chat.h"
+#include "audio_kernels.h"
 #include "crossSockets.h"
+#include "drift_compensator.h"
+#include "dsp_chain.h"
+#include "encoder_control.h"
+#include "frame_queue.h"
+#include "latency_histogram.h"
 #include "logger.h"
 #include "packets.h"
+#include "realtime.h"
+#include "resampler.h"
+#include "voice_activity.h"
+#include "voice_mixer.h"
+#include "voice_packets.h"
+#include "voice_transport.h"
 #include <QThread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
 #include <opus.h>
+#include <semaphore>
 #include <soundio/soundio.h>
 #include <string>
 #include <thread>
@@ -13,16 +29,28 @@
 
 // Audio configuration (must match server)
 #define SAMPLE_RATE 48000
-#define CHUNK_SIZE 120 // 2.5ms at 48kHz | Minimum Opus frame size
+#define CHUNK_SIZE 120 // 2.5ms at 48kHz | Capture is moved in blocks of this size
+#define MIX_TICK 480   // 10ms, how much the mixer writes to the output at a time
+#define STATS_INTERVAL_S 5
+#define REPORT_INTERVAL_MS 1000 // How often listeners tell speakers how their stream arrives
 
-// Ring buffer settings
+// Ring buffer settings, the minimum. Sized for the longest frame since the engine outlives sessions
 #define RING_MS 150
 #define BYTES_PER_FRAME (int)sizeof(float)
 
-#define SW_LATENCY 0.005 // in s
+#define SW_LATENCY 0.005 // in s, also the minimum
 
 // Opus
-#define MAX_OPUS_BYTES 1276
+#define MAX_OPUS_BYTES VOICE_MAX_PAYLOAD
+#define MAX_FRAME_SAMPLES 960 // Longest frame we negotiate or switch to
+#define DTX_MAX_BYTES 2 // Opus asks for nothing to be sent when it returns this little
+
+#define KEEPALIVE_SAMPLES 19200 // 400ms, comfort noise sent while silent
+#define DSP_BUDGET 0.1          // Share of a frame the DSP chain may take, the rest is the encoder's
+
+// SCHED_FIFO priorities in real-time mode, the device callbacks above the codec threads
+#define RT_PRIORITY_DEVICE 10
+#define RT_PRIORITY_CODEC 8
 
 static struct SoundIo *soundio = nullptr;
 static struct SoundIoDevice *in_device = nullptr;
@@ -31,61 +59,142 @@ static struct SoundIoDevice *out_device = nullptr;
 static struct SoundIoOutStream *outstream = nullptr;
 
 // Ring buffers
-SoundIoRingBuffer *ring_buffer_input = nullptr;
-SoundIoRingBuffer *ring_buffer_output = nullptr;
-
-static int underflow_count = 0;
-
-static std::atomic<bool> running{true};
-static int vc_socket = -1;
-static uint32_t channel;
+static FrameQueue<float> input_queue;  // Capture callback -> sender, at 48kHz
+static FrameQueue<float> output_queue; // Mixer -> playback callback, at the device rate
+static std::atomic<bool> input_overflow{false}; // The sender fell behind and capture had nowhere to go
+
+static std::atomic<int> underflow_count{0};
+
+// What made a stream fail, the callbacks can't log themselves
+static std::atomic<const char *> stream_error_what{nullptr};
+static std::atomic<int> stream_error_code{0};
+
+static std::atomic<bool> running{false}; // A session is on
+static VoiceTransport transport;
+static VoiceSessionInfo session;
+static std::mutex session_mutex; // Held by a session for as long as it uses the engine
+
+// The audio engine outlives sessions: soundio stays connected, the streams stay open
+// (paused between sessions) and the codecs allocated, so joining a channel only
+// resets them and connects the network
+enum class EngineState { STOPPED, STARTING, READY, FAILED };
+static std::mutex engine_mutex;
+static std::condition_variable engine_cv;
+static EngineState engine_state = EngineState::STOPPED;
+static std::thread engine_thread;
+static std::atomic<bool> engine_alive{false};
+static std::atomic<bool> engine_broken{false}; // A stream failed, rebuilt on the next join
+static std::atomic<bool> streaming{false};     // A session owns the queues, the callbacks move audio
+
+// Join latency, us
+static std::atomic<int64_t> join_time{0};
+static std::atomic<int64_t> first_playout{0}; // First mixed audio handed to the device
+
+// Tuned to the frame size the server settled on, the encoder control may lengthen it
+static std::atomic<int> frame_samples{CHUNK_SIZE};
+static int ring_ms = RING_MS;
+static double sw_latency = SW_LATENCY; // Set when the engine opens the streams
 
 // Opus
 static OpusEncoder *opus_encoder = nullptr;
-static OpusDecoder *opus_decoder = nullptr;
+static VoiceMixer mixer;
+static EncoderControl encoder_control;
+static DriftCompensator drift; // Mixer clock -> output device clock
+
+// Devices that won't run at 48kHz are resampled on both sides
+static ResampleQuality resample_quality = ResampleQuality::MEDIUM;
+static int input_rate = SAMPLE_RATE;
+static int output_rate = SAMPLE_RATE;
+static Resampler capture_resampler;  // Input device -> 48kHz
+static Resampler playback_resampler; // 48kHz -> output device
+static std::vector<float> capture_resampled;
+
+// Harness taps, set before the engine starts and fixed after that
+static VoiceProbe probe;
+
+// Glitches of the current session, for the harness
+static std::atomic<uint64_t> capture_dropped{0}; // Samples
+static std::atomic<uint64_t> capture_overruns{0};
+static std::atomic<uint64_t> mix_dropped{0};     // Ticks
+static std::mutex heard_mutex;                   // Guards heard, written by the mixer between ticks
+static JitterStats heard;
+
+// Cleans up the microphone before it is encoded, on the sender thread
+static DspChain dsp;
+static std::vector<float> processed(MAX_FRAME_SAMPLES);
+
+// Capture -> sender wakeup. The flag keeps the semaphore at most 1
+static std::binary_semaphore input_ready{0};
+static std::atomic<bool> input_signaled{false};
+static std::atomic<int64_t> input_signal_time{0}; // us
+
+static inline int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Wakes the sender, safe to call from the audio callback
+static void signal_input() {
+    if (!input_signaled.exchange(true)) {
+        input_signal_time.store(now_us(), std::memory_order_relaxed);
+        input_ready.release();
+    }
+}
 
 void run();
 
-void init_opus() {
+// Codec objects live with the engine
+static bool create_codecs() {
     int err;
-    // Encoder
     opus_encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &err);
     if (err != OPUS_OK) {
         LOG_ERROR("opus_encoder_create failed: " + std::string(opus_strerror(err)));
-        running.store(false);
-        return;
+        opus_encoder = nullptr;
+        return false;
     }
 
-    // Set a target bitrate https://wiki.xiph.org/Opus_Recommended_Settings
-    opus_encoder_ctl(opus_encoder, OPUS_SET_BITRATE(38000));
-    opus_encoder_ctl(opus_encoder, OPUS_SET_COMPLEXITY(7));
+    dsp.init(SAMPLE_RATE);
 
-    // Decoder
-    opus_decoder = opus_decoder_create(SAMPLE_RATE, 1, &err);
-    if (err != OPUS_OK) {
-        LOG_ERROR("opus_decoder_create failed: " + std::string(opus_strerror(err)));
-        running.store(false);
-        return;
-    }
+    // Decoders are created per speaker by the mixer
+    return mixer.init(MIX_TICK);
 }
 
-void VoiceChat::init(std::string ip, uint port, uint32_t ch) {
-    channel = ch;
+// Puts the encoder back to a clean state with the session's settings
+static void reset_codecs() {
+    opus_encoder_ctl(opus_encoder, OPUS_RESET_STATE);
+
+    // Bitrate and complexity come from the session https://wiki.xiph.org/Opus_Recommended_Settings
+    opus_encoder_ctl(opus_encoder, OPUS_SET_BITRATE(session.codec.bitrate));
+    opus_encoder_ctl(opus_encoder, OPUS_SET_COMPLEXITY(session.codec.complexity));
 
-    // Voice socket
-    vc_socket = socket(AF_INET, SOCK_STREAM, 0);
-    int flag = 1;
-    crossSockets::setSocketOptions(vc_socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    // Let Opus flag silence too. It only kicks in with 10ms+ frames, our own VAD covers shorter ones
+    opus_encoder_ctl(opus_encoder, OPUS_SET_DTX(1));
 
-    struct sockaddr_in srv;
-    srv.sin_family = AF_INET;
-    srv.sin_port = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &srv.sin_addr);
+    // FEC stays off until listeners report loss
+    opus_encoder_ctl(opus_encoder, OPUS_SET_INBAND_FEC(0));
+    opus_encoder_ctl(opus_encoder, OPUS_SET_PACKET_LOSS_PERC(0));
+    encoder_control.init(session.codec);
+}
+
+static bool engine_acquire(const VoiceCodecParams &codec, ResampleQuality quality, bool realtime);
 
-    if (::connect(vc_socket, (struct sockaddr *)&srv, sizeof(srv)) < 0) {
-        perror("VC connect");
-        close(vc_socket);
-        vc_socket = -1;
+void VoiceChat::init(std::string ip, uint port, VoiceSessionInfo s, ResampleQuality quality, bool realtime) {
+    join_time.store(now_us());
+    first_playout.store(0);
+    session = s;
+
+    // Normally warm already, otherwise this join pays for opening the devices
+    if (!engine_acquire(session.codec, quality, realtime)) {
+        LOG_ERROR("VC | Audio engine unavailable");
+        return;
+    }
+
+    frame_samples = session.codec.frame_samples;
+    double frame_s = (double)frame_samples / SAMPLE_RATE;
+    LOG_INFO("Voice codec: " + std::to_string(frame_s * 1000) + "ms frames, " + std::to_string(session.codec.bitrate) +
+             "bps, complexity " + std::to_string(session.codec.complexity));
+
+    if (!transport.connect(ip, port, session)) {
+        LOG_ERROR("Could not reach the voice server");
         return;
     }
 
@@ -95,12 +204,8 @@ void VoiceChat::init(std::string ip, uint port, uint32_t ch) {
 
 void VoiceChat::stop() {
     running.store(false);
-    shutdown(vc_socket, SHUT_RDWR);
-
-    // Wake up soundio to break out of wait_events
-    if (soundio) {
-        soundio_wakeup(soundio);
-    }
+    transport.shutdown();
+    signal_input();
 
     // Wait for main thread to finish
     if (main.joinable()) {
@@ -113,57 +218,116 @@ void VoiceChat::stop() {
     QThread::currentThread()->quit();
 }
 
-static inline int frames_fill_count(SoundIoRingBuffer *rb) {
-    return soundio_ring_buffer_fill_count(rb) / BYTES_PER_FRAME;
+// Plain interleaved float frames, what the SIMD kernels expect. Most backends hand us this
+static inline bool is_interleaved(const SoundIoChannelArea *areas, int channels) {
+    for (int c = 0; c < channels; c++) {
+        if (areas[c].ptr != areas[0].ptr + c * BYTES_PER_FRAME || areas[c].step != channels * BYTES_PER_FRAME) {
+            return false;
+        }
+    }
+    return true;
 }
 
-// Produce samples into the SoundIo ring buffer from Input callback
-static void produce_samples(const float *samples, int nframes) {
-    const int bytes_to_write = nframes * BYTES_PER_FRAME;
-
-    int free_bytes = soundio_ring_buffer_free_count(ring_buffer_input);
+// Mono mix of nframes device frames starting at offset
+static void downmix_areas(const SoundIoChannelArea *areas, int channels, bool interleaved, int offset, int nframes, float *out) {
+    if (interleaved) {
+        // Vectorized downmix (a copy for mono)
+        const float *src = (const float *)(areas[0].ptr + offset * areas[0].step);
+        AudioKernels::downmix(src, channels, nframes, out);
+    } else if (channels == 1) {
+        // straightforward copy from areas[0]
+        for (int i = 0; i < nframes; ++i) {
+            out[i] = *((float *)(areas[0].ptr + (offset + i) * areas[0].step));
+        }
+    } else {
+        // mix all channels to mono (average)
+        for (int i = 0; i < nframes; ++i) {
+            float sum = 0.0f;
+            for (int c = 0; c < channels; ++c) {
+                float *src = (float *)(areas[c].ptr + (offset + i) * areas[c].step);
+                sum += *src;
+            }
+            out[i] = sum / channels;
+        }
+    }
+}
 
-    // If not enough space, drop old samples (advance read pointer)
-    if (free_bytes < bytes_to_write) {
-        int overflow_bytes = bytes_to_write - free_bytes;
-        overflow_bytes = (overflow_bytes / BYTES_PER_FRAME) * BYTES_PER_FRAME;
+// Queues a block of at most CHUNK_SIZE device frames, silence when areas is null.
+// The mono mix goes straight into the queue unless it still has to be brought to 48kHz
+static void capture_block(const SoundIoChannelArea *areas, int channels, bool interleaved, int offset, int nframes, int64_t captured_us) {
+    bool resample = capture_resampler.active();
+    float *dst = input_queue.reserve(resample ? capture_resampler.maxOutput(nframes) : nframes);
+    if (!dst) {
+        // Only the sender may drop queued audio, it skips ahead once it sees this
+        input_overflow.store(true, std::memory_order_relaxed);
+        return;
+    }
 
-        soundio_ring_buffer_advance_read_ptr(ring_buffer_input, overflow_bytes);
+    float temp[CHUNK_SIZE];
+    float *mono = resample ? temp : dst;
+    if (areas) {
+        downmix_areas(areas, channels, interleaved, offset, nframes, mono);
+    } else {
+        AudioKernels::silence(mono, nframes);
+    }
+    if (probe.capture) {
+        probe.capture(mono, nframes, input_rate, captured_us);
     }
 
-    char *write_ptr = soundio_ring_buffer_write_ptr(ring_buffer_input);
-    float *out = reinterpret_cast<float *>(write_ptr);
+    input_queue.commit(resample ? capture_resampler.process(mono, nframes, dst) : nframes);
+}
 
-    if (samples) {
-        // Copy samples directly
-        memcpy(out, samples, bytes_to_write);
-    } else {
-        // Fill with silence
-        for (int i = 0; i < nframes; i++) {
-            out[i] = 0.0f;
-        }
+// A stream failed, end the session and rebuild the engine on the next join
+static void stream_failed(const char *what, int err) {
+    stream_error_code.store(err);
+    stream_error_what.store(what);
+    engine_broken.store(true);
+    running.store(false);
+}
+
+// Logs a failure recorded by a callback, once
+static void log_stream_error() {
+    const char *what = stream_error_what.exchange(nullptr);
+    if (what) {
+        LOG_ERROR(std::string(what) + " error: " + soundio_strerror(stream_error_code.load()));
     }
+}
 
-    soundio_ring_buffer_advance_write_ptr(ring_buffer_input, bytes_to_write);
+// First thing in every callback, only does something the first time on each thread
+static inline void prepare_callback_thread() {
+    static thread_local bool prepared = false;
+    if (!prepared) {
+        Realtime::promoteThread(RT_PRIORITY_DEVICE);
+        Realtime::prefaultStack();
+        prepared = true;
+    }
 }
 
-// Audio input callback
+// Audio input callback. Between sessions the stream is paused, or if the backend
+// can't pause, read and thrown away
 static void read_callback(struct SoundIoInStream *instream, int frame_count_min, int frame_count_max) {
-    // Check if we're shutting down
-    if (!running.load()) {
-        return;
-    }
+    prepare_callback_thread();
+    Realtime::AudioScope scope;
+    bool live = streaming.load();
 
     struct SoundIoChannelArea *areas;
     int err;
-    int frames_left = std::max(CHUNK_SIZE, frame_count_min);
-    frames_left = std::min(frames_left, frame_count_max);
+
+    // When the oldest frame waiting in the device was captured, only the harness wants it
+    int64_t captured_us = 0;
+    if (probe.capture) {
+        double latency = 0.0;
+        soundio_instream_get_latency(instream, &latency);
+        captured_us = now_us() - (int64_t)(latency * 1000000);
+    }
+
+    // Take everything the device has, leaving frames behind lets its buffer overrun
+    int frames_left = frame_count_max;
     while (frames_left > 0) {
         int frame_count = frames_left;
         err = soundio_instream_begin_read(instream, &areas, &frame_count);
         if (err) {
-            LOG_ERROR("Begin read error: " + std::string(soundio_strerror(err)));
-            running.store(false);
+            stream_failed("Begin read", err);
             return;
         }
 
@@ -172,59 +336,34 @@ static void read_callback(struct SoundIoInStream *instream, int frame_count_min,
             break;
         }
 
-        int processed = 0;
         // If device gives us areas == NULL, fill with silence
-        if (!areas) {
-            while (processed < frame_count) {
-                int tocopy = std::min(CHUNK_SIZE, frame_count - processed);
-                produce_samples(nullptr, tocopy);
-                processed += tocopy;
-            }
-        } else {
-            // Copy frames into a temporary stack buffer in small blocks to call
-            int device_channels = instream->layout.channel_count;
-            while (processed < frame_count) {
-                int tocopy = std::min(CHUNK_SIZE, frame_count - processed);
-                float temp[CHUNK_SIZE];
-
-                if (device_channels == 1) {
-                    // straightforward copy from areas[0]
-                    for (int i = 0; i < tocopy; ++i) {
-                        temp[i] = *((float *)(areas[0].ptr + (processed + i) * areas[0].step));
-                    }
-                } else {
-                    // mix all channels to mono (average)
-                    for (int i = 0; i < tocopy; ++i) {
-                        float sum = 0.0f;
-                        for (int c = 0; c < device_channels; ++c) {
-                            float *src = (float *)(areas[c].ptr + (processed + i) * areas[c].step);
-                            sum += *src;
-                        }
-                        temp[i] = sum / device_channels;
-                    }
-                }
-
-                produce_samples(temp, tocopy);
-                processed += tocopy;
-            }
+        int device_channels = instream->layout.channel_count;
+        bool interleaved = areas && is_interleaved(areas, device_channels);
+        for (int processed = 0; live && processed < frame_count; processed += CHUNK_SIZE) {
+            capture_block(areas, device_channels, interleaved, processed, std::min(CHUNK_SIZE, frame_count - processed),
+                          captured_us + (int64_t)processed * 1000000 / input_rate);
         }
+        captured_us += (int64_t)frame_count * 1000000 / input_rate;
 
         err = soundio_instream_end_read(instream);
         if (err) {
-            LOG_ERROR("End read error: " + std::string(soundio_strerror(err)));
-            running.store(false);
+            stream_failed("End read", err);
             return;
         }
         frames_left -= frame_count;
     }
+
+    // Only bother the sender once it has a whole frame to encode
+    if (live && input_queue.fill() >= frame_samples) {
+        signal_input();
+    }
 }
 
-// Audio output callback
+// Audio output callback, plays silence between sessions if the backend can't pause
 static void write_callback(struct SoundIoOutStream *outstream, int frame_count_min, int frame_count_max) {
-    //  Check if we're shutting down
-    if (!running.load()) {
-        return;
-    }
+    prepare_callback_thread();
+    Realtime::AudioScope scope;
+    bool live = streaming.load();
 
     static struct SoundIoChannelArea *areas;
     static int err;
@@ -234,179 +373,458 @@ static void write_callback(struct SoundIoOutStream *outstream, int frame_count_m
         frames_left = frame_count_min;
     }
     while (frames_left > 0) {
+        // What is already queued in the device plays before anything written now
+        int64_t audible_us = 0;
+        if (probe.playback) {
+            double latency = 0.0;
+            soundio_outstream_get_latency(outstream, &latency);
+            audible_us = now_us() + (int64_t)(latency * 1000000);
+        }
+
         int frame_count = frames_left;
         err = soundio_outstream_begin_write(outstream, &areas, &frame_count);
         if (err) {
-            LOG_ERROR("Begin write error: " + std::string(soundio_strerror(err)));
-            running.store(false);
+            stream_failed("Begin write", err);
             return;
         }
 
-        float *buffer = (float *)soundio_ring_buffer_read_ptr(ring_buffer_output);
-        int fill_count = frames_fill_count(ring_buffer_output);
-        int copy_frames = std::min(fill_count, frame_count);
+        // Between sessions the queue belongs to whoever is resetting it
+        int copy_frames = live ? std::min(output_queue.readable(), frame_count) : 0;
+        const float *buffer = live ? output_queue.peek(copy_frames) : nullptr;
+        if (copy_frames > 0 && first_playout.load(std::memory_order_relaxed) == 0) {
+            first_playout.store(now_us(), std::memory_order_relaxed);
+        }
         int silence_frames = frame_count - copy_frames;
+        int channels = outstream->layout.channel_count;
 
-        for (int frame = 0; frame < copy_frames; frame++) {
-            float sample = buffer[frame];
+        if (is_interleaved(areas, channels)) {
+            // Vectorized fan-out of the mono mix, silence for whatever the ring couldn't cover
+            float *out = (float *)areas[0].ptr;
+            AudioKernels::fanout(buffer, copy_frames, channels, out);
+            AudioKernels::silence(out + copy_frames * channels, silence_frames * channels);
+        } else {
+            for (int frame = 0; frame < copy_frames; frame++) {
+                float sample = buffer[frame];
 
-            // Write mono sample to all channels
-            for (int ch = 0; ch < outstream->layout.channel_count; ch++) {
-                float *ptr = (float *)(areas[ch].ptr + areas[ch].step * frame);
-                *ptr = sample;
+                // Write mono sample to all channels
+                for (int ch = 0; ch < channels; ch++) {
+                    float *ptr = (float *)(areas[ch].ptr + areas[ch].step * frame);
+                    *ptr = sample;
+                }
             }
-        }
 
-        for (int frame = copy_frames; frame < frame_count; frame++) {
-            for (int ch = 0; ch < outstream->layout.channel_count; ch++) {
-                float *ptr = (float *)(areas[ch].ptr + areas[ch].step * frame);
-                *ptr = 0.0f;
+            for (int frame = copy_frames; frame < frame_count; frame++) {
+                for (int ch = 0; ch < channels; ch++) {
+                    float *ptr = (float *)(areas[ch].ptr + areas[ch].step * frame);
+                    *ptr = 0.0f;
+                }
             }
         }
 
-        soundio_ring_buffer_advance_read_ptr(ring_buffer_output, copy_frames * BYTES_PER_FRAME);
+        if (probe.playback) {
+            probe.playback(buffer, copy_frames, output_rate, audible_us);
+            probe.playback(nullptr, silence_frames, output_rate, audible_us + (int64_t)copy_frames * 1000000 / output_rate);
+        }
+
+        if (live) {
+            output_queue.release(copy_frames);
+        }
         frames_left -= frame_count;
 
         err = soundio_outstream_end_write(outstream);
         if (err) {
-            LOG_ERROR("End write error: " + std::string(soundio_strerror(err)));
-            running.store(false);
+            stream_failed("End write", err);
             return;
         }
     }
 }
 
+// Counted here, logged by the mixer
 static void underflow_callback(struct SoundIoOutStream *outstream) {
-    underflow_count++;
-    LOG_ERROR("Underflow " + std::to_string(underflow_count) + " (network latency too high)");
+    underflow_count.fetch_add(1, std::memory_order_relaxed);
 }
 
-void network_send_thread() {
-    send_packet(vc_socket, PacketType::UINT, channel);
+// The device buffer filled up before we read it. libsoundio calls this unconditionally, it can't be null
+static void overflow_callback(struct SoundIoInStream *instream) {
+    capture_overruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Per stage cost against the frame it has to fit in, the encoder needs most of that
+static void log_dsp_stats() {
+    double budget_us = (double)frame_samples.load() * 1000000 / SAMPLE_RATE;
+    double chain_max_us = 0.0;
+    std::string line = "DSP";
+    for (const DspStageStats &s : dsp.stats()) {
+        if (!s.enabled) {
+            line += " | " + std::string(s.name) + " off";
+            continue;
+        }
+        line += " | " + std::string(s.name) + " " + std::to_string(s.avg_us) + "us avg " + std::to_string(s.max_us) + "us max";
+        chain_max_us += s.max_us;
+    }
+    LOG_DEBUG(line + " | agc gain " + std::to_string(dsp.agcGainDb()) + "dB");
+
+    if (chain_max_us > budget_us * DSP_BUDGET) {
+        LOG_WARNING("DSP chain took up to " + std::to_string(chain_max_us) + "us of a " + std::to_string(budget_us) + "us frame");
+    }
+}
 
+void network_send_thread() {
     LOG_DEBUG("Connected to server, streaming audio...");
+    Realtime::promoteThread(RT_PRIORITY_CODEC);
+    Realtime::prefaultStack();
+
+    std::vector<char> frame(VOICE_MAX_FRAME);
+    VoicePacketHeader *header = reinterpret_cast<VoicePacketHeader *>(frame.data());
+    unsigned char *opus_buf = reinterpret_cast<unsigned char *>(frame.data() + sizeof(VoicePacketHeader));
+
+    uint16_t seq = 0;
+    uint32_t timestamp = 0;
+
+    VoiceActivityDetector vad;
+    bool talking = false;
+    uint32_t last_sent = 0; // Timestamp of the last frame that went out
+    uint64_t suppressed = 0;
+    bool first_frame = true;
 
-    std::vector<float> sendbuf(CHUNK_SIZE);
-    std::vector<unsigned char> opus_buf(MAX_OPUS_BYTES);
+    LatencyHistogram wake_latency;    // Capture callback signalled -> sender running
+    LatencyHistogram encode_latency;  // Encode start -> frame handed to the socket
+    auto last_stats = std::chrono::steady_clock::now();
+    EncoderSettings encoder;
 
     while (running.load()) {
-        // If not enough samples, sleep a tiny bit
-        int available = frames_fill_count(ring_buffer_input);
-        while (available < CHUNK_SIZE && running.load()) {
-            // std::this_thread::sleep_for(std::chrono::milliseconds(1)); Windows doesnt play nice with this. Maybe change this to a event wait
-            available = frames_fill_count(ring_buffer_input);
+        // Sleep until the capture callback has a full frame, the timeout only guards against a stalled device
+        if (!input_ready.try_acquire_for(std::chrono::milliseconds(100))) {
+            continue;
         }
+        wake_latency.record(now_us() - input_signal_time.load(std::memory_order_relaxed));
+        input_signaled.store(false);
+
+        // Drain everything captured so far, the callback may have delivered several frames at once
+        while (running.load()) {
+            // Follow what listeners report, between frames so a frame is never split
+            if (encoder_control.poll(encoder)) {
+                opus_encoder_ctl(opus_encoder, OPUS_SET_BITRATE(encoder.bitrate));
+                opus_encoder_ctl(opus_encoder, OPUS_SET_INBAND_FEC(encoder.fec ? 1 : 0));
+                opus_encoder_ctl(opus_encoder, OPUS_SET_PACKET_LOSS_PERC(encoder.loss_perc));
+                frame_samples.store(encoder.frame_samples);
+            }
 
-        // Check again after the wait loop
-        if (!running.load()) {
-            break;
-        }
+            const int frame_len = frame_samples.load();
 
-        float *read_buf = (float *)soundio_ring_buffer_read_ptr(ring_buffer_input);
-        memcpy(sendbuf.data(), read_buf, CHUNK_SIZE * BYTES_PER_FRAME);
-        soundio_ring_buffer_advance_read_ptr(ring_buffer_input, CHUNK_SIZE * BYTES_PER_FRAME);
+            // Capture overflowed while we were away, keep only the newest frame so the delay doesn't stick
+            if (input_overflow.exchange(false, std::memory_order_relaxed)) {
+                int skip = std::max(0, input_queue.readable() - frame_len);
+                input_queue.release(skip);
+                capture_dropped.fetch_add(skip, std::memory_order_relaxed);
+                LOG_DEBUG("Sender skipped " + std::to_string(skip) + " samples of backlog");
+            }
 
-        int nb_bytes = opus_encode_float(opus_encoder,
-                                         sendbuf.data(),
-                                         CHUNK_SIZE,
-                                         opus_buf.data(),
-                                         MAX_OPUS_BYTES);
+            const float *captured = input_queue.peek(frame_len);
+            if (!captured) {
+                break;
+            }
+            int64_t encode_start = now_us();
+
+            int nb_bytes;
+            bool active = false;
+            {
+                // Nothing in here may allocate or block
+                Realtime::AudioScope scope;
+
+                // Filtered out of the queue, then encoded straight behind the header
+                std::memcpy(processed.data(), captured, frame_len * sizeof(float));
+                input_queue.release(frame_len);
+                dsp.process(processed.data(), frame_len);
+
+                nb_bytes = opus_encode_float(opus_encoder,
+                                             processed.data(),
+                                             frame_len,
+                                             opus_buf,
+                                             MAX_OPUS_BYTES);
+
+                // The encoder keeps running through silence so its state stays continuous, only sending stops
+                if (nb_bytes >= 0) {
+                    active = vad.process(processed.data(), frame_len) && nb_bytes > DTX_MAX_BYTES;
+                }
+            }
 
-        if (nb_bytes < 0) {
-            LOG_ERROR("Opus encode failed: " + std::string(opus_strerror(nb_bytes)));
-            running.store(false);
-            break;
-        }
+            if (nb_bytes < 0) {
+                LOG_ERROR("Opus encode failed: " + std::string(opus_strerror(nb_bytes)));
+                running.store(false);
+                break;
+            }
 
-        // Send length prefix (uint16 network-order) then packet
-        uint16_t len16 = static_cast<uint16_t>(nb_bytes);
-        uint16_t len_net = htons(len16);
-        if (!send_all(vc_socket, &len_net, sizeof(len_net))) {
-            LOG_ERROR("Error sending opus length");
-            running.store(false);
-            break;
-        }
-        if (!send_all(vc_socket, opus_buf.data(), nb_bytes)) {
-            LOG_ERROR("Error sending voice");
-            running.store(false);
+            // Microphone to encoder, the sending side of joining
+            if (first_frame) {
+                LOG_INFO("Join to first captured frame " + std::to_string((now_us() - join_time.load()) / 1000) + "ms");
+                first_frame = false;
+            }
+
+            uint8_t flags = 0;
+            if (!active) {
+                if (talking || timestamp - last_sent >= KEEPALIVE_SAMPLES) {
+                    flags = VOICE_FLAG_SILENCE;
+                } else {
+                    timestamp += frame_len;
+                    suppressed++;
+                    continue;
+                }
+            } else if (!talking) {
+                flags = VOICE_FLAG_TALKSPURT;
+            }
+            talking = active;
+            last_sent = timestamp;
+
+            header->type = static_cast<uint8_t>(VoicePacketType::AUDIO);
+            header->flags = flags;
+            header->seq = htons(seq);
+            header->timestamp = htonl(timestamp);
+            header->ssrc = htonl(session.ssrc);
+            header->speaker = 0; // Stamped by the server
+            header->level = vad.level();
+            timestamp += frame_len;
+
+            if (!transport.send(frame.data(), sizeof(VoicePacketHeader) + nb_bytes)) {
+                LOG_ERROR("Error sending voice");
+                running.store(false);
+            }
+            encoder_control.onSent(seq++);
+
+            encode_latency.record(now_us() - encode_start);
         }
 
-        std::this_thread::yield();
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_stats > std::chrono::seconds(STATS_INTERVAL_S)) {
+            LOG_DEBUG("Sender wakeup " + wake_latency.summary());
+            LOG_DEBUG("Sender encode to send " + encode_latency.summary());
+            LOG_DEBUG("Sender suppressed " + std::to_string(suppressed) + " silent frames");
+            LOG_DEBUG("Sender reported loss " + std::to_string(encoder_control.loss() * 100.0f) + "% rtt " +
+                      std::to_string(encoder_control.rttMs()) + "ms");
+            log_dsp_stats();
+            uint64_t overruns = capture_overruns.load(std::memory_order_relaxed);
+            if (overruns > 0) {
+                LOG_WARNING("Capture device overran " + std::to_string(overruns) + " times this session");
+            }
+            suppressed = 0;
+            wake_latency.reset();
+            encode_latency.reset();
+            last_stats = now;
+        }
     }
 
     LOG_DEBUG("Network send exited");
 }
 
 void network_recv_thread() {
-    std::vector<unsigned char> packet_buf(MAX_OPUS_BYTES);
-    std::vector<float> chunk(CHUNK_SIZE);
+    std::vector<char> frame(VOICE_MAX_FRAME);
 
     LOG_DEBUG("Connected, receiving audio...");
 
     while (running.load()) {
-        uint16_t len_net;
-        if (!recv_all(vc_socket, &len_net, sizeof(len_net))) {
-            LOG_ERROR("Disconnected or read error (len)");
-            running.store(false);
-            break;
-        }
-        uint16_t nb_bytes = ntohs(len_net);
-        if (nb_bytes == 0 || nb_bytes > (int)packet_buf.size()) {
-            LOG_ERROR("Invalid packet length");
+        int len = transport.recv(frame.data(), frame.size());
+        if (len < 0) {
+            if (running.load()) {
+                LOG_ERROR("Disconnected or read error");
+            }
             running.store(false);
             break;
         }
 
-        if (!recv_all(vc_socket, packet_buf.data(), nb_bytes)) {
-            LOG_ERROR("Disconnected or read error (payload)");
-            running.store(false);
-            break;
+        // Receive timeout, just check if we are still running
+        if (len == 0) {
+            continue;
         }
 
-        int frame_count = opus_decode_float(opus_decoder,
-                                            packet_buf.data(),
-                                            nb_bytes,
-                                            chunk.data(),
-                                            CHUNK_SIZE,
-                                            0);
-        if (frame_count < 0) {
-            LOG_ERROR("Opus decode failed: " + std::string(opus_strerror(frame_count)));
+        const VoicePacketHeader *header = reinterpret_cast<const VoicePacketHeader *>(frame.data());
+        int nb_bytes = len - (int)sizeof(VoicePacketHeader);
+
+        // A listener telling us how our stream arrives, the relay sends each block on its own
+        if (header->type == static_cast<uint8_t>(VoicePacketType::REPORT)) {
+            if (nb_bytes >= (int)sizeof(VoiceReportBlock)) {
+                VoiceReportBlock block;
+                memcpy(&block, frame.data() + sizeof(VoicePacketHeader), sizeof(block));
+                encoder_control.onReport(block);
+            }
             continue;
         }
 
-        // Check if buffer would overflow
-        int free = soundio_ring_buffer_free_count(ring_buffer_output);
-        int bytes_to_write = frame_count * BYTES_PER_FRAME;
-        if (free < bytes_to_write) {
-            LOG_DEBUG("Packet Dropped");
+        if (header->type != static_cast<uint8_t>(VoicePacketType::AUDIO)) {
             continue;
         }
 
-        // Write chunk to ring buffer
-        float *buffer = (float *)soundio_ring_buffer_write_ptr(ring_buffer_output);
-        memcpy(buffer, chunk.data(), bytes_to_write);
-        soundio_ring_buffer_advance_write_ptr(ring_buffer_output, bytes_to_write);
+        if (nb_bytes <= 0) {
+            continue;
+        }
 
-        // std::this_thread::sleep_for(std::chrono::milliseconds(2));
-        std::this_thread::yield();
+        // Decoding happens on the mixer thread, once the jitter buffer has put it in order
+        mixer.push(*header, reinterpret_cast<const unsigned char *>(frame.data() + sizeof(VoicePacketHeader)), nb_bytes);
     }
 
     LOG_DEBUG("Network recv exited");
 }
 
-void start_input_stream() {
+static void update_heard(const std::vector<SpeakerStats> &speakers) {
+    JitterStats sum;
+    for (const SpeakerStats &s : speakers) {
+        sum.received += s.jitter.received;
+        sum.played += s.jitter.played;
+        sum.late += s.jitter.late;
+        sum.lost += s.jitter.lost;
+        sum.concealed += s.jitter.concealed;
+        sum.recovered += s.jitter.recovered;
+        sum.skipped += s.jitter.skipped;
+        sum.errors += s.jitter.errors;
+        sum.talkspurts += s.jitter.talkspurts;
+    }
+
+    std::lock_guard<std::mutex> lock(heard_mutex);
+    heard = sum;
+}
+
+static void log_jitter_stats() {
+    std::vector<SpeakerStats> speakers = mixer.stats();
+    update_heard(speakers);
+    for (const SpeakerStats &s : speakers) {
+        const JitterStats &j = s.jitter;
+        LOG_DEBUG("Speaker " + std::to_string(s.userId) + " | depth " + std::to_string(j.depth_ms) + "ms target " +
+                  std::to_string(j.target_ms) + "ms jitter " + std::to_string(j.jitter_ms) + "ms | received " +
+                  std::to_string(j.received) + " late " + std::to_string(j.late) + " lost " + std::to_string(j.lost) +
+                  " concealed " + std::to_string(j.concealed) + " recovered " + std::to_string(j.recovered) +
+                  " skipped " + std::to_string(j.skipped) + " errors " + std::to_string(j.errors) + " talkspurts " +
+                  std::to_string(j.talkspurts));
+    }
+}
+
+// Tells each speaker we hear how their stream is arriving
+static void send_reports() {
+    std::vector<VoiceReportBlock> blocks = mixer.reports();
+    if (blocks.empty()) {
+        return;
+    }
+
+    char frame[VOICE_MAX_FRAME];
+    VoicePacketHeader header{};
+    header.type = static_cast<uint8_t>(VoicePacketType::REPORT);
+    header.ssrc = htonl(session.ssrc);
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), blocks.data(), blocks.size() * sizeof(VoiceReportBlock));
+
+    if (!transport.send(frame, sizeof(header) + blocks.size() * sizeof(VoiceReportBlock))) {
+        LOG_ERROR("Error sending voice report");
+    }
+}
+
+// Sums every speaker into the output ring on a fixed tick
+void mix_thread() {
+    const int tick = mixer.tickFrames();
+    const auto period = std::chrono::microseconds(1000000LL * tick / SAMPLE_RATE);
+    auto next = std::chrono::steady_clock::now();
+    auto last_stats = next;
+    auto last_report = next;
+    bool playout_logged = false;
+    int underflows_logged = 0;
+
+    // The ring should hold a tick plus two device periods right after each write
+    std::vector<float> mixed(tick);
+    drift.init(tick, tick + (int)(2 * sw_latency * SAMPLE_RATE));
+
+    // Drift is corrected at 48kHz, the device rate only comes in at the very end
+    std::vector<float> drifted(DriftCompensator::maxOutput(tick));
+    const int max_write = playback_resampler.maxOutput(DriftCompensator::maxOutput(tick));
+
+    Realtime::promoteThread(RT_PRIORITY_CODEC);
+    Realtime::prefaultStack();
+    Realtime::lockMemory(mixed.data(), mixed.size() * sizeof(float));
+    Realtime::lockMemory(drifted.data(), drifted.size() * sizeof(float));
+
+    while (running.load()) {
+        next += period;
+        std::this_thread::sleep_until(next);
+
+        // Fell behind (suspended, debugger...), don't try to catch up in a burst
+        auto now = std::chrono::steady_clock::now();
+        if (now - next > period * 4) {
+            next = now;
+        }
+
+        float *buffer = output_queue.reserve(max_write);
+        if (!buffer) {
+            mix_dropped.fetch_add(1, std::memory_order_relaxed);
+            LOG_DEBUG("Mix Dropped");
+            continue;
+        }
+
+        {
+            // Decode, mix and resample, nothing in here may allocate or block
+            Realtime::AudioScope scope;
+
+            // Resampled by a hair so the ring neither fills nor drains on the device's clock
+            mixer.mix(mixed.data());
+            int written;
+            if (playback_resampler.active()) {
+                int n = drift.process(mixed.data(), tick, drifted.data());
+                written = playback_resampler.process(drifted.data(), n, buffer);
+            } else {
+                written = drift.process(mixed.data(), tick, buffer);
+            }
+            output_queue.commit(written);
+            drift.update((int)((int64_t)output_queue.fill() * SAMPLE_RATE / output_rate), tick);
+        }
+
+        int underflows = underflow_count.load(std::memory_order_relaxed);
+        if (underflows != underflows_logged) {
+            LOG_ERROR("Underflow " + std::to_string(underflows) + " (network latency too high)");
+            underflows_logged = underflows;
+        }
+
+        // Network to speaker, once somebody in the channel talks
+        int64_t played = first_playout.load(std::memory_order_relaxed);
+        if (!playout_logged && played) {
+            LOG_INFO("Join to first audio played " + std::to_string((played - join_time.load()) / 1000) + "ms");
+            playout_logged = true;
+        }
+
+        if (now - last_report > std::chrono::milliseconds(REPORT_INTERVAL_MS)) {
+            send_reports();
+            last_report = now;
+        }
+
+        if (now - last_stats > std::chrono::seconds(STATS_INTERVAL_S)) {
+            LOG_DEBUG("Playout drift " + std::to_string(drift.ppm()) + "ppm, ring " +
+                      std::to_string(drift.smoothedFill() * 1000 / SAMPLE_RATE) + "ms");
+            log_jitter_stats();
+            last_stats = now;
+        }
+    }
+
+    update_heard(mixer.stats());
+    LOG_DEBUG("Mixer exited");
+}
+
+// 48kHz when the device has it, otherwise whatever it already runs at so the
+// OS doesn't resample as well, otherwise the closest it can do
+static int pick_sample_rate(SoundIoDevice *device) {
+    if (soundio_device_supports_sample_rate(device, SAMPLE_RATE)) {
+        return SAMPLE_RATE;
+    }
+    if (device->sample_rate_current > 0 && soundio_device_supports_sample_rate(device, device->sample_rate_current)) {
+        return device->sample_rate_current;
+    }
+    return soundio_device_nearest_sample_rate(device, SAMPLE_RATE);
+}
+
+static bool start_input_stream() {
     int default_input_index = soundio_default_input_device_index(soundio);
     if (default_input_index < 0) {
         LOG_ERROR("No input device found");
-        running.store(false);
-        return;
+        return false;
     }
 
     in_device = soundio_get_input_device(soundio, default_input_index);
     if (!in_device) {
         LOG_ERROR("Could not get input device");
-        running.store(false);
-        return;
+        return false;
     }
 
     LOG_INFO("Input device: " + std::string(in_device->name));
@@ -434,47 +852,51 @@ void start_input_stream() {
     } else {
         instream->layout = in_device->current_layout;
     }
-    instream->sample_rate = SAMPLE_RATE;
-    instream->software_latency = SW_LATENCY; // 5 ms capture latency
+    input_rate = pick_sample_rate(in_device);
+    if (!capture_resampler.init(input_rate, SAMPLE_RATE, resample_quality, CHUNK_SIZE)) {
+        return false;
+    }
+    capture_resampled.assign(capture_resampler.maxOutput(CHUNK_SIZE), 0.0f);
+    if (capture_resampler.active()) {
+        LOG_INFO("Resampling input from " + std::to_string(input_rate) + "Hz");
+    }
+
+    instream->sample_rate = input_rate;
+    instream->software_latency = sw_latency;
     instream->read_callback = read_callback;
-    instream->overflow_callback = nullptr;
+    instream->overflow_callback = overflow_callback;
 
     int err = soundio_instream_open(instream);
     if (err) {
         LOG_ERROR("Unable to open input stream: " + std::string(soundio_strerror(err)));
-        running.store(false);
-        return;
+        return false;
     }
 
-    // allocate ring buffer
-    int capacity = (int)(((double)RING_MS / 1000.0) * SAMPLE_RATE) * BYTES_PER_FRAME;
-    ring_buffer_input = soundio_ring_buffer_create(soundio, capacity);
-    if (!ring_buffer_input) {
-        LOG_ERROR("Unable to allocate ring buffer");
-        return;
+    // allocate the queue, it holds audio at 48kHz
+    if (!input_queue.init((int)(((double)ring_ms / 1000.0) * SAMPLE_RATE))) {
+        LOG_ERROR("Unable to allocate input queue");
+        return false;
     }
 
     err = soundio_instream_start(instream);
     if (err) {
         LOG_ERROR("Unable to start input stream: " + std::string(soundio_strerror(err)));
-        running.store(false);
-        return;
+        return false;
     }
+    return true;
 }
 
-void start_output_stream() {
+static bool start_output_stream() {
     // Get default output device
     int default_output_index = soundio_default_output_device_index(soundio);
     if (default_output_index < 0) {
         LOG_ERROR("No output device found");
-        running.store(false);
-        return;
+        return false;
     }
     out_device = soundio_get_output_device(soundio, default_output_index);
     if (!out_device) {
         LOG_ERROR("Could not get output device");
-        running.store(false);
-        return;
+        return false;
     }
 
     LOG_INFO("Output device: " + std::string(out_device->name));
@@ -483,106 +905,276 @@ void start_output_stream() {
     outstream = soundio_outstream_create(out_device);
     outstream->format = SoundIoFormatFloat32NE;
     outstream->layout = *soundio_channel_layout_get_builtin(SoundIoChannelLayoutIdStereo);
-    outstream->sample_rate = SAMPLE_RATE;
-    outstream->software_latency = SW_LATENCY; // 5ms
+    output_rate = pick_sample_rate(out_device);
+    if (!playback_resampler.init(SAMPLE_RATE, output_rate, resample_quality, DriftCompensator::maxOutput(MIX_TICK))) {
+        return false;
+    }
+    if (playback_resampler.active()) {
+        LOG_INFO("Resampling output to " + std::to_string(output_rate) + "Hz");
+    }
+
+    outstream->sample_rate = output_rate;
+    outstream->software_latency = sw_latency;
     outstream->write_callback = write_callback;
     outstream->underflow_callback = underflow_callback;
 
     int err = soundio_outstream_open(outstream);
     if (err) {
         LOG_ERROR("Unable to open output stream: " + std::string(soundio_strerror(err)));
-        running.store(false);
-        return;
+        return false;
     }
 
-    // allocate ring buffer
-    int capacity = (int)(((double)RING_MS / 1000.0) * SAMPLE_RATE) * BYTES_PER_FRAME;
-    ring_buffer_output = soundio_ring_buffer_create(soundio, capacity);
-    if (!ring_buffer_output) {
-        LOG_ERROR("Unable to allocate ring buffer");
-        return;
+    // allocate the queue, it holds audio at the device rate
+    if (!output_queue.init((int)(((double)ring_ms / 1000.0) * output_rate))) {
+        LOG_ERROR("Unable to allocate output queue");
+        return false;
     }
 
     err = soundio_outstream_start(outstream);
     if (err) {
         LOG_ERROR("Unable to start output stream: " + std::string(soundio_strerror(err)));
-        running.store(false);
-        return;
+        return false;
     }
+    return true;
 }
 
-void run() {
-    // Initialize soundio
+// Pausing is optional in soundio, streams that can't keep running and the callbacks idle instead
+static void pause_streams(bool pause) {
+    int err = soundio_instream_pause(instream, pause);
+    if (err) {
+        LOG_DEBUG("Input stream can't pause: " + std::string(soundio_strerror(err)));
+    }
+    err = soundio_outstream_pause(outstream, pause);
+    if (err) {
+        LOG_DEBUG("Output stream can't pause: " + std::string(soundio_strerror(err)));
+    }
+}
+
+// Everything a session needs that doesn't depend on the session
+static bool engine_open(const VoiceCodecParams &codec, ResampleQuality quality, bool realtime) {
+    resample_quality = quality;
+    Realtime::setEnabled(realtime);
+
+    // Device latency can grow with the frame since the frame hides it anyway. Sessions
+    // usually get the frame we ask for, and the rings fit a few of the longest one
+    sw_latency = std::max(SW_LATENCY, (double)codec.frame_samples / SAMPLE_RATE / 2);
+    ring_ms = std::max(RING_MS, 8 * MAX_FRAME_SAMPLES * 1000 / SAMPLE_RATE);
+
     soundio = soundio_create();
     if (!soundio) {
         LOG_ERROR("Out of memory");
-        return;
+        return false;
     }
-    int err = soundio_connect(soundio);
+    int err = probe.dummy_backend ? soundio_connect_backend(soundio, SoundIoBackendDummy) : soundio_connect(soundio);
     if (err) {
         LOG_ERROR("Error connecting: " + std::string(soundio_strerror(err)));
-        soundio_destroy(soundio);
-        soundio = nullptr;
-        return;
+        return false;
     }
     soundio_flush_events(soundio);
 
     LOG_INFO("Using SoundIo backend: " + std::string(soundio_backend_name(soundio->current_backend)));
+    LOG_INFO("Audio kernels: " + std::string(AudioKernels::active().name));
 
-    // Initialize soundio streams
-    start_input_stream();
-    start_output_stream();
-
-    // Check if initialization failed
-    if (!running.load()) {
-        LOG_ERROR("VC | Initialization failed");
-        return;
+    if (!start_input_stream() || !start_output_stream() || !create_codecs()) {
+        return false;
     }
 
-    // Start Opus En/Decoders
-    init_opus();
-
-    // Start network threads
-    std::thread net_send(network_send_thread);
-    std::thread net_recv(network_recv_thread);
-
-    LOG_INFO("VOICE CHAT STARTED: streaming");
-
-    // main loop: pump soundio events
-    while (running.load()) {
-        soundio_wait_events(soundio);
+    // Everything the audio path touches stays in RAM, a page fault there is a dropout
+    if (Realtime::enabled()) {
+        input_queue.lockMemory();
+        output_queue.lockMemory();
+        Realtime::lockMemory(opus_encoder, opus_encoder_get_size(1));
+        Realtime::lockMemory(capture_resampled.data(), capture_resampled.size() * sizeof(float));
+        Realtime::lockMemory(processed.data(), processed.size() * sizeof(float));
+        capture_resampler.lockMemory();
+        playback_resampler.lockMemory();
+        mixer.lockMemory();
     }
 
-    // Cleanup
-    // Wait for network threads to finish
-    net_send.join();
-    net_recv.join();
+    // Ready, but quiet until a session starts
+    pause_streams(true);
+    return true;
+}
 
-    // Destroy soundio stuff
+static void engine_close() {
     soundio_instream_destroy(instream);
     soundio_outstream_destroy(outstream);
     soundio_device_unref(in_device);
     soundio_device_unref(out_device);
-    soundio_destroy(soundio);
+    if (soundio) {
+        soundio_destroy(soundio);
+    }
 
-    // Clean up ring buffers
-    soundio_ring_buffer_destroy(ring_buffer_input);
-    soundio_ring_buffer_destroy(ring_buffer_output);
+    input_queue.destroy();
+    output_queue.destroy();
 
-    // Destroy opus stuff
-    opus_encoder_destroy(opus_encoder);
-    opus_decoder_destroy(opus_decoder);
+    if (opus_encoder) {
+        opus_encoder_destroy(opus_encoder);
+    }
+    mixer.destroy();
 
-    // Reset everything
-    soundio = nullptr;
     in_device = nullptr;
     instream = nullptr;
     out_device = nullptr;
     outstream = nullptr;
-    ring_buffer_input = nullptr;
-    ring_buffer_output = nullptr;
-    vc_socket = -1;
+    opus_encoder = nullptr;
+}
+
+// Opens everything, then pumps soundio events until shut down
+static void engine_main(VoiceCodecParams codec, ResampleQuality quality, bool realtime) {
+    int64_t start = now_us();
+    bool ok = engine_open(codec, quality, realtime);
+    {
+        std::lock_guard<std::mutex> lock(engine_mutex);
+        engine_state = ok ? EngineState::READY : EngineState::FAILED;
+    }
+    engine_cv.notify_all();
+
+    if (ok) {
+        LOG_INFO("Audio engine ready in " + std::to_string((now_us() - start) / 1000) + "ms");
+        while (engine_alive.load()) {
+            soundio_wait_events(soundio);
+        }
+    } else {
+        LOG_ERROR("VC | Audio engine failed to start");
+    }
+
+    // Under the lock so nobody wakes a soundio that is going away
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    engine_close();
+    soundio = nullptr;
+}
+
+// Call with engine_mutex held
+static void engine_launch(const VoiceCodecParams &codec, ResampleQuality quality, bool realtime) {
+    engine_state = EngineState::STARTING;
+    engine_broken.store(false);
+    engine_alive.store(true);
+    engine_thread = std::thread(engine_main, codec, quality, realtime);
+}
+
+// Stops and joins the engine thread, no session may be using it
+static void engine_stop() {
+    {
+        std::lock_guard<std::mutex> lock(engine_mutex);
+        engine_alive.store(false);
+        if (engine_state == EngineState::READY) {
+            soundio_wakeup(soundio);
+        }
+    }
+
+    if (engine_thread.joinable()) {
+        engine_thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    engine_state = EngineState::STOPPED;
+}
+
+// Waits for a ready engine, starting or rebuilding it if needed
+static bool engine_acquire(const VoiceCodecParams &codec, ResampleQuality quality, bool realtime) {
+    std::unique_lock<std::mutex> lock(engine_mutex);
+
+    // Broken or failed last time, start over. Devices may have come back since
+    if (engine_state == EngineState::FAILED || (engine_state == EngineState::READY && engine_broken.load())) {
+        log_stream_error();
+        lock.unlock();
+        engine_stop();
+        lock.lock();
+    }
+
+    if (engine_state == EngineState::STOPPED) {
+        engine_launch(codec, quality, realtime);
+    }
+
+    engine_cv.wait(lock, [] { return engine_state != EngineState::STARTING; });
+    return engine_state == EngineState::READY;
+}
+
+void VoiceChat::warmUp(VoiceCodecParams codec, ResampleQuality quality, bool realtime) {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    if (engine_state == EngineState::STOPPED) {
+        engine_launch(codec, quality, realtime);
+    }
+}
+
+void VoiceChat::setProbe(const VoiceProbe &p) {
+    probe = p;
+}
+
+VoicePipelineStats VoiceChat::pipelineStats() {
+    std::lock_guard<std::mutex> lock(heard_mutex);
+    return {underflow_count.load(), capture_overruns.load(), capture_dropped.load(), mix_dropped.load(), heard};
+}
+
+void VoiceChat::configureDsp(DspSettings settings) {
+    dsp.configure(settings);
+}
+
+void VoiceChat::shutdown() {
+    // End a session that is still on, then wait for it to let go of the engine
+    running.store(false);
+    transport.shutdown();
+    signal_input();
+
+    std::lock_guard<std::mutex> session_lock(session_mutex);
+    engine_stop();
+}
+
+// One voice session on the warm engine
+void run() {
+    std::lock_guard<std::mutex> session_lock(session_mutex);
+
+    // Start from clean state, nothing touches it while the streams are paused
+    reset_codecs();
+    dsp.reset();
+    capture_resampler.reset();
+    playback_resampler.reset();
+    input_queue.release(input_queue.readable());
+    output_queue.release(output_queue.readable());
+    input_overflow.store(false);
     underflow_count = 0;
+    capture_dropped.store(0);
+    capture_overruns.store(0);
+    mix_dropped.store(0);
+    update_heard({});
+
+    // Leave no stale wakeup behind from the last session
+    while (input_ready.try_acquire()) {
+    }
+    input_signaled.store(false);
+
+    if (Realtime::enabled()) {
+        Realtime::Status rt = Realtime::status();
+        LOG_INFO("Real-time audio: " + std::to_string(rt.promoted) + " threads promoted, " + std::to_string(rt.raised) +
+                 " raised, " + std::to_string(rt.refused) + " refused, " + std::to_string(rt.locked_bytes / 1024) +
+                 "KB locked" + (rt.lock_failed ? " (locking failed for some)" : ""));
+    }
+
+    streaming.store(true);
+    pause_streams(false);
+
+    std::thread net_send(network_send_thread);
+    std::thread net_recv(network_recv_thread);
+    std::thread mixing(mix_thread);
+
+    LOG_INFO("VOICE CHAT STARTED: streaming (" + std::to_string((now_us() - join_time.load()) / 1000) + "ms after join)");
+
+    net_send.join();
+    net_recv.join();
+    mixing.join();
+    log_stream_error();
+
+    // Back to idle, the engine stays up for the next channel
+    pause_streams(true);
+    streaming.store(false);
+    mixer.reset();
+    transport.close();
+
+    int violations = Realtime::status().violations;
+    if (violations > 0) {
+        LOG_WARNING(std::to_string(violations) + " allocations or locks on the audio path this session");
+    }
 
-    return;
+    LOG_DEBUG("VC session ended");
 }
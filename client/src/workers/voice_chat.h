@@ -1,14 +1,45 @@
 #pragma once
+#include "common_data.h"
+#include "dsp_chain.h"
+#include "jitter_buffer.h"
+#include "resampler.h"
 #include <QObject>
 #include <cstdint>
 #include <string>
 #include <thread>
 
+// Taps on the audio callbacks for the loopback harness, left empty by the client.
+// Both see mono audio at the device rate, stamped with the steady clock time its
+// first frame was captured or will be heard.
+struct VoiceProbe {
+    bool dummy_backend = false; // libsoundio's dummy devices instead of real ones
+    void (*capture)(float *mono, int frames, int rate, int64_t captured_us) = nullptr;       // May overwrite the microphone
+    void (*playback)(const float *mono, int frames, int rate, int64_t audible_us) = nullptr; // mono is null for silence
+};
+
+// Glitches in the current session
+struct VoicePipelineStats {
+    int underflows;            // Playback ran dry
+    uint64_t capture_overruns; // The capture device wasn't read in time
+    uint64_t capture_dropped;  // Samples the sender skipped to catch up
+    uint64_t mix_dropped;      // Mixer ticks skipped on a full output ring
+    JitterStats heard;         // Counters of the speakers being heard, summed, as of the last stats interval
+};
+
 class VoiceChat : public QObject {
     Q_OBJECT
 
   public:
-    void init(std::string ip, uint port, uint32_t ch);
+    void init(std::string ip, uint port, VoiceSessionInfo session, ResampleQuality quality, bool realtime);
+
+    // The audio engine stays up between sessions so joining a channel doesn't reopen the devices
+    static void warmUp(VoiceCodecParams codec, ResampleQuality quality, bool realtime); // Starts it in the background
+    static void shutdown(); // Ends any session and closes it
+
+    static void configureDsp(DspSettings settings); // Microphone processing, takes effect from the next frame
+
+    static void setProbe(const VoiceProbe &probe); // Before the engine starts
+    static VoicePipelineStats pipelineStats();
 
   public slots:
     void stop();
@@ -0,0 +1,215 @@
+#include "voice_mixer.h"
+#include "crossSockets.h"
+#include "logger.h"
+#include "realtime.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#define SPEAKER_TIMEOUT_MS 2000 // Decoder goes back to the pool after this long without packets
+#define PACKET_QUEUE 256        // Packets in flight between the network and mixer threads
+
+// Limiter
+#define LIMIT_THRESHOLD 0.9f
+#define LIMIT_RELEASE 0.05f // Fraction of the way back to unity gain per tick
+
+bool VoiceMixer::init(int frames) {
+    if (frames != 120 && frames != 480 && frames != 960) {
+        LOG_ERROR("Unsupported mixer tick of " + std::to_string(frames) + " frames");
+        return false;
+    }
+
+    if (!incoming.init(PACKET_QUEUE)) {
+        LOG_ERROR("Unable to allocate the mixer packet queue");
+        return false;
+    }
+
+    speakers.resize(MAX_SPEAKERS);
+    for (Speaker &s : speakers) {
+        if (!s.jitter.init()) {
+            destroy();
+            return false;
+        }
+    }
+
+    tick_frames = frames;
+    mix_buf.assign(tick_frames, 0.0f);
+    speaker_buf.assign(tick_frames, 0.0f);
+    limiter_gain = 1.0f;
+    return true;
+}
+
+void VoiceMixer::destroy() {
+    for (Speaker &s : speakers) {
+        s.jitter.destroy();
+    }
+    speakers.clear();
+    incoming.destroy();
+}
+
+void VoiceMixer::reset() {
+    const Packet *p;
+    while ((p = incoming.peek(1))) {
+        incoming.release(1);
+    }
+
+    for (Speaker &s : speakers) {
+        s.active = false;
+    }
+    limiter_gain = 1.0f;
+}
+
+void VoiceMixer::lockMemory() const {
+    Realtime::lockMemory(speakers.data(), speakers.size() * sizeof(Speaker));
+    for (const Speaker &s : speakers) {
+        s.jitter.lockMemory();
+    }
+    incoming.lockMemory();
+    Realtime::lockMemory(mix_buf.data(), mix_buf.size() * sizeof(float));
+    Realtime::lockMemory(speaker_buf.data(), speaker_buf.size() * sizeof(float));
+}
+
+int VoiceMixer::tickFrames() const {
+    return tick_frames;
+}
+
+// The speaker's slot, or a free one from the pool. Null when all are taken
+VoiceMixer::Speaker *VoiceMixer::speakerFor(const VoicePacketHeader &header) {
+    uint32_t ssrc = ntohl(header.ssrc);
+
+    Speaker *spare = nullptr;
+    for (Speaker &s : speakers) {
+        if (s.active && s.ssrc == ssrc) {
+            return &s;
+        }
+        if (!s.active && !spare) {
+            spare = &s;
+        }
+    }
+
+    if (spare) {
+        spare->jitter.clear();
+        spare->active = true;
+        spare->ssrc = ssrc;
+        spare->userId = ntohl(header.speaker);
+    }
+    return spare;
+}
+
+void VoiceMixer::push(const VoicePacketHeader &header, const unsigned char *payload, int len) {
+    int samples = opus_packet_samples(payload, len);
+    if (samples <= 0 || len > VOICE_MAX_PAYLOAD) {
+        return;
+    }
+
+    Packet *p = incoming.reserve(1);
+    if (!p) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    p->header = header;
+    p->len = len;
+    p->samples = samples;
+    p->arrival = std::chrono::steady_clock::now();
+    std::memcpy(p->data, payload, len);
+    incoming.commit(1);
+}
+
+void VoiceMixer::deliver(const Packet &p) {
+    Speaker *s = speakerFor(p.header);
+    if (!s) {
+        return;
+    }
+
+    s->last_packet = p.arrival;
+    s->jitter.push(ntohs(p.header.seq), ntohl(p.header.timestamp), p.header.flags, p.data, p.len, p.samples, p.arrival);
+}
+
+int VoiceMixer::mix(float *out) {
+    // Take in whatever the network thread handed over since the last tick
+    const Packet *p;
+    while ((p = incoming.peek(1))) {
+        deliver(*p);
+        incoming.release(1);
+    }
+
+    std::fill(mix_buf.begin(), mix_buf.end(), 0.0f);
+    int heard = 0;
+    auto now = std::chrono::steady_clock::now();
+
+    for (Speaker &s : speakers) {
+        if (!s.active) {
+            continue;
+        }
+
+        int n = s.jitter.read(speaker_buf.data(), tick_frames);
+        if (n > 0) {
+            float *__restrict dst = mix_buf.data();
+            const float *__restrict src = speaker_buf.data();
+            for (int i = 0; i < n; i++) {
+                dst[i] += src[i];
+            }
+            heard++;
+        }
+
+        if (s.jitter.idle() && now - s.last_packet > std::chrono::milliseconds(SPEAKER_TIMEOUT_MS)) {
+            s.active = false;
+        }
+    }
+
+    limit(out);
+    return heard;
+}
+
+std::vector<VoiceReportBlock> VoiceMixer::reports() {
+    std::vector<VoiceReportBlock> blocks;
+    for (Speaker &s : speakers) {
+        VoiceReportBlock block;
+        if (s.active && blocks.size() < VOICE_MAX_REPORT_BLOCKS && s.jitter.report(block)) {
+            block.ssrc = htonl(s.ssrc);
+            blocks.push_back(block);
+        }
+    }
+    return blocks;
+}
+
+std::vector<SpeakerStats> VoiceMixer::stats() {
+    uint64_t dropped = overflows.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        LOG_WARNING("Mixer fell behind, dropped " + std::to_string(dropped) + " packets");
+    }
+
+    std::vector<SpeakerStats> all;
+    for (const Speaker &s : speakers) {
+        if (s.active) {
+            all.push_back({s.userId, s.jitter.stats()});
+        }
+    }
+    return all;
+}
+
+// Smooth peak limiter followed by a hard clip. The loops are kept simple so the
+// compiler can vectorize them.
+void VoiceMixer::limit(float *out) {
+    const float *__restrict src = mix_buf.data();
+    float *__restrict dst = out;
+
+    float peak = 0.0f;
+    for (int i = 0; i < tick_frames; i++) {
+        peak = std::max(peak, std::fabs(src[i]));
+    }
+
+    // Attack instantly, release slowly
+    float target = peak > LIMIT_THRESHOLD ? LIMIT_THRESHOLD / peak : 1.0f;
+    float start = target < limiter_gain ? target : limiter_gain;
+    limiter_gain = target < limiter_gain ? target : limiter_gain + (target - limiter_gain) * LIMIT_RELEASE;
+
+    // Ramp the release across the tick to avoid zipper noise
+    float step = (limiter_gain - start) / tick_frames;
+    for (int i = 0; i < tick_frames; i++) {
+        float v = src[i] * (start + step * i);
+        dst[i] = std::min(1.0f, std::max(-1.0f, v));
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "frame_queue.h"
+#include "jitter_buffer.h"
+#include "voice_packets.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#define MAX_SPEAKERS 16 // Decoders kept ready, anyone past this many at once isn't heard
+
+struct SpeakerStats {
+    uint32_t userId;
+    JitterStats jitter;
+};
+
+// Decodes every speaker with its own decoder and jitter buffer, then sums them
+// into a single mono stream one tick at a time. push() is called from the
+// network thread and hands packets over through a lock-free queue, everything
+// else runs on the mixer thread. Speakers come from a pool set up by init(),
+// so mixing never allocates or waits on the network thread.
+class VoiceMixer {
+  public:
+    bool init(int tick_frames); // 120, 480 or 960 (2.5, 10 or 20ms)
+    void destroy();
+    void reset(); // Forgets every speaker, not while either thread is running
+    void lockMemory() const;
+    void push(const VoicePacketHeader &header, const unsigned char *payload, int len);
+    int mix(float *out); // Writes tick_frames samples, returns how many speakers were heard
+    int tickFrames() const;
+    std::vector<SpeakerStats> stats();
+    std::vector<VoiceReportBlock> reports(); // One per speaker heard since the last call
+
+  private:
+    // Sized so a whole number of them fills the queue's pages
+    struct alignas(2048) Packet {
+        VoicePacketHeader header;
+        uint16_t len;
+        int samples;
+        std::chrono::steady_clock::time_point arrival;
+        unsigned char data[VOICE_MAX_PAYLOAD];
+    };
+
+    struct Speaker {
+        bool active = false;
+        uint32_t ssrc = 0;
+        uint32_t userId = 0;
+        JitterBuffer jitter;
+        std::chrono::steady_clock::time_point last_packet;
+    };
+
+    FrameQueue<Packet> incoming;
+    std::atomic<uint64_t> overflows{0}; // Packets the mixer was too far behind to take
+    std::vector<Speaker> speakers;      // MAX_SPEAKERS, active or not
+    int tick_frames = 0;
+    std::vector<float> mix_buf;
+    std::vector<float> speaker_buf;
+    float limiter_gain = 1.0f;
+
+    Speaker *speakerFor(const VoicePacketHeader &header);
+    void deliver(const Packet &packet);
+    void limit(float *out);
+};
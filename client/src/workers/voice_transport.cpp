@@ -0,0 +1,161 @@
+#include "voice_transport.h"
+#include "crossSockets.h"
+#include "logger.h"
+#include "voice_packets.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#define HELLO_ATTEMPTS 5
+#define HELLO_TIMEOUT_MS 100
+#define RECV_TIMEOUT_MS 200 // So the receiver can notice we are stopping
+
+bool VoiceTransport::connect(const std::string &ip, uint port, const VoiceSessionInfo &s) {
+    session = s;
+
+    struct sockaddr_in srv;
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &srv.sin_addr);
+
+    if (connectUdp(srv)) {
+        LOG_INFO("Voice transport: UDP");
+        return true;
+    }
+
+    LOG_WARNING("No UDP answer from the voice server, falling back to TCP");
+    if (connectTcp(srv)) {
+        LOG_INFO("Voice transport: TCP");
+        return true;
+    }
+
+    return false;
+}
+
+void VoiceTransport::buildHello(char *frame) const {
+    VoicePacketHeader h = {};
+    h.type = static_cast<uint8_t>(VoicePacketType::HELLO);
+    h.ssrc = htonl(session.ssrc);
+
+    std::memcpy(frame, &h, sizeof(h));
+    std::memcpy(frame + sizeof(h), &session.key, sizeof(session.key));
+}
+
+bool VoiceTransport::connectUdp(const struct sockaddr_in &srv) {
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return false;
+    }
+
+    // Connected UDP socket: plain send/recv and only the server can talk to us
+    if (::connect(sock, (struct sockaddr *)&srv, sizeof(srv)) < 0) {
+        close();
+        return false;
+    }
+
+    udp = true;
+    crossSockets::setRecvTimeout(sock, HELLO_TIMEOUT_MS);
+
+    char hello[sizeof(VoicePacketHeader) + sizeof(uint64_t)];
+    buildHello(hello);
+
+    for (int attempt = 0; attempt < HELLO_ATTEMPTS; attempt++) {
+        ::send(sock, hello, sizeof(hello), 0);
+
+        VoicePacketHeader ack;
+        ssize_t n = ::recv(sock, (char *)&ack, sizeof(ack), 0);
+        if (n == sizeof(ack) && ack.type == static_cast<uint8_t>(VoicePacketType::HELLO_ACK)) {
+            crossSockets::setRecvTimeout(sock, RECV_TIMEOUT_MS);
+            return true;
+        }
+    }
+
+    close();
+    return false;
+}
+
+bool VoiceTransport::connectTcp(const struct sockaddr_in &srv) {
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return false;
+    }
+
+    int flag = 1;
+    crossSockets::setSocketOptions(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    if (::connect(sock, (struct sockaddr *)&srv, sizeof(srv)) < 0) {
+        perror("VC connect");
+        close();
+        return false;
+    }
+
+    udp = false;
+
+    char hello[sizeof(VoicePacketHeader) + sizeof(uint64_t)];
+    buildHello(hello);
+    if (!send_voice_frame(sock, hello, sizeof(hello))) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool VoiceTransport::send(const void *frame, uint16_t len) {
+    if (udp) {
+        // A dropped datagram is not an error, that's what the receiver's jitter handling is for
+        ::send(sock, (const char *)frame, len, 0);
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(tcp_send_mutex);
+    return send_voice_frame(sock, frame, len);
+}
+
+int VoiceTransport::recv(void *frame, size_t max_len) {
+    if (!udp) {
+        return recv_voice_frame(sock, frame, max_len);
+    }
+
+    ssize_t n = ::recv(sock, (char *)frame, max_len, 0);
+    if (n < 0) {
+#ifdef _WIN32
+        return WSAGetLastError() == WSAETIMEDOUT ? 0 : -1;
+#else
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+#endif
+    }
+
+    // Runt datagrams are just ignored
+    if (n < (ssize_t)sizeof(VoicePacketHeader)) {
+        return 0;
+    }
+
+    return n;
+}
+
+void VoiceTransport::shutdown() {
+    if (sock < 0) {
+        return;
+    }
+
+    if (udp) {
+        VoicePacketHeader bye = {};
+        bye.type = static_cast<uint8_t>(VoicePacketType::BYE);
+        bye.ssrc = htonl(session.ssrc);
+        ::send(sock, (const char *)&bye, sizeof(bye), 0);
+    }
+
+    ::shutdown(sock, SHUT_RDWR);
+}
+
+void VoiceTransport::close() {
+    if (sock >= 0) {
+        ::close(sock);
+    }
+    sock = -1;
+}
+
+bool VoiceTransport::isUdp() const {
+    return udp;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "common_data.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+typedef unsigned int uint;
+
+// Carries voice frames to the relay. UDP is tried first, if the server never
+// answers the hello (blocked by a firewall, etc.) we fall back to TCP.
+class VoiceTransport {
+  public:
+    bool connect(const std::string &ip, uint port, const VoiceSessionInfo &session);
+    bool send(const void *frame, uint16_t len); // Safe from several threads
+    int recv(void *frame, size_t max_len); // 0 on timeout, -1 on error
+    void shutdown();                       // Says goodbye and wakes up a blocked recv
+    void close();
+    bool isUdp() const;
+
+  private:
+    int sock = -1;
+    bool udp = false;
+    VoiceSessionInfo session;
+    std::mutex tcp_send_mutex; // Keeps length prefixed frames from interleaving
+
+    bool connectUdp(const struct sockaddr_in &srv);
+    bool connectTcp(const struct sockaddr_in &srv);
+    void buildHello(char *frame) const;
+};
@@ -24,4 +24,19 @@ struct MessageInfo {
     std::string msg;
 };
 
+// Opus settings of a voice session, requested by the client and settled by the server
+struct VoiceCodecParams {
+    uint32_t frame_samples; // 120, 240, 480 or 960 (2.5, 5, 10 or 20ms at 48kHz)
+    uint32_t bitrate;       // bps
+    uint32_t complexity;    // 0-10
+};
+
+// Handed out over the text connection, the voice transport presents the key to join
+struct VoiceSessionInfo {
+    uint32_t channel;
+    uint32_t ssrc;
+    uint64_t key;
+    VoiceCodecParams codec;
+};
+
 #pragma pack(pop)
\ No newline at end of file
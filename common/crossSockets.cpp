@@ -11,6 +11,16 @@ void setSocketOptions(int sockfd, int level, int optname, const void *optval, so
 #endif
 }
 
+void setRecvTimeout(int sockfd, int ms) {
+#ifdef _WIN32
+    DWORD timeout = ms;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+#else
+    struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+}
+
 void initializeSockets() {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -27,5 +27,6 @@ namespace crossSockets {
 void initializeSockets();
 void setSocketOptions(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
 void closeSocket(int s);
+void setRecvTimeout(int sockfd, int ms);
 
 } // namespace crossSockets
\ No newline at end of file
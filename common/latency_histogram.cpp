@@ -0,0 +1,55 @@
+#include "latency_histogram.h"
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram(uint32_t width, size_t count) : bucket_us(width), buckets(count, 0) {}
+
+void LatencyHistogram::record(uint64_t us) {
+    size_t i = std::min<uint64_t>(us / bucket_us, buckets.size() - 1);
+    buckets[i]++;
+    total++;
+    highest = std::max(highest, us);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t wanted = (uint64_t)(p / 100.0 * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > wanted) {
+            return std::min<uint64_t>((i + 1) * bucket_us, highest);
+        }
+    }
+
+    return highest;
+}
+
+uint64_t LatencyHistogram::max() const {
+    return highest;
+}
+
+std::string LatencyHistogram::summary() const {
+    return "n=" + std::to_string(total) + " p50=" + std::to_string(percentile(50)) + "us p99=" + std::to_string(percentile(99)) +
+           "us p99.9=" + std::to_string(percentile(99.9)) + "us max=" + std::to_string(highest) + "us";
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < std::min(buckets.size(), other.buckets.size()); i++) {
+        buckets[i] += other.buckets[i];
+    }
+    total += other.total;
+    highest = std::max(highest, other.highest);
+}
+
+void LatencyHistogram::reset() {
+    std::fill(buckets.begin(), buckets.end(), 0);
+    total = 0;
+    highest = 0;
+}
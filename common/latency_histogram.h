@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fixed-width latency histogram. Recording is a couple of instructions so it
+// can sit in hot loops, but it is not thread safe: one thread records.
+class LatencyHistogram {
+  public:
+    explicit LatencyHistogram(uint32_t bucket_us = 10, size_t buckets = 1000);
+    void record(uint64_t us);
+    uint64_t count() const;
+    uint64_t percentile(double p) const; // Upper edge of the bucket, in us
+    uint64_t max() const;
+    std::string summary() const;
+    void merge(const LatencyHistogram &other); // Same bucket width and count
+    void reset();
+
+  private:
+    uint32_t bucket_us;
+    std::vector<uint64_t> buckets; // Last one also holds everything past the range
+    uint64_t total = 0;
+    uint64_t highest = 0;
+};
@@ -0,0 +1,252 @@
+#include "net_impairment.h"
+#include "voice_packets.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#define MAX_ALTERATIONS 100000 // Counting goes on past this, recording stops
+
+NetImpairer::NetImpairer() : added(100, 10000) {}
+
+void NetImpairer::init(const NetImpairment &settings, uint32_t stream) {
+    cfg = settings;
+    rng = ((uint64_t)settings.seed << 32 | stream) * 0x9e3779b97f4a7c15ULL + 1;
+    in_burst = false;
+    link_free_us = 0;
+    counters = NetImpairmentStats();
+    added.reset();
+    altered.clear();
+}
+
+// xorshift64*, plenty for picking packets
+double NetImpairer::uniform() {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 0x2545f4914f6cdd1dULL) >> 11) / (double)(1ULL << 53);
+}
+
+void NetImpairer::record(const void *frame, size_t len, int64_t now_us, NetAction action, int64_t delay_us) {
+    if (altered.size() >= MAX_ALTERATIONS) {
+        return;
+    }
+
+    NetAlteration a = {};
+    a.time_us = now_us;
+    a.type = 0xff;
+    a.action = action;
+    a.delay_us = (int32_t)delay_us;
+    if (len >= sizeof(VoicePacketHeader)) {
+        VoicePacketHeader header;
+        std::memcpy(&header, frame, sizeof(header));
+        a.type = header.type;
+        a.ssrc = ntohl(header.ssrc);
+        a.seq = ntohs(header.seq);
+    }
+    altered.push_back(a);
+}
+
+bool NetImpairer::admit(const void *frame, size_t len, int64_t now_us, int64_t &deliver_us) {
+    counters.packets++;
+    counters.bytes += len;
+
+    // Two state loss: once a burst starts everything is lost until it ends,
+    // which it does with a chance of 1 / burst_length per packet
+    if (!in_burst && cfg.burst_loss > 0.0 && uniform() < cfg.burst_loss) {
+        in_burst = true;
+    }
+    if (in_burst) {
+        if (uniform() < 1.0 / std::max(1, cfg.burst_length)) {
+            in_burst = false;
+        }
+        counters.burst_lost++;
+        record(frame, len, now_us, NetAction::BURST_LOST, 0);
+        return false;
+    }
+
+    if (cfg.loss > 0.0 && uniform() < cfg.loss) {
+        counters.lost++;
+        record(frame, len, now_us, NetAction::LOST, 0);
+        return false;
+    }
+
+    // A capped link sends one packet at a time, the rest wait their turn
+    int64_t depart_us = now_us;
+    if (cfg.bandwidth_kbps > 0) {
+        int64_t start_us = std::max(now_us, link_free_us);
+        if (start_us - now_us > (int64_t)cfg.queue_ms * 1000) {
+            counters.queue_dropped++;
+            record(frame, len, now_us, NetAction::QUEUE_DROPPED, 0);
+            return false;
+        }
+        link_free_us = start_us + (int64_t)len * 8000 / cfg.bandwidth_kbps;
+        depart_us = link_free_us;
+        if (start_us > now_us) {
+            counters.throttled++;
+            record(frame, len, now_us, NetAction::THROTTLED, depart_us - now_us);
+        }
+    }
+
+    deliver_us = depart_us + (int64_t)cfg.latency_ms * 1000;
+    if (cfg.jitter_ms > 0) {
+        deliver_us += (int64_t)(uniform() * cfg.jitter_ms * 1000);
+    }
+    if (cfg.reorder > 0.0 && uniform() < cfg.reorder) {
+        deliver_us += (int64_t)cfg.reorder_ms * 1000;
+        counters.reordered++;
+        record(frame, len, now_us, NetAction::REORDERED, deliver_us - now_us);
+    }
+
+    added.record(deliver_us - now_us);
+    return true;
+}
+
+const NetImpairmentStats &NetImpairer::stats() const {
+    return counters;
+}
+
+const LatencyHistogram &NetImpairer::delay() const {
+    return added;
+}
+
+const std::vector<NetAlteration> &NetImpairer::alterations() const {
+    return altered;
+}
+
+std::string NetImpairer::summary() const {
+    const NetImpairmentStats &s = counters;
+    return std::to_string(s.packets) + " packets, lost " + std::to_string(s.lost) + " + " + std::to_string(s.burst_lost) +
+           " in bursts, queue dropped " + std::to_string(s.queue_dropped) + ", reordered " + std::to_string(s.reordered) +
+           ", throttled " + std::to_string(s.throttled) + ", added delay " + added.summary();
+}
+
+// Heap order, earliest due on top
+static bool due_later(const NetDelayLine::Packet &a, const NetDelayLine::Packet &b) {
+    return a.due_us != b.due_us ? a.due_us > b.due_us : a.order > b.order;
+}
+
+void NetDelayLine::push(int64_t due_us, int route, const void *frame, size_t len) {
+    Packet p;
+    p.due_us = due_us;
+    p.order = pushed++;
+    p.route = route;
+    p.data.assign((const char *)frame, (const char *)frame + len);
+    heap.push_back(std::move(p));
+    std::push_heap(heap.begin(), heap.end(), due_later);
+}
+
+bool NetDelayLine::pop(int64_t now_us, Packet &out) {
+    if (heap.empty() || heap.front().due_us > now_us) {
+        return false;
+    }
+
+    std::pop_heap(heap.begin(), heap.end(), due_later);
+    out = std::move(heap.back());
+    heap.pop_back();
+    return true;
+}
+
+int64_t NetDelayLine::nextDue() const {
+    return heap.empty() ? -1 : heap.front().due_us;
+}
+
+size_t NetDelayLine::size() const {
+    return heap.size();
+}
+
+const char *net_action_name(NetAction action) {
+    switch (action) {
+    case NetAction::LOST:
+        return "lost";
+    case NetAction::BURST_LOST:
+        return "burst_lost";
+    case NetAction::QUEUE_DROPPED:
+        return "queue_dropped";
+    case NetAction::REORDERED:
+        return "reordered";
+    case NetAction::THROTTLED:
+        return "throttled";
+    default:
+        return "unknown";
+    }
+}
+
+// "12.5" or "12.5:30", false on anything else
+static bool parse_pair(const std::string &value, double &first, double &second, bool &has_second) {
+    char *end;
+    first = std::strtod(value.c_str(), &end);
+    if (end == value.c_str()) {
+        return false;
+    }
+
+    has_second = *end == ':';
+    if (has_second) {
+        const char *rest = end + 1;
+        second = std::strtod(rest, &end);
+        if (end == rest) {
+            return false;
+        }
+    }
+    return *end == '\0' && first >= 0.0 && (!has_second || second >= 0.0);
+}
+
+bool net_impairment_parse(const std::string &spec, NetImpairment &out) {
+    NetImpairment settings = out;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t comma = spec.find(',', start);
+        std::string item = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? spec.size() : comma + 1;
+
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        double a, b = 0.0;
+        bool has_b;
+        if (!parse_pair(item.substr(eq + 1), a, b, has_b)) {
+            return false;
+        }
+
+        if (key == "loss" && !has_b && a <= 100.0) {
+            settings.loss = a / 100.0;
+        } else if (key == "burst" && a <= 100.0 && (!has_b || b >= 1.0)) {
+            settings.burst_loss = a / 100.0;
+            settings.burst_length = has_b ? (int)b : settings.burst_length;
+        } else if (key == "latency" && !has_b) {
+            settings.latency_ms = (int)a;
+        } else if (key == "jitter" && !has_b) {
+            settings.jitter_ms = (int)a;
+        } else if (key == "reorder" && a <= 100.0) {
+            settings.reorder = a / 100.0;
+            settings.reorder_ms = has_b ? (int)b : settings.reorder_ms;
+        } else if (key == "bandwidth") {
+            settings.bandwidth_kbps = (int)a;
+            settings.queue_ms = has_b ? (int)b : settings.queue_ms;
+        } else if (key == "seed" && !has_b) {
+            settings.seed = (uint32_t)a;
+        } else {
+            return false;
+        }
+    }
+
+    out = settings;
+    return true;
+}
+
+std::string net_impairment_describe(const NetImpairment &s) {
+    auto percent = [](double chance) {
+        std::string text = std::to_string(chance * 100.0);
+        text.erase(text.find_last_not_of('0') + 1);
+        if (text.back() == '.') {
+            text.pop_back();
+        }
+        return text;
+    };
+
+    return "loss=" + percent(s.loss) + ",burst=" + percent(s.burst_loss) + ":" + std::to_string(s.burst_length) +
+           ",latency=" + std::to_string(s.latency_ms) + ",jitter=" + std::to_string(s.jitter_ms) + ",reorder=" +
+           percent(s.reorder) + ":" + std::to_string(s.reorder_ms) + ",bandwidth=" + std::to_string(s.bandwidth_kbps) +
+           ":" + std::to_string(s.queue_ms) + ",seed=" + std::to_string(s.seed);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "latency_histogram.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A bad network on demand, for tuning the voice path. Everything is driven by
+// the caller's clock and a seeded generator, so the same settings and traffic
+// give the same result every run.
+struct NetImpairment {
+    double loss = 0.0;         // Chance any packet is lost, 0..1
+    double burst_loss = 0.0;   // Chance a packet starts a burst of losses, 0..1
+    int burst_length = 3;      // Mean packets lost per burst
+    int latency_ms = 0;        // One way
+    int jitter_ms = 0;         // Extra delay, uniform up to this, packets may overtake each other
+    double reorder = 0.0;      // Chance a packet is held back by reorder_ms so later ones pass it, 0..1
+    int reorder_ms = 20;
+    int bandwidth_kbps = 0;    // 0 for no cap, otherwise packets queue for the link
+    int queue_ms = 100;        // Longest wait for the link before a packet is dropped
+    uint32_t seed = 1;
+};
+
+// "loss=2,burst=1:5,latency=40,jitter=20,reorder=1:30,bandwidth=64:100,seed=7"
+// Percentages for chances, burst=chance:length, reorder=chance:ms, bandwidth=kbps:queue_ms
+bool net_impairment_parse(const std::string &spec, NetImpairment &out);
+std::string net_impairment_describe(const NetImpairment &settings);
+
+enum class NetAction : uint8_t { LOST, BURST_LOST, QUEUE_DROPPED, REORDERED, THROTTLED };
+const char *net_action_name(NetAction action);
+
+// A packet the impairer did more to than add latency and jitter
+struct NetAlteration {
+    int64_t time_us;  // Caller's clock, when it was sent
+    uint8_t type;     // VoicePacketType, 0xff if it wasn't a voice frame
+    uint32_t ssrc;
+    uint16_t seq;
+    NetAction action;
+    int32_t delay_us; // Total added delay, 0 if dropped
+};
+
+struct NetImpairmentStats {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t lost = 0;
+    uint64_t burst_lost = 0;
+    uint64_t queue_dropped = 0;
+    uint64_t reordered = 0;
+    uint64_t throttled = 0; // Waited for the link
+};
+
+// One direction of the network. admit() decides the fate of each packet as it
+// is sent; the caller holds it back until the returned time, for example in a
+// NetDelayLine. Not thread safe.
+class NetImpairer {
+  public:
+    NetImpairer();
+    void init(const NetImpairment &settings, uint32_t stream); // stream keeps directions on separate random sequences
+    bool admit(const void *frame, size_t len, int64_t now_us, int64_t &deliver_us); // False if dropped
+    const NetImpairmentStats &stats() const;
+    const LatencyHistogram &delay() const;          // Added to the packets that got through
+    const std::vector<NetAlteration> &alterations() const;
+    std::string summary() const;
+
+  private:
+    NetImpairment cfg;
+    uint64_t rng = 0;
+    bool in_burst = false;
+    int64_t link_free_us = 0; // When the capped link finishes its queue
+    NetImpairmentStats counters;
+    LatencyHistogram added;
+    std::vector<NetAlteration> altered;
+
+    double uniform();
+    void record(const void *frame, size_t len, int64_t now_us, NetAction action, int64_t delay_us);
+};
+
+// Packets held until their delivery time. Ties leave in the order they came in.
+class NetDelayLine {
+  public:
+    struct Packet {
+        int64_t due_us;
+        uint64_t order;
+        int route; // Where it goes, up to the caller
+        std::vector<char> data;
+    };
+
+    void push(int64_t due_us, int route, const void *frame, size_t len);
+    bool pop(int64_t now_us, Packet &out); // The next packet due by now
+    int64_t nextDue() const;               // -1 if empty
+    size_t size() const;
+
+  private:
+    std::vector<Packet> heap;
+    uint64_t pushed = 0;
+};
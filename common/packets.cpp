@@ -1,13 +1,26 @@
 #include "packets.h"
 #include "common_data.h"
 #include "logger.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
 #include <cstring>
-#include <fstream>
+#include <fcntl.h>
 #include <string>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define FILE_CHUNK_SIZE 16384 // Only used where sendfile is not available
+
 bool send_all(int sock, const void *buf, size_t len) {
     const char *ptr = static_cast<const char *>(buf);
     size_t sent = 0;
@@ -125,30 +138,72 @@ bool send_message(int sock, const MessageInfo &m) {
     return true;
 }
 
+bool send_file_packet(int sock, PacketType type, int fd, uint64_t offset, uint32_t length) {
+    PacketHeader header;
+    header.type = static_cast<uint8_t>(type);
+    header.length = htonl(length);
+
+    if (!send_all(sock, &header, sizeof(header))) {
+        return false;
+    }
+
+#ifdef __linux__
+    // Let the kernel copy straight from the page cache into the socket
+    off_t off = static_cast<off_t>(offset);
+    size_t left = length;
+    while (left > 0) {
+        ssize_t n = sendfile(sock, fd, &off, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        left -= n;
+    }
+#else
+    if (lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+        return false;
+    }
+
+    char chunk[FILE_CHUNK_SIZE];
+    size_t left = length;
+    while (left > 0) {
+        ssize_t n = read(fd, chunk, std::min(left, sizeof(chunk)));
+        if (n <= 0) {
+            return false;
+        }
+        if (!send_all(sock, chunk, n)) {
+            return false;
+        }
+        left -= n;
+    }
+#endif
+
+    return true;
+}
+
 bool send_image(int socket, const std::string &filename) {
-    // Open file in binary mode and at the end
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
+    int fd = open(filename.c_str(), O_RDONLY | O_BINARY);
+    if (fd < 0) {
         LOG_ERROR("Failed to open file");
         return false;
     }
 
     // Get file size
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    uint64_t fileSize = static_cast<uint64_t>(size);
-
-    // Read file into buffer
-    std::vector<char> buffer(size);
-    if (!file.read(buffer.data(), size)) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size > UINT32_MAX) {
         LOG_ERROR("Failed to read file");
+        close(fd);
         return false;
     }
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
 
     send_packet(socket, PacketType::UINT64, fileSize); // Send file size first (as 64-bit integer)
-    send_packet(socket, PacketType::BUFFER, buffer);   // Send image
+    bool ok = send_file_packet(socket, PacketType::BUFFER, fd, 0, static_cast<uint32_t>(fileSize)); // Send image
 
-    return true;
+    close(fd);
+    return ok;
 }
 
 bool recv_packet(int sock, PacketType &type, std::vector<char> &data) {
@@ -170,6 +225,29 @@ bool recv_packet(int sock, PacketType &type, std::vector<char> &data) {
     return true;
 }
 
+bool recv_packet(int sock, PacketType &type, std::vector<char> &data, uint32_t max_length) {
+    PacketHeader header;
+    if (!recv_all(sock, &header, sizeof(header))) {
+        return false;
+    }
+
+    type = static_cast<PacketType>(header.type);
+    uint32_t length = ntohl(header.length);
+    if (length > max_length) {
+        LOG_ERROR("Packet too large: " + std::to_string(length) + " bytes");
+        return false;
+    }
+
+    data.resize(length);
+    if (length > 0) {
+        if (!recv_all(sock, data.data(), length)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool recv_code(int sock, uint8_t &code) {
     PacketType type;
     std::vector<char> buffer;
@@ -24,6 +24,25 @@ enum class PacketType : uint8_t {
     CHANNEL_INFO,
     USER_INFO,
     USER_IMAGE,
+    // Attachments, server side only for now: the client doesn't send these yet and
+    // messages don't reference attachments, that linkage comes later
+    ATTACHMENT_UPLOAD,
+    ATTACHMENT_CHUNK,
+    ATTACHMENT_ACK,
+    ATTACHMENT_GET,
+    // Voice
+    VOICE_SESSION,
+};
+
+// Attachments are transferred in chunks of at most this many bytes
+#define ATTACHMENT_CHUNK_SIZE (64 * 1024)
+
+enum class AttachmentStatus : uint8_t {
+    ACCEPTED,  // Offset tells the sender where to continue
+    COMPLETE,  // Stored (or already present) and verified
+    REJECTED,  // Unknown upload, bad offset or too large
+    CORRUPT,   // Content did not match its hash, upload restarts from 0
+    NOT_FOUND, // Requested attachment is not in the store
 };
 
 // header format (packed to avoid padding)
@@ -54,9 +73,15 @@ bool send_userInfo(int sock, const UserInfo &u);
 bool send_message(int sock, const MessageInfo &msg);
 bool send_image(int socket, const std::string &filename);
 
+// send a packet whose payload is streamed from an open file, without buffering it in user space
+bool send_file_packet(int sock, PacketType type, int fd, uint64_t offset, uint32_t length);
+
 // receive a packet
 bool recv_packet(int sock, PacketType &type, std::vector<char> &data);
 
+// receive a packet, failing instead of allocating if the peer announces more than max_length bytes
+bool recv_packet(int sock, PacketType &type, std::vector<char> &data, uint32_t max_length);
+
 bool recv_code(int sock, uint8_t &code);
 
 bool recv_string(int sock, std::string &str);
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Incremental SHA-256, used to content-address attachments
+class Sha256 {
+  public:
+    Sha256();
+    void update(const void *data, size_t len);
+    std::string hexDigest(); // Finalizes the hash
+
+  private:
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t block_len;
+    uint64_t total_len;
+
+    void transform(const uint8_t *chunk);
+};
+
+bool isSha256Hex(const std::string &str);
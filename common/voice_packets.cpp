@@ -0,0 +1,140 @@
+#include "voice_packets.h"
+#include "packets.h"
+#include <algorithm>
+#include <cstring>
+
+#define VOICE_MIN_BITRATE 6000
+#define VOICE_MAX_BITRATE 128000
+
+bool send_voice_frame(int sock, const void *frame, uint16_t len) {
+    // Single send so the prefix never goes out on its own with TCP_NODELAY
+    char buf[sizeof(uint16_t) + VOICE_MAX_FRAME];
+    if (len > VOICE_MAX_FRAME) {
+        return false;
+    }
+
+    uint16_t len_net = htons(len);
+    std::memcpy(buf, &len_net, sizeof(len_net));
+    std::memcpy(buf + sizeof(len_net), frame, len);
+
+    return send_all(sock, buf, sizeof(len_net) + len);
+}
+
+int recv_voice_frame(int sock, void *frame, size_t max_len) {
+    uint16_t len_net;
+    if (!recv_all(sock, &len_net, sizeof(len_net))) {
+        return -1;
+    }
+
+    uint16_t len = ntohs(len_net);
+    if (len < sizeof(VoicePacketHeader) || len > max_len) {
+        return -1;
+    }
+
+    if (!recv_all(sock, frame, len)) {
+        return -1;
+    }
+
+    return len;
+}
+
+VoiceCodecParams voice_profile_params(VoiceProfile profile) {
+    switch (profile) {
+    case VoiceProfile::EFFICIENCY:
+        return {960, 24000, 10};
+    case VoiceProfile::LOW_LATENCY:
+    default:
+        return {120, 38000, 7};
+    }
+}
+
+bool voice_profile_from_name(const std::string &name, VoiceProfile &profile) {
+    if (name == "low_latency") {
+        profile = VoiceProfile::LOW_LATENCY;
+    } else if (name == "efficiency") {
+        profile = VoiceProfile::EFFICIENCY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+VoiceCodecParams voice_codec_sanitize(const VoiceCodecParams &requested) {
+    VoiceCodecParams p = requested;
+
+    // Round down to the nearest frame duration Opus has
+    static const uint32_t frames[] = {960, 480, 240, 120};
+    p.frame_samples = 120;
+    for (uint32_t f : frames) {
+        if (requested.frame_samples >= f) {
+            p.frame_samples = f;
+            break;
+        }
+    }
+
+    p.bitrate = std::clamp<uint32_t>(requested.bitrate, VOICE_MIN_BITRATE, VOICE_MAX_BITRATE);
+    p.complexity = std::min<uint32_t>(requested.complexity, 10);
+    return p;
+}
+
+int opus_packet_samples(const unsigned char *packet, size_t len) {
+    if (len < 1) {
+        return -1;
+    }
+
+    uint8_t toc = packet[0];
+    int config = toc >> 3;
+
+    // Samples per frame for each config group
+    int frame_samples;
+    if (config < 12) {
+        // SILK: 10, 20, 40, 60 ms
+        static const int silk[4] = {480, 960, 1920, 2880};
+        frame_samples = silk[config & 3];
+    } else if (config < 16) {
+        // Hybrid: 10, 20 ms
+        frame_samples = (config & 1) ? 960 : 480;
+    } else {
+        // CELT: 2.5, 5, 10, 20 ms
+        static const int celt[4] = {120, 240, 480, 960};
+        frame_samples = celt[config & 3];
+    }
+
+    int frames;
+    switch (toc & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 1:
+        // Two frames of equal size
+        if ((len - 1) % 2 != 0) {
+            return -1;
+        }
+        frames = 2;
+        break;
+    case 2:
+        if (len < 2) {
+            return -1;
+        }
+        frames = 2;
+        break;
+    default:
+        // Arbitrary number of frames, count in the second byte
+        if (len < 2) {
+            return -1;
+        }
+        frames = packet[1] & 0x3F;
+        if (frames == 0) {
+            return -1;
+        }
+        break;
+    }
+
+    // A packet never holds more than 120 ms
+    int samples = frames * frame_samples;
+    if (samples > 5760) {
+        return -1;
+    }
+
+    return samples;
+}
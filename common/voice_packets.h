@@ -0,0 +1,69 @@
+#pragma once
+#include "common_data.h"
+#include "crossSockets.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Voice frames travel as single UDP datagrams, or length prefixed (uint16,
+// network order) over the TCP fallback. Both carry the same header.
+enum class VoicePacketType : uint8_t {
+    AUDIO,     // Header + Opus payload
+    HELLO,     // Header + uint64 session key, binds the transport to a session
+    HELLO_ACK, // Server confirms the binding
+    BYE,       // Client is leaving
+    REPORT,    // Header + VoiceReportBlocks, how a listener is hearing each speaker
+};
+
+#pragma pack(push, 1)
+struct VoicePacketHeader {
+    uint8_t type;       // VoicePacketType
+    uint8_t flags;      // VOICE_FLAG_*
+    uint16_t seq;       // network order, +1 per frame
+    uint32_t timestamp; // network order, in samples at 48kHz
+    uint32_t ssrc;      // network order, assigned by the server
+    uint32_t speaker;   // network order, user id of the speaker, stamped by the relay
+    uint8_t level;      // Audio level in -dBov, 0 loudest to 127 silent (as in RFC 6464)
+};
+#pragma pack(pop)
+
+// Header flags
+#define VOICE_FLAG_SILENCE 0x01   // Comfort noise keepalive, the speaker is not talking
+#define VOICE_FLAG_TALKSPURT 0x02 // First frame after a silence, sequence gaps before it are not loss
+
+#define VOICE_LEVEL_SILENT 127
+
+// Reception quality of one speaker, sent by listeners about once a second.
+// The relay hands each block to the speaker it is about.
+#pragma pack(push, 1)
+struct VoiceReportBlock {
+    uint32_t ssrc;     // network order, the speaker this is about
+    uint8_t loss;      // Fraction lost since the last report, out of 256 (as in RTCP)
+    uint16_t jitter;   // network order, interarrival jitter in samples
+    uint16_t last_seq; // network order, highest sequence number received
+    uint32_t delay;    // network order, us between last_seq arriving and this report, for RTT
+};
+#pragma pack(pop)
+
+#define VOICE_MAX_PAYLOAD 1276 // Largest Opus packet
+#define VOICE_MAX_FRAME (sizeof(VoicePacketHeader) + VOICE_MAX_PAYLOAD)
+#define VOICE_MAX_REPORT_BLOCKS (VOICE_MAX_PAYLOAD / sizeof(VoiceReportBlock))
+
+// Connected voice sockets (TCP fallback) need a length prefix to keep frame boundaries
+bool send_voice_frame(int sock, const void *frame, uint16_t len);
+// Returns the frame length or -1 on error/disconnect
+int recv_voice_frame(int sock, void *frame, size_t max_len);
+
+// Codec presets a session can ask for
+enum class VoiceProfile : uint32_t {
+    LOW_LATENCY, // 2.5ms frames, the most packets and the least delay
+    EFFICIENCY,  // 20ms frames, far fewer packets and enables Opus DTX
+};
+
+VoiceCodecParams voice_profile_params(VoiceProfile profile);
+bool voice_profile_from_name(const std::string &name, VoiceProfile &profile); // "low_latency" or "efficiency"
+// Clamps requested settings to what both ends support
+VoiceCodecParams voice_codec_sanitize(const VoiceCodecParams &requested);
+
+// Duration of an Opus packet in samples at 48kHz, parsed from its TOC byte (RFC 6716, 3.1). -1 if malformed
+int opus_packet_samples(const unsigned char *packet, size_t len);
@@ -0,0 +1,622 @@
+// How many voice users one relay can carry. The real VoiceRelay runs in this
+// process on a loopback UDP socket, sessions come from AudioServer::createSession
+// as the text connection would hand them out, and every simulated client is a
+// UDP socket of its own that goes through the HELLO handshake. Speakers stream
+// pre-encoded Opus frames at the real frame rate, listeners report once a second
+// like clients do and time every frame they get. Each step grows the channels
+// by more listeners and prints one line of the capacity curve, until loss or
+// latency give out. Built with -DPERRY_BUILD_BENCHMARKS=ON.
+//
+// voice_load_bench [speakers per channel] [max listeners per channel] [channels] [seconds per step]
+//                  [low_latency|efficiency] [relay workers]
+#include "audio_server.h"
+#include "config.h"
+#include "latency_histogram.h"
+#include "logger.h"
+#include "voice_packets.h"
+#include "voice_relay.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <opus.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define WARMUP_MS 1000      // Handshakes settle and speakers get selected before anything counts
+#define DRAIN_MS 300        // After the last frame, for the ones still queued in the relay
+#define HELLO_TIMEOUT_MS 500
+#define HELLO_TRIES 3
+#define REPORT_MS 1000      // As often as clients send reports
+#define SPEAKER_LEVEL 20    // -dBov, comfortably loud
+#define RECEIVERS 4         // Threads timing the listeners, at most one per core
+#define HISTOGRAM_BUCKET_US 100
+#define HISTOGRAM_BUCKETS 2000 // 200ms, anything later lands in the last bucket
+#define MAX_EVENTS 256
+#define SEQ_SLOTS 65536
+#define MAX_LATE_PERCENT 1.0 // Frames the generator may send over a frame period late before its numbers don't count
+
+// A step past either of these ends the sweep
+#define MAX_LOSS_PERCENT 1.0
+#define MAX_P99_MS 20
+
+static const size_t listener_steps[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+static const auto epoch = std::chrono::steady_clock::now();
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+static void sleep_until_ns(int64_t ns) {
+    std::this_thread::sleep_until(epoch + std::chrono::nanoseconds(ns));
+}
+
+// Threads of the load generator, every other thread in the process is the relay's
+static std::mutex bench_threads_mutex;
+static std::vector<pid_t> bench_threads;
+
+static void register_bench_thread() {
+    std::lock_guard<std::mutex> lock(bench_threads_mutex);
+    bench_threads.push_back((pid_t)syscall(SYS_gettid));
+}
+
+// CPU time the relay's threads have used so far
+static int64_t relay_cpu_ns() {
+    std::lock_guard<std::mutex> lock(bench_threads_mutex);
+
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+        return 0;
+    }
+
+    int64_t ticks = 0;
+    while (dirent *entry = readdir(dir)) {
+        pid_t tid = (pid_t)std::atoi(entry->d_name);
+        if (tid <= 0 || std::find(bench_threads.begin(), bench_threads.end(), tid) != bench_threads.end()) {
+            continue;
+        }
+
+        std::string path = "/proc/self/task/" + std::string(entry->d_name) + "/stat";
+        FILE *f = std::fopen(path.c_str(), "r");
+        if (!f) {
+            continue;
+        }
+        char line[1024];
+        size_t n = std::fread(line, 1, sizeof(line) - 1, f);
+        std::fclose(f);
+        line[n] = '\0';
+
+        // utime and stime are the 12th and 13th fields after the parenthesized name
+        const char *p = std::strrchr(line, ')');
+        long long utime = 0, stime = 0;
+        if (p && std::sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld", &utime, &stime) == 2) {
+            ticks += utime + stime;
+        }
+    }
+    closedir(dir);
+
+    return ticks * 1000000000LL / sysconf(_SC_CLK_TCK);
+}
+
+struct Speaker {
+    int sock;
+    uint32_t ssrc;
+    size_t channel;
+    uint16_t seq = 0;
+    uint32_t timestamp = 0;
+    uint64_t sent_in_window = 0;
+    std::unique_ptr<std::atomic<int64_t>[]> sent_ns; // By seq, when each frame left, 0 if not yet
+};
+
+// How one listener hears one speaker
+struct Stream {
+    uint64_t received = 0;    // Frames sent inside the measuring window
+    double jitter_us = 0.0;   // Interarrival jitter as in RFC 3550, over the window
+    int64_t last_transit = -1;
+    uint64_t packets = 0;     // Everything, for the reports
+    uint16_t highest_seq = 0;
+    uint64_t reported_packets = 0;
+    uint16_t reported_seq = 0;
+};
+
+struct Listener {
+    int sock;
+    uint32_t ssrc;
+    size_t channel;
+    std::vector<Stream> streams; // By speaker within the channel
+    LatencyHistogram latency{HISTOGRAM_BUCKET_US, HISTOGRAM_BUCKETS};
+};
+
+struct StepResult {
+    uint64_t frames_in = 0;
+    uint64_t frames_out = 0;
+    uint64_t expected = 0; // By the listeners, from the speakers they hear
+    LatencyHistogram latency{HISTOGRAM_BUCKET_US, HISTOGRAM_BUCKETS};
+    uint64_t worst_p99_us = 0; // Of any one listener
+    double jitter_sum_us = 0.0;
+    double jitter_max_us = 0.0;
+    size_t streams_heard = 0;
+    size_t streams_expected = 0;
+    double relay_cores = 0.0;
+    uint64_t sends = 0;      // By the generator inside the window
+    uint64_t late_sends = 0; // More than a frame period behind its schedule
+};
+
+// Everything a step's threads share, read only while they run except where noted
+struct Step {
+    size_t speakers_per_channel;
+    int frame_samples;
+    int64_t start_ns;
+    int64_t window_start_ns;
+    int64_t window_end_ns;
+    std::vector<Speaker> speakers; // Channel by channel
+    std::vector<Listener> listeners; // Each one touched only by its receiver
+    std::unordered_map<uint32_t, size_t> speaker_by_ssrc;
+    std::atomic<bool> receiving{true};
+};
+
+// One second of a voiced sound, encoded once and sent round and round
+static bool preencode(const VoiceCodecParams &codec, std::vector<std::vector<unsigned char>> &frames) {
+    int err;
+    OpusEncoder *encoder = opus_encoder_create(48000, 1, OPUS_APPLICATION_VOIP, &err);
+    if (err != OPUS_OK) {
+        return false;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(codec.bitrate));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(codec.complexity));
+
+    std::vector<float> pcm(codec.frame_samples);
+    unsigned char packet[VOICE_MAX_PAYLOAD];
+    size_t t = 0;
+    for (uint32_t i = 0; i < 48000 / codec.frame_samples; i++) {
+        for (float &s : pcm) {
+            double time = t++ / 48000.0;
+            double syllables = 0.5 + 0.5 * std::sin(2.0 * M_PI * 4.0 * time);
+            s = (float)(0.2 * syllables *
+                        (std::sin(2.0 * M_PI * 140.0 * time) + 0.5 * std::sin(2.0 * M_PI * 280.0 * time) +
+                         0.25 * std::sin(2.0 * M_PI * 700.0 * time)));
+        }
+
+        int len = opus_encode_float(encoder, pcm.data(), codec.frame_samples, packet, sizeof(packet));
+        if (len <= 0) {
+            opus_encoder_destroy(encoder);
+            return false;
+        }
+        frames.emplace_back(packet, packet + len);
+    }
+
+    opus_encoder_destroy(encoder);
+    return true;
+}
+
+// A client joining voice: a session as the text connection hands it out, then the UDP handshake
+static bool open_session(uint32_t userId, uint32_t channel, const VoiceCodecParams &requested, const sockaddr_in &relay,
+                         int &sock, uint32_t &ssrc) {
+    VoiceSessionInfo session = AudioServer::createSession(userId, channel, requested);
+    ssrc = session.ssrc;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || connect(sock, (const sockaddr *)&relay, sizeof(relay)) < 0) {
+        return false;
+    }
+    timeval timeout = {0, HELLO_TIMEOUT_MS * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char hello[sizeof(VoicePacketHeader) + sizeof(uint64_t)];
+    VoicePacketHeader h = {};
+    h.type = static_cast<uint8_t>(VoicePacketType::HELLO);
+    h.ssrc = htonl(session.ssrc);
+    std::memcpy(hello, &h, sizeof(h));
+    std::memcpy(hello + sizeof(h), &session.key, sizeof(session.key));
+
+    for (int i = 0; i < HELLO_TRIES; i++) {
+        send(sock, hello, sizeof(hello), 0);
+
+        VoicePacketHeader ack;
+        ssize_t n = recv(sock, &ack, sizeof(ack), 0);
+        if (n == (ssize_t)sizeof(ack) && ack.type == static_cast<uint8_t>(VoicePacketType::HELLO_ACK) &&
+            ntohl(ack.ssrc) == session.ssrc) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Every speaker on its own schedule, spread evenly over the frame period
+static void send_loop(Step &step, const std::vector<std::vector<unsigned char>> &frames, StepResult &result) {
+    register_bench_thread();
+
+    const size_t n = step.speakers.size();
+    const int64_t period_ns = (int64_t)step.frame_samples * 1000000000LL / 48000;
+    char frame[VOICE_MAX_FRAME];
+
+    for (uint64_t slot = 0;; slot++) {
+        int64_t at = step.start_ns + (int64_t)(slot / n) * period_ns + (int64_t)(slot % n) * period_ns / (int64_t)n;
+        if (at >= step.window_end_ns) {
+            break;
+        }
+        if (at > now_ns()) {
+            sleep_until_ns(at);
+        }
+
+        Speaker &s = step.speakers[slot % n];
+        const std::vector<unsigned char> &payload = frames[s.seq % frames.size()];
+
+        VoicePacketHeader h = {};
+        h.type = static_cast<uint8_t>(VoicePacketType::AUDIO);
+        h.flags = s.seq == 0 ? VOICE_FLAG_TALKSPURT : 0;
+        h.seq = htons(s.seq);
+        h.timestamp = htonl(s.timestamp);
+        h.ssrc = htonl(s.ssrc);
+        h.level = SPEAKER_LEVEL;
+        std::memcpy(frame, &h, sizeof(h));
+        std::memcpy(frame + sizeof(h), payload.data(), payload.size());
+
+        int64_t now = now_ns();
+        s.sent_ns[s.seq].store(now, std::memory_order_release);
+        send(s.sock, frame, sizeof(h) + payload.size(), MSG_DONTWAIT);
+
+        if (now >= step.window_start_ns) {
+            s.sent_in_window++;
+            result.sends++;
+            result.late_sends += now - at > period_ns;
+        }
+        s.seq++;
+        s.timestamp += step.frame_samples;
+    }
+}
+
+static void receive(Step &step, Listener &l) {
+    char frame[VOICE_MAX_FRAME];
+
+    while (true) {
+        ssize_t len = recv(l.sock, frame, sizeof(frame), MSG_DONTWAIT);
+        if (len < 0) {
+            return;
+        }
+        int64_t now = now_ns();
+
+        VoicePacketHeader h;
+        if (len < (ssize_t)sizeof(h)) {
+            continue;
+        }
+        std::memcpy(&h, frame, sizeof(h));
+        if (h.type != static_cast<uint8_t>(VoicePacketType::AUDIO)) {
+            continue;
+        }
+
+        auto it = step.speaker_by_ssrc.find(ntohl(h.ssrc));
+        if (it == step.speaker_by_ssrc.end() || step.speakers[it->second].channel != l.channel) {
+            continue;
+        }
+        uint16_t seq = ntohs(h.seq);
+        int64_t sent = step.speakers[it->second].sent_ns[seq].load(std::memory_order_acquire);
+        if (sent <= 0 || sent > now) {
+            continue; // Sequence wrapped past it
+        }
+
+        Stream &s = l.streams[it->second % step.speakers_per_channel];
+        if (s.packets == 0 || (int16_t)(seq - s.highest_seq) > 0) {
+            s.highest_seq = seq;
+        }
+        s.packets++;
+
+        if (sent < step.window_start_ns || sent >= step.window_end_ns) {
+            continue;
+        }
+
+        int64_t transit = now - sent;
+        s.received++;
+        l.latency.record(transit / 1000);
+        if (s.last_transit >= 0) {
+            s.jitter_us += (std::abs(transit - s.last_transit) / 1000.0 - s.jitter_us) / 16.0;
+        }
+        s.last_transit = transit;
+    }
+}
+
+// What a client reports about each speaker it hears, the relay hands the blocks on
+static void send_report(const Step &step, Listener &l) {
+    char frame[sizeof(VoicePacketHeader) + VOICE_MAX_REPORT_BLOCKS * sizeof(VoiceReportBlock)];
+    VoicePacketHeader h = {};
+    h.type = static_cast<uint8_t>(VoicePacketType::REPORT);
+    h.ssrc = htonl(l.ssrc);
+    std::memcpy(frame, &h, sizeof(h));
+
+    size_t blocks = 0;
+    for (size_t i = 0; i < l.streams.size() && blocks < VOICE_MAX_REPORT_BLOCKS; i++) {
+        Stream &s = l.streams[i];
+        if (s.packets == 0) {
+            continue;
+        }
+
+        uint16_t expected = s.highest_seq - s.reported_seq;
+        uint64_t got = s.packets - s.reported_packets;
+        VoiceReportBlock block = {};
+        block.ssrc = htonl(step.speakers[l.channel * step.speakers_per_channel + i].ssrc);
+        block.loss = expected > got ? (uint8_t)std::min<uint64_t>(255, (expected - got) * 256 / expected) : 0;
+        block.jitter = htons((uint16_t)std::min(65535.0, s.jitter_us * 48000 / 1e6));
+        block.last_seq = htons(s.highest_seq);
+        std::memcpy(frame + sizeof(h) + blocks * sizeof(block), &block, sizeof(block));
+        blocks++;
+
+        s.reported_seq = s.highest_seq;
+        s.reported_packets = s.packets;
+    }
+
+    if (blocks > 0) {
+        send(l.sock, frame, sizeof(h) + blocks * sizeof(VoiceReportBlock), MSG_DONTWAIT);
+    }
+}
+
+// Listeners with id % receivers == id, speaker sockets are only drained
+static void receive_loop(Step &step, size_t id, size_t receivers) {
+    register_bench_thread();
+
+    int epoll_fd = epoll_create1(0);
+    std::vector<size_t> mine;
+    for (size_t i = id; i < step.listeners.size(); i += receivers) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, step.listeners[i].sock, &ev);
+        mine.push_back(i);
+    }
+    for (size_t i = id; i < step.speakers.size(); i += receivers) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = step.listeners.size() + i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, step.speakers[i].sock, &ev);
+    }
+
+    epoll_event events[MAX_EVENTS];
+    char discard[VOICE_MAX_FRAME];
+    int64_t next_report = now_ns() + (int64_t)REPORT_MS * 1000000;
+
+    while (step.receiving.load()) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 10);
+        for (int i = 0; i < n; i++) {
+            size_t index = events[i].data.u64;
+            if (index < step.listeners.size()) {
+                receive(step, step.listeners[index]);
+            } else {
+                while (recv(step.speakers[index - step.listeners.size()].sock, discard, sizeof(discard), MSG_DONTWAIT) >= 0) {
+                }
+            }
+        }
+
+        if (now_ns() >= next_report) {
+            for (size_t i : mine) {
+                send_report(step, step.listeners[i]);
+            }
+            next_report += (int64_t)REPORT_MS * 1000000;
+        }
+    }
+
+    close(epoll_fd);
+}
+
+static void leave(int sock, uint32_t ssrc) {
+    VoicePacketHeader bye = {};
+    bye.type = static_cast<uint8_t>(VoicePacketType::BYE);
+    bye.ssrc = htonl(ssrc);
+    send(sock, &bye, sizeof(bye), 0);
+    close(sock);
+}
+
+// One point of the curve. Each step gets fresh channels and sessions
+static bool run_step(const sockaddr_in &relay, const VoiceCodecParams &requested,
+                     const std::vector<std::vector<unsigned char>> &frames, size_t channels, size_t speakers,
+                     size_t listeners, int seconds, StepResult &result) {
+    static uint32_t next_channel = 1;
+    static uint32_t next_user = 1;
+
+    Step step;
+    step.speakers_per_channel = speakers;
+    step.frame_samples = requested.frame_samples;
+
+    bool joined = true;
+    for (size_t c = 0; c < channels && joined; c++) {
+        uint32_t channel = next_channel + (uint32_t)c;
+        for (size_t i = 0; i < speakers && joined; i++) {
+            Speaker &s = step.speakers.emplace_back();
+            s.channel = c;
+            s.sent_ns = std::make_unique<std::atomic<int64_t>[]>(SEQ_SLOTS);
+            joined = open_session(next_user++, channel, requested, relay, s.sock, s.ssrc);
+            step.speaker_by_ssrc[s.ssrc] = step.speakers.size() - 1;
+        }
+        for (size_t i = 0; i < listeners && joined; i++) {
+            Listener &l = step.listeners.emplace_back();
+            l.channel = c;
+            l.streams.resize(speakers);
+            joined = open_session(next_user++, channel, requested, relay, l.sock, l.ssrc);
+        }
+    }
+    next_channel += (uint32_t)channels;
+
+    if (!joined) {
+        std::fprintf(stderr, "A client could not join voice after %zu sessions\n", step.speakers.size() + step.listeners.size());
+    }
+
+    if (joined) {
+        size_t receivers = std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, RECEIVERS);
+        step.start_ns = now_ns() + 50000000;
+        step.window_start_ns = step.start_ns + (int64_t)WARMUP_MS * 1000000;
+        step.window_end_ns = step.window_start_ns + (int64_t)seconds * 1000000000;
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < receivers; i++) {
+            threads.emplace_back(receive_loop, std::ref(step), i, receivers);
+        }
+        std::thread sender(send_loop, std::ref(step), std::cref(frames), std::ref(result));
+
+        sleep_until_ns(step.window_start_ns);
+        int64_t cpu_start = relay_cpu_ns();
+        sleep_until_ns(step.window_end_ns);
+        result.relay_cores = (relay_cpu_ns() - cpu_start) / ((double)seconds * 1e9);
+
+        sender.join();
+        std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS));
+        step.receiving.store(false);
+        for (std::thread &t : threads) {
+            t.join();
+        }
+    }
+
+    size_t forwarded = Config::voice_max_speakers == 0 ? speakers : std::min<size_t>(speakers, Config::voice_max_speakers);
+    for (const Speaker &s : step.speakers) {
+        result.frames_in += s.sent_in_window;
+    }
+    for (const Listener &l : step.listeners) {
+        for (size_t i = 0; i < l.streams.size(); i++) {
+            const Stream &s = l.streams[i];
+            if (s.received == 0) {
+                continue;
+            }
+            result.frames_out += s.received;
+            result.expected += step.speakers[l.channel * speakers + i].sent_in_window;
+            result.jitter_sum_us += s.jitter_us;
+            result.jitter_max_us = std::max(result.jitter_max_us, s.jitter_us);
+            result.streams_heard++;
+        }
+        result.streams_expected += forwarded;
+        result.latency.merge(l.latency);
+        result.worst_p99_us = std::max(result.worst_p99_us, l.latency.percentile(99));
+    }
+
+    // Leaving frees the sessions right away instead of waiting for them to time out
+    for (const Speaker &s : step.speakers) {
+        if (s.sock >= 0) {
+            leave(s.sock, s.ssrc);
+        }
+    }
+    for (const Listener &l : step.listeners) {
+        if (l.sock >= 0) {
+            leave(l.sock, l.ssrc);
+        }
+    }
+
+    return joined;
+}
+
+int main(int argc, char **argv) {
+    size_t speakers = argc > 1 ? (size_t)std::atoi(argv[1]) : 3;
+    size_t max_listeners = argc > 2 ? (size_t)std::atoi(argv[2]) : 1000;
+    size_t channels = argc > 3 ? (size_t)std::atoi(argv[3]) : 1;
+    int seconds = argc > 4 ? std::atoi(argv[4]) : 10;
+    VoiceProfile profile = VoiceProfile::EFFICIENCY;
+    if (argc > 5 && !voice_profile_from_name(argv[5], profile)) {
+        std::fprintf(stderr, "Unknown profile %s, use low_latency or efficiency\n", argv[5]);
+        return 2;
+    }
+    if (argc > 6) {
+        Config::voice_workers = (uint)std::atoi(argv[6]);
+    }
+    if (speakers == 0 || max_listeners == 0 || channels == 0 || seconds <= 0) {
+        std::fprintf(stderr, "voice_load_bench [speakers] [max listeners] [channels] [seconds] [profile] [workers]\n");
+        return 2;
+    }
+
+    Logger::init("", LogLevel::WARNING);
+    register_bench_thread();
+
+    // Every client is a socket
+    rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    VoiceCodecParams codec = voice_profile_params(profile);
+    std::vector<std::vector<unsigned char>> frames;
+    if (!preencode(codec, frames)) {
+        std::fprintf(stderr, "Opus encoding failed\n");
+        return 1;
+    }
+
+    // As AudioServer::run starts it, but on loopback and any free port
+    sockaddr_in relay = {};
+    relay.sin_family = AF_INET;
+    relay.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (!VoiceRelay::start(relay, Config::voice_workers)) {
+        std::fprintf(stderr, "The relay could not bind\n");
+        return 1;
+    }
+
+    std::printf("Relay on 127.0.0.1:%u with %u workers, forwarding the loudest %u speakers (0 for all)\n",
+                ntohs(relay.sin_port), std::max(1u, Config::voice_workers), Config::voice_max_speakers);
+    std::printf("%zu channel(s), %zu speakers each, %u sample frames at %ukbps, %ds per step\n\n", channels, speakers,
+                codec.frame_samples, codec.bitrate / 1000, seconds);
+    std::printf("listeners  users   frames/s in      out   relay cpu   p50ms  p99ms  maxms  worst p99  jitter avg/max ms  "
+                "loss%%  streams\n");
+
+    std::vector<size_t> steps;
+    for (size_t l : listener_steps) {
+        if (l < max_listeners) {
+            steps.push_back(l);
+        }
+    }
+    steps.push_back(max_listeners);
+
+    size_t capacity = 0;
+    bool limit_reached = false;
+    bool generator_limited = false;
+    for (size_t listeners : steps) {
+        StepResult r;
+        bool joined = run_step(relay, codec, frames, channels, speakers, listeners, seconds, r);
+
+        double loss = r.expected ? 100.0 * (1.0 - (double)r.frames_out / r.expected) : 100.0;
+        std::printf("%9zu %6zu %12.0f %8.0f %9.0f%% %7.2f %6.2f %6.2f %10.2f %8.2f / %-7.2f %6.2f %5zu/%zu\n", listeners,
+                    channels * (speakers + listeners), r.frames_in / (double)seconds, r.frames_out / (double)seconds,
+                    r.relay_cores * 100.0, r.latency.percentile(50) / 1000.0, r.latency.percentile(99) / 1000.0,
+                    r.latency.max() / 1000.0, r.worst_p99_us / 1000.0,
+                    r.streams_heard ? r.jitter_sum_us / r.streams_heard / 1000.0 : 0.0, r.jitter_max_us / 1000.0, loss,
+                    r.streams_heard, r.streams_expected);
+        std::fflush(stdout);
+
+        // Numbers from a generator that couldn't keep up are its limit, not the relay's
+        double late = r.sends ? 100.0 * r.late_sends / r.sends : 0.0;
+        if (late > MAX_LATE_PERCENT) {
+            std::printf("The load generator sent %.1f%% of its frames over a frame period late, stopping here\n", late);
+            generator_limited = true;
+            break;
+        }
+        if (!joined || loss > MAX_LOSS_PERCENT || r.latency.percentile(99) > MAX_P99_MS * 1000 ||
+            r.streams_heard < r.streams_expected) {
+            limit_reached = true;
+            break;
+        }
+        capacity = listeners;
+    }
+
+    std::printf("\n");
+    if (generator_limited) {
+        std::printf("Capacity: more than %zu listeners per channel, the load generator is the limit on this machine\n",
+                    capacity);
+    } else if (capacity == 0) {
+        std::printf("Not even one listener per channel stayed under %.1f%% loss and %dms p99\n", MAX_LOSS_PERCENT, MAX_P99_MS);
+    } else {
+        std::printf("Capacity: %zu listeners per channel, %zu users in all, under %.1f%% loss and %dms p99%s\n", capacity,
+                    channels * (speakers + capacity), MAX_LOSS_PERCENT, MAX_P99_MS,
+                    limit_reached ? "" : " (the largest step, the limit is further out)");
+    }
+
+    VoiceRelay::stop();
+    return 0;
+}
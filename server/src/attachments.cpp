@@ -0,0 +1,287 @@
+#include "attachments.h"
+#include "config.h"
+#include "logger.h"
+#include "sha256.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+#define MAX_OPEN_UPLOADS 8    // Per user, announced but not finished
+#define UPLOAD_EXPIRY_S 3600  // Uploads untouched this long are abandoned and their partial file deleted
+#define SWEEP_INTERVAL_S 60
+
+namespace {
+
+struct Upload {
+    uint64_t size; // As announced
+    uint32_t userId;
+    std::chrono::steady_clock::time_point last_active;
+    uint64_t stored = 0; // Bytes already in the partial file
+};
+
+fs::path store_root;
+std::mutex uploads_mutex;
+std::condition_variable settled; // A hash left writing or verifying
+std::unordered_map<std::string, Upload> uploads; // By hash
+std::unordered_set<std::string> writing;         // A chunk is going to disk outside the lock
+std::unordered_set<std::string> verifying;       // Complete, being hashed outside the lock
+std::chrono::steady_clock::time_point last_sweep;
+
+fs::path storedPath(const std::string &hash) {
+    // Fan out on the first byte so no directory grows too large
+    return store_root / hash.substr(0, 2) / hash;
+}
+
+fs::path partialPath(const std::string &hash) {
+    return store_root / "partial" / (hash + ".part");
+}
+
+uint64_t partialSize(const std::string &hash) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(partialPath(hash), ec);
+    return ec ? 0 : size;
+}
+
+bool verifyPartial(const std::string &hash) {
+    int fd = ::open(partialPath(hash).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    Sha256 sha;
+    char chunk[ATTACHMENT_CHUNK_SIZE];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        sha.update(chunk, n);
+    }
+    close(fd);
+
+    return n == 0 && sha.hexDigest() == hash;
+}
+
+// Requires uploads_mutex. Drops uploads nobody touched in a while, and partial
+// files nobody owns any more, e.g. from before a restart
+void sweepStale() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_sweep < std::chrono::seconds(SWEEP_INTERVAL_S)) {
+        return;
+    }
+    last_sweep = now;
+
+    std::error_code ec;
+    for (auto it = uploads.begin(); it != uploads.end();) {
+        if (now - it->second.last_active > std::chrono::seconds(UPLOAD_EXPIRY_S) && !writing.count(it->first)) {
+            LOG_INFO("Attachment upload " + it->first + " abandoned");
+            fs::remove(partialPath(it->first), ec);
+            it = uploads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Non-throwing iteration, this runs on a client's thread
+    for (fs::directory_iterator it(store_root / "partial", ec), end; !ec && it != end; it.increment(ec)) {
+        const fs::directory_entry &entry = *it;
+        std::string hash = entry.path().stem().string();
+        if (uploads.count(hash) || verifying.count(hash)) {
+            continue;
+        }
+
+        std::error_code time_ec;
+        fs::file_time_type modified = entry.last_write_time(time_ec);
+        if (!time_ec && fs::file_time_type::clock::now() - modified > std::chrono::seconds(UPLOAD_EXPIRY_S)) {
+            fs::remove(entry.path(), time_ec);
+        }
+    }
+}
+
+// Requires uploads_mutex held through lock and the partial file complete. Hashing
+// a large file takes a while, so the lock is let go meanwhile
+AttachmentStatus commitPartial(const std::string &hash, std::unique_lock<std::mutex> &lock) {
+    verifying.insert(hash);
+    lock.unlock();
+
+    AttachmentStatus status = AttachmentStatus::COMPLETE;
+    std::error_code ec;
+    if (!verifyPartial(hash)) {
+        LOG_WARNING("Attachment " + hash + " does not match its hash");
+        fs::remove(partialPath(hash), ec);
+        status = AttachmentStatus::CORRUPT;
+    } else {
+        fs::create_directories(storedPath(hash).parent_path(), ec);
+        if (!ec) {
+            fs::rename(partialPath(hash), storedPath(hash), ec);
+        }
+        if (ec) {
+            LOG_ERROR("Failed to store attachment: " + ec.message());
+            status = AttachmentStatus::REJECTED;
+        }
+    }
+
+    lock.lock();
+    verifying.erase(hash);
+    settled.notify_all();
+    return status;
+}
+
+} // namespace
+
+namespace Attachments {
+
+void init(const std::string &root) {
+    store_root = root;
+    try {
+        fs::create_directories(store_root / "partial");
+    } catch (const fs::filesystem_error &e) {
+        LOG_ERROR("Failed to create attachment store: " + std::string(e.what()));
+    }
+}
+
+AttachmentStatus beginUpload(uint32_t userId, const std::string &hash, uint64_t size, uint64_t &offset) {
+    offset = 0;
+    if (!isSha256Hex(hash) || size == 0 || size > Config::attachment_max_size) {
+        return AttachmentStatus::REJECTED;
+    }
+
+    std::unique_lock<std::mutex> lock(uploads_mutex);
+    sweepStale();
+
+    // Let a chunk in flight land first, and whatever another connection is
+    // verifying decides this upload too
+    settled.wait(lock, [&] { return !writing.count(hash) && !verifying.count(hash); });
+
+    std::error_code ec;
+    if (fs::exists(storedPath(hash), ec)) {
+        offset = size;
+        return AttachmentStatus::COMPLETE;
+    }
+
+    auto it = uploads.find(hash);
+    if (it != uploads.end() && it->second.size != size) {
+        return AttachmentStatus::REJECTED;
+    }
+    if (it == uploads.end()) {
+        size_t open = std::count_if(uploads.begin(), uploads.end(), [&](const auto &u) { return u.second.userId == userId; });
+        if (open >= MAX_OPEN_UPLOADS) {
+            LOG_WARNING("User " + std::to_string(userId) + " has too many attachment uploads open");
+            return AttachmentStatus::REJECTED;
+        }
+        uploads[hash] = {size, userId, std::chrono::steady_clock::now()};
+    } else {
+        // Someone else announcing the same content joins the upload; it stays counted against whoever started it
+        it->second.last_active = std::chrono::steady_clock::now();
+    }
+
+    // Left over from an upload announced with another size, before a restart
+    uint64_t stored = partialSize(hash);
+    if (stored > size) {
+        fs::remove(partialPath(hash), ec);
+        stored = 0;
+    }
+
+    // Every byte arrived but it was never verified, the server went down in between
+    if (stored == size) {
+        uploads.erase(hash);
+        AttachmentStatus status = commitPartial(hash, lock);
+        offset = status == AttachmentStatus::COMPLETE ? size : 0;
+        return status;
+    }
+
+    // Resume wherever a previous connection left off
+    uploads[hash].stored = stored;
+    offset = stored;
+    return AttachmentStatus::ACCEPTED;
+}
+
+AttachmentStatus writeChunk(const std::string &hash, uint64_t offset, const char *data, size_t len, uint64_t &newOffset) {
+    std::unique_lock<std::mutex> lock(uploads_mutex);
+
+    newOffset = 0;
+    auto it = uploads.find(hash);
+    if (it == uploads.end()) {
+        return AttachmentStatus::REJECTED;
+    }
+    uint64_t size = it->second.size;
+    it->second.last_active = std::chrono::steady_clock::now();
+
+    // Only accept the next expected chunk, and one at a time per upload. The
+    // sender resends from newOffset
+    newOffset = it->second.stored;
+    if (writing.count(hash) || offset != newOffset || len == 0 || offset + len > size) {
+        return AttachmentStatus::REJECTED;
+    }
+
+    // The disk write happens without the lock so other uploads carry on meanwhile
+    writing.insert(hash);
+    lock.unlock();
+
+    size_t written = 0;
+    int fd = ::open(partialPath(hash).c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd >= 0) {
+        while (written < len) {
+            ssize_t n = pwrite(fd, data + written, len - written, offset + written);
+            if (n <= 0) {
+                break;
+            }
+            written += n;
+        }
+        close(fd);
+    }
+
+    lock.lock();
+    writing.erase(hash);
+    settled.notify_all();
+
+    // Marked as writing, so nothing else could have dropped it
+    it = uploads.find(hash);
+    it->second.stored = offset + written;
+    newOffset = it->second.stored;
+    if (written != len) {
+        LOG_ERROR("Failed to write attachment chunk " + hash);
+        return AttachmentStatus::REJECTED;
+    }
+
+    if (newOffset < size) {
+        return AttachmentStatus::ACCEPTED;
+    }
+
+    uploads.erase(it);
+    AttachmentStatus status = commitPartial(hash, lock);
+    if (status == AttachmentStatus::CORRUPT) {
+        newOffset = 0;
+    }
+    return status;
+}
+
+int open(const std::string &hash, uint64_t &size) {
+    size = 0;
+    if (!isSha256Hex(hash)) {
+        return -1;
+    }
+
+    int fd = ::open(storedPath(hash).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    size = static_cast<uint64_t>(st.st_size);
+    return fd;
+}
+
+} // namespace Attachments
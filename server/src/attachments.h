@@ -0,0 +1,26 @@
+#pragma once
+#include "packets.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Content-addressed attachment storage. Files are stored under their SHA-256
+// and written chunk by chunk, so an upload never has to fit in memory and can
+// be resumed from the last acknowledged offset.
+//
+// This is only the server side store. No client uploads or fetches attachments yet
+// and MessageInfo has no field referencing one, tying them into chat comes later.
+namespace Attachments {
+void init(const std::string &root);
+
+// Returns how many bytes of the upload are already stored (size if it is a duplicate).
+// Each user can only have a few uploads open, abandoned ones expire. Announcing a hash that is
+// already being uploaded resumes it, but it stays counted against the user who started it
+AttachmentStatus beginUpload(uint32_t userId, const std::string &hash, uint64_t size, uint64_t &offset);
+
+// Appends a chunk at offset. Once the last byte arrives the content is verified and moved into the store
+AttachmentStatus writeChunk(const std::string &hash, uint64_t offset, const char *data, size_t len, uint64_t &newOffset);
+
+// Returns a read-only descriptor for a stored attachment or -1 if missing
+int open(const std::string &hash, uint64_t &size);
+}; // namespace Attachments
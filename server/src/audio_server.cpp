@@ -1,10 +1,12 @@
 #include "audio_server.h"
 #include "config.h"
 #include "logger.h"
-#include "packets.h"
+#include "voice_relay.h"
+#include "voice_sessions.h"
 #include <arpa/inet.h>
 #include <atomic>
 #include <cstdint>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
@@ -12,73 +14,30 @@
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <thread>
 #include <unistd.h>
-#include <unordered_map>
-#include <vector>
-
-// Configuration
-#define CHUNK_SIZE 120 // 2.5ms at 48kHz
 
 std::atomic<bool> AudioServer::running{true};
 
-static std::unordered_map<uint32_t, std::vector<int>> clients_per_channel;
-static std::mutex clients_mutex;
+VoiceSessionInfo AudioServer::createSession(uint32_t userId, uint32_t channel, const VoiceCodecParams &requested) {
+    VoiceSessionInfo session = VoiceSessions::create(userId, channel);
 
-ssize_t findClientIndex(uint32_t channel, int socket) {
-    ssize_t index = 0;
-    for (const int c : clients_per_channel[channel]) {
-        if (c == socket) {
-            return index;
-        }
-        index++;
+    // A channel profile wins over what the client asked for
+    auto it = Config::voice_channel_profiles.find(channel);
+    if (it != Config::voice_channel_profiles.end()) {
+        session.codec = voice_profile_params(it->second);
+    } else {
+        session.codec = voice_codec_sanitize(requested);
     }
 
-    return -1;
-}
-
-// Network receiving thread
-void network_thread(int client_socket) {
-
-    uint32_t channel;
-    recv_uint(client_socket, channel);
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        clients_per_channel[channel].push_back(client_socket);
-    }
-
-    std::vector<float> chunk(CHUNK_SIZE);
-
-    LOG_INFO("Client connected, receiving audio...");
-
-    while (AudioServer::running.load()) {
-        bool got = recv_all(client_socket, chunk.data(), CHUNK_SIZE * sizeof(float));
-        if (!got) {
-            LOG_INFO("Client disconnected from voice");
-            break;
-        }
-
-        for (const int client : clients_per_channel[channel]) {
-            /*
-            if (client == client_socket) {
-                continue;
-            }
-            */
-
-            send_all(client, chunk.data(), CHUNK_SIZE * sizeof(float));
-        }
-    }
-
-    close(client_socket);
-
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        ssize_t index = findClientIndex(channel, client_socket);
-        clients_per_channel[channel].erase(clients_per_channel[channel].begin() + index);
-    }
+    return session;
 }
 
 void AudioServer::run() {
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(Config::port_voice);
+
     // Set up TCP server
     int server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
@@ -89,11 +48,6 @@ void AudioServer::run() {
     int opt = 1;
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
-    struct sockaddr_in server_addr = {};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(Config::port_voice);
-
     if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
         return;
@@ -104,7 +58,17 @@ void AudioServer::run() {
         return;
     }
 
-    LOG_INFO("Audio server listening on port " + std::to_string(Config::port_voice));
+    // The relay binds its UDP sockets, same port number as TCP
+    sockaddr_in udp_addr = server_addr;
+    if (!VoiceRelay::start(udp_addr, Config::voice_workers)) {
+        close(server_socket);
+        return;
+    }
+    if (!Config::voice_mix_channels.empty()) {
+        LOG_INFO(std::to_string(Config::voice_mix_channels.size()) + " voice channel(s) mixed on the server");
+    }
+
+    LOG_INFO("Audio server listening on port " + std::to_string(Config::port_voice) + " (UDP and TCP)");
     LOG_INFO("Waiting for client connections...");
 
     while (running.load()) {
@@ -119,18 +83,18 @@ void AudioServer::run() {
 
         LOG_INFO("Client connected from " + std::string(inet_ntoa(client_addr.sin_addr)));
 
-        // Configure client socket for low latency
+        // Configure client socket for low latency, the relay never blocks on it
         int flag = 1;
         setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL, 0) | O_NONBLOCK);
 
-        // Handle client in separate thread
-        std::thread client_thread(network_thread, client_socket);
-        client_thread.detach();
+        VoiceRelay::addConnection(client_socket);
     }
 
     // Cleanup
     running = false;
 
+    VoiceRelay::stop();
     close(server_socket);
 
     return;
@@ -1,7 +1,10 @@
-
+#pragma once
+#include "common_data.h"
 #include <atomic>
+#include <cstdint>
 
 namespace AudioServer {
 extern std::atomic<bool> running;
 void run();
+VoiceSessionInfo createSession(uint32_t userId, uint32_t channel, const VoiceCodecParams &requested);
 } // namespace AudioServer
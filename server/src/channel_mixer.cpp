@@ -0,0 +1,326 @@
+#include "channel_mixer.h"
+#include "logger.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#define SAMPLE_RATE 48000
+#define MAX_PACKET_SAMPLES 5760 // 120ms, the longest Opus packet
+
+// Mixed streams are encoded for many listeners at once, keep them cheap
+#define MIX_BITRATE 32000
+#define MIX_COMPLEXITY 5
+
+#define PREBUFFER (2 * MIX_TICK_SAMPLES) // A speaker joins the mix once this much is decoded
+#define MAX_BACKLOG 4800                 // 100ms, beyond this the oldest audio is dropped
+#define MAX_CONCEAL 5                    // Missing frames filled in before giving up on a gap
+#define MINUS_HOLD_TICKS 20              // 200ms, keeps a speaker on their mix-minus through short pauses
+
+ChannelMixer::~ChannelMixer() {
+    for (auto &[ssrc, s] : speakers) {
+        destroySpeaker(s);
+    }
+    if (shared.encoder) {
+        opus_encoder_destroy(shared.encoder);
+    }
+}
+
+bool ChannelMixer::createStream(Stream &s) {
+    int err;
+    s.encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &err);
+    if (err != OPUS_OK) {
+        LOG_ERROR("opus_encoder_create failed: " + std::string(opus_strerror(err)));
+        s.encoder = nullptr;
+        return false;
+    }
+
+    opus_encoder_ctl(s.encoder, OPUS_SET_BITRATE(MIX_BITRATE));
+    opus_encoder_ctl(s.encoder, OPUS_SET_COMPLEXITY(MIX_COMPLEXITY));
+    return true;
+}
+
+bool ChannelMixer::init() {
+    total.assign(MIX_TICK_SAMPLES, 0.0f);
+    scratch.assign(MIX_TICK_SAMPLES, 0.0f);
+    return createStream(shared);
+}
+
+void ChannelMixer::destroySpeaker(Speaker &s) {
+    if (s.decoder) {
+        opus_decoder_destroy(s.decoder);
+        s.decoder = nullptr;
+    }
+    if (s.minus.encoder) {
+        opus_encoder_destroy(s.minus.encoder);
+        s.minus.encoder = nullptr;
+    }
+}
+
+// Appends a decoded packet, or a concealed one when payload is null
+void ChannelMixer::decode(Speaker &s, const unsigned char *payload, int len, bool fec) {
+    // Arriving faster than it plays, drop the oldest audio to keep the delay bounded
+    if (s.pcm_len > MAX_BACKLOG) {
+        int drop = s.pcm_len - PREBUFFER;
+        std::memmove(s.pcm.data(), s.pcm.data() + drop, PREBUFFER * sizeof(float));
+        s.pcm_len = PREBUFFER;
+    }
+
+    int frame = s.last_samples ? s.last_samples : MIX_TICK_SAMPLES;
+    int max = payload && !fec ? MAX_PACKET_SAMPLES : frame;
+    int n = opus_decode_float(s.decoder, payload, payload ? len : 0, s.pcm.data() + s.pcm_len, max, fec ? 1 : 0);
+    if (n < 0) {
+        LOG_ERROR("Opus decode failed: " + std::string(opus_strerror(n)));
+        return;
+    }
+
+    s.pcm_len += n;
+    s.last_samples = n;
+}
+
+void ChannelMixer::push(uint32_t ssrc, const VoicePacketHeader &header, const unsigned char *payload, int len) {
+    auto it = speakers.find(ssrc);
+    if (it == speakers.end()) {
+        Speaker s;
+        int err;
+        s.decoder = opus_decoder_create(SAMPLE_RATE, 1, &err);
+        if (err != OPUS_OK) {
+            LOG_ERROR("opus_decoder_create failed: " + std::string(opus_strerror(err)));
+            return;
+        }
+        if (!createStream(s.minus)) {
+            opus_decoder_destroy(s.decoder);
+            return;
+        }
+
+        s.pcm.assign(MAX_BACKLOG + MAX_PACKET_SAMPLES, 0.0f);
+        s.frame.assign(MIX_TICK_SAMPLES, 0.0f);
+        it = speakers.emplace(ssrc, std::move(s)).first;
+    }
+
+    Speaker &s = it->second;
+    uint16_t seq = ntohs(header.seq);
+    auto now = std::chrono::steady_clock::now();
+
+    // Interarrival jitter as in RFC 3550, for the reports
+    uint32_t arrival = (uint32_t)(std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count() * SAMPLE_RATE / 1000000);
+    uint32_t transit = arrival - ntohl(header.timestamp);
+    if (s.has_transit) {
+        s.jitter += (std::abs((float)(int32_t)(transit - s.last_transit)) - s.jitter) / 16.0f;
+    }
+    s.last_transit = transit;
+    s.has_transit = true;
+
+    if (!s.has_highest || static_cast<int16_t>(seq - s.highest_seq) > 0) {
+        s.highest_seq = seq;
+        s.highest_arrival = now;
+        s.has_highest = true;
+    }
+    s.fresh = true;
+
+    // Gone quiet, whatever is buffered plays out and the next talkspurt starts clean
+    if (header.flags & VOICE_FLAG_SILENCE) {
+        s.has_seq = false;
+        return;
+    }
+
+    if (s.has_seq && !(header.flags & VOICE_FLAG_TALKSPURT)) {
+        int16_t gap = static_cast<int16_t>(seq - s.next_seq);
+
+        // Its place was already concealed
+        if (gap < 0) {
+            return;
+        }
+
+        // The packet right before this one can come back from its in-band FEC
+        int missing = std::min<int>(gap, MAX_CONCEAL);
+        for (int i = 0; i < missing; i++) {
+            bool last = i == missing - 1;
+            decode(s, last ? payload : nullptr, len, last);
+        }
+        s.lost += gap;
+    }
+
+    decode(s, payload, len, false);
+    s.played++;
+    s.next_seq = seq + 1;
+    s.has_seq = true;
+}
+
+void ChannelMixer::removeSpeaker(uint32_t ssrc) {
+    auto it = speakers.find(ssrc);
+    if (it == speakers.end()) {
+        return;
+    }
+
+    // They were on their own stream, the channel mix has to restart for them
+    if (it->second.hold > 0) {
+        returning.push_back(ssrc);
+    }
+
+    destroySpeaker(it->second);
+    speakers.erase(it);
+}
+
+bool ChannelMixer::empty() const {
+    return speakers.empty();
+}
+
+int ChannelMixer::encodes() const {
+    return tick_encodes;
+}
+
+// Encodes one stream's frame, or ends its talkspurt when pcm is null
+void ChannelMixer::encode(uint32_t ssrc, Stream &stream, const float *pcm) {
+    MixOutput &out = outputs.emplace_back();
+    out.ssrc = ssrc;
+    out.len = 0;
+
+    if (!pcm) {
+        stream.talking = false;
+        return;
+    }
+
+    // Hard clip and measure the level in one pass
+    const float *__restrict src = pcm;
+    float *__restrict dst = scratch.data();
+    float energy = 0.0f;
+    for (int i = 0; i < MIX_TICK_SAMPLES; i++) {
+        float v = std::min(1.0f, std::max(-1.0f, src[i]));
+        dst[i] = v;
+        energy += v * v;
+    }
+
+    unsigned char *payload = reinterpret_cast<unsigned char *>(out.data + sizeof(VoicePacketHeader));
+    int n = opus_encode_float(stream.encoder, scratch.data(), MIX_TICK_SAMPLES, payload, VOICE_MAX_PAYLOAD);
+    tick_encodes++;
+    if (n < 0) {
+        LOG_ERROR("Opus encode failed: " + std::string(opus_strerror(n)));
+        return;
+    }
+
+    float db = energy > 0.0f ? 10.0f * std::log10(energy / MIX_TICK_SAMPLES) : -(float)VOICE_LEVEL_SILENT;
+
+    VoicePacketHeader header = {};
+    header.type = static_cast<uint8_t>(VoicePacketType::AUDIO);
+    header.flags = stream.talking ? 0 : VOICE_FLAG_TALKSPURT;
+    header.seq = htons(static_cast<uint16_t>(ticks));
+    header.timestamp = htonl(ticks * MIX_TICK_SAMPLES);
+    header.ssrc = htonl(ssrc);
+    header.speaker = 0; // A mix has no single speaker
+    header.level = (uint8_t)std::clamp(-db, 0.0f, (float)VOICE_LEVEL_SILENT);
+    std::memcpy(out.data, &header, sizeof(header));
+
+    out.len = sizeof(header) + n;
+    stream.talking = true;
+}
+
+const std::vector<MixOutput> &ChannelMixer::tick() {
+    outputs.clear();
+    tick_encodes = 0;
+    ticks++;
+
+    std::fill(total.begin(), total.end(), 0.0f);
+    int heard = 0;
+
+    for (auto &[ssrc, s] : speakers) {
+        s.heard = false;
+        std::fill(s.frame.begin(), s.frame.end(), 0.0f);
+
+        if (!s.primed && s.pcm_len >= PREBUFFER) {
+            s.primed = true;
+        }
+
+        if (s.primed) {
+            int n = std::min(s.pcm_len, MIX_TICK_SAMPLES);
+            std::memcpy(s.frame.data(), s.pcm.data(), n * sizeof(float));
+            s.pcm_len -= n;
+            std::memmove(s.pcm.data(), s.pcm.data() + n, s.pcm_len * sizeof(float));
+
+            // Ran dry, buffer up again
+            if (s.pcm_len == 0) {
+                s.primed = false;
+            }
+
+            float *__restrict dst = total.data();
+            const float *__restrict src = s.frame.data();
+            for (int i = 0; i < MIX_TICK_SAMPLES; i++) {
+                dst[i] += src[i];
+            }
+
+            s.heard = true;
+            s.hold = MINUS_HOLD_TICKS;
+            heard++;
+        } else if (s.hold > 0 && --s.hold == 0) {
+            // Quiet long enough, back to the channel mix
+            s.minus.talking = false;
+            returning.push_back(ssrc);
+        }
+    }
+
+    outputs.reserve(1 + speakers.size() + returning.size());
+
+    // One encode for everyone who isn't talking
+    encode(0, shared, heard > 0 ? total.data() : nullptr);
+
+    // Speakers who just finished pick the channel mix back up as a new talkspurt.
+    // If the channel mix is quiet it restarts with one anyway
+    if (outputs[0].len > 0) {
+        for (uint32_t ssrc : returning) {
+            MixOutput &out = outputs.emplace_back();
+            out.ssrc = ssrc;
+            out.len = outputs[0].len;
+            std::memcpy(out.data, outputs[0].data, out.len);
+            reinterpret_cast<VoicePacketHeader *>(out.data)->flags |= VOICE_FLAG_TALKSPURT;
+        }
+    }
+    returning.clear();
+
+    // Whoever is talking, or just paused, gets the mix without themselves
+    for (auto &[ssrc, s] : speakers) {
+        if (s.hold == 0) {
+            continue;
+        }
+
+        int others = heard - (s.heard ? 1 : 0);
+        if (others == 0) {
+            encode(ssrc, s.minus, nullptr); // Only themselves to hear
+            continue;
+        }
+
+        const float *__restrict all = total.data();
+        float *__restrict minus = s.frame.data();
+        for (int i = 0; i < MIX_TICK_SAMPLES; i++) {
+            minus[i] = all[i] - minus[i];
+        }
+        encode(ssrc, s.minus, minus);
+    }
+
+    return outputs;
+}
+
+void ChannelMixer::reports(std::vector<VoiceReportBlock> &blocks) {
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto &[ssrc, s] : speakers) {
+        if (!s.fresh || blocks.size() >= VOICE_MAX_REPORT_BLOCKS) {
+            continue;
+        }
+
+        uint64_t lost = s.lost - s.reported_lost;
+        uint64_t due = lost + s.played - s.reported_played;
+
+        VoiceReportBlock block;
+        block.ssrc = htonl(ssrc);
+        block.loss = due ? (uint8_t)std::min<uint64_t>(255, lost * 256 / due) : 0;
+        block.jitter = htons((uint16_t)std::min(s.jitter, 65535.0f));
+        block.last_seq = htons(s.highest_seq);
+        block.delay = htonl((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - s.highest_arrival).count());
+        blocks.push_back(block);
+
+        s.reported_lost = s.lost;
+        s.reported_played = s.played;
+        s.fresh = false;
+    }
+}
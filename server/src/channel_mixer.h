@@ -0,0 +1,83 @@
+#pragma once
+#include "voice_packets.h"
+#include <chrono>
+#include <cstdint>
+#include <opus.h>
+#include <unordered_map>
+#include <vector>
+
+#define MIX_TICK_SAMPLES 480 // 10ms at 48kHz, one mixed frame per tick
+
+// A frame the mixer produced. ssrc 0 is the channel mix, for every listener
+// without an entry of their own. len 0 means that listener gets nothing this tick.
+struct MixOutput {
+    uint32_t ssrc;
+    uint16_t len;
+    char data[VOICE_MAX_FRAME];
+};
+
+// Server side mixing for channels with too many listeners to forward every
+// speaker to. Speakers picked by the relay are decoded as they arrive and summed
+// once per tick. The sum is encoded once for everyone, and whoever is talking
+// gets a mix-minus without their own voice, so listeners decode one stream.
+// Owned by the relay worker of its channel, not thread safe.
+class ChannelMixer {
+  public:
+    ~ChannelMixer();
+    bool init();
+    void push(uint32_t ssrc, const VoicePacketHeader &header, const unsigned char *payload, int len);
+    void removeSpeaker(uint32_t ssrc);
+    bool empty() const; // No speakers left
+
+    const std::vector<MixOutput> &tick(); // Valid until the next tick
+    int encodes() const;                  // Opus encodes the last tick took
+
+    // What the mixer heard from each speaker since the last call, the mixer is their only listener
+    void reports(std::vector<VoiceReportBlock> &blocks);
+
+  private:
+    struct Stream {
+        OpusEncoder *encoder = nullptr;
+        bool talking = false; // Next frame doesn't need the talkspurt flag
+    };
+
+    struct Speaker {
+        OpusDecoder *decoder = nullptr;
+        Stream minus;          // Everyone but this speaker
+        std::vector<float> pcm; // Decoded, not yet mixed
+        int pcm_len = 0;
+        bool primed = false;   // Buffered enough to start mixing
+        bool has_seq = false;
+        uint16_t next_seq = 0;
+        int last_samples = 0;  // For concealment
+        bool heard = false;    // Part of the current tick
+        int hold = 0;          // Ticks left on the mix-minus, refilled whenever they are heard
+        std::vector<float> frame; // Their part of the current tick
+
+        // For reports
+        uint64_t played = 0, lost = 0;
+        uint64_t reported_played = 0, reported_lost = 0;
+        bool has_highest = false;
+        uint16_t highest_seq = 0;
+        std::chrono::steady_clock::time_point highest_arrival;
+        bool has_transit = false;
+        uint32_t last_transit = 0;
+        float jitter = 0.0f;
+        bool fresh = false; // Something arrived since the last report
+    };
+
+    std::unordered_map<uint32_t, Speaker> speakers; // By ssrc
+    Stream shared;
+    uint32_t ticks = 0; // Sequence number and timestamp of every stream follow this
+    int tick_encodes = 0;
+
+    std::vector<float> total;
+    std::vector<float> scratch;
+    std::vector<MixOutput> outputs;
+    std::vector<uint32_t> returning; // Had their own stream, need a talkspurt on the channel mix
+
+    bool createStream(Stream &s);
+    void destroySpeaker(Speaker &s);
+    void decode(Speaker &s, const unsigned char *payload, int len, bool fec);
+    void encode(uint32_t ssrc, Stream &s, const float *pcm);
+};
@@ -1,5 +1,7 @@
 #include "config.h"
 #include "logger.h"
+#include <algorithm>
+#include <thread>
 #include <yaml-cpp/yaml.h>
 
 namespace Config {
@@ -10,6 +12,11 @@ std::string db_addr = "127.0.0.1";
 std::string db_database = "perrydb";
 std::string db_user = "perryuser";
 std::string db_password = "perrypass";
+uint64_t attachment_max_size = 100 * 1024 * 1024;
+uint voice_workers = std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+uint voice_max_speakers = 4;
+std::unordered_map<uint32_t, VoiceProfile> voice_channel_profiles;
+std::unordered_set<uint32_t> voice_mix_channels;
 
 void init(const std::string &configPath) {
     readConfig(configPath);
@@ -26,6 +33,33 @@ void readConfig(const std::string &configPath) {
         db_database = configFile["db_database"].as<std::string>();
         db_user = configFile["db_user"].as<std::string>();
         db_password = configFile["db_password"].as<std::string>();
+
+        // Optional settings
+        if (configFile["attachment_max_size"]) {
+            attachment_max_size = configFile["attachment_max_size"].as<uint64_t>();
+        }
+        if (configFile["voice_workers"]) {
+            voice_workers = configFile["voice_workers"].as<uint>();
+        }
+        if (configFile["voice_max_speakers"]) {
+            voice_max_speakers = configFile["voice_max_speakers"].as<uint>();
+        }
+        if (configFile["voice_channel_profiles"]) {
+            for (const auto &entry : configFile["voice_channel_profiles"]) {
+                VoiceProfile profile;
+                std::string name = entry.second.as<std::string>();
+                if (voice_profile_from_name(name, profile)) {
+                    voice_channel_profiles[entry.first.as<uint32_t>()] = profile;
+                } else {
+                    LOG_WARNING("Unknown voice profile " + name);
+                }
+            }
+        }
+        if (configFile["voice_mix_channels"]) {
+            for (const auto &channel : configFile["voice_mix_channels"]) {
+                voice_mix_channels.insert(channel.as<uint32_t>());
+            }
+        }
     } catch (YAML::BadFile) {
         LOG_ERROR("Could not load config file");
     } catch (...) {
@@ -1,5 +1,9 @@
 #pragma once
+#include "voice_packets.h"
+#include <cstdint>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace Config {
 extern uint port_text;
@@ -9,6 +13,11 @@ extern std::string db_addr;
 extern std::string db_database;
 extern std::string db_user;
 extern std::string db_password;
+extern uint64_t attachment_max_size;
+extern uint voice_workers;
+extern uint voice_max_speakers;
+extern std::unordered_map<uint32_t, VoiceProfile> voice_channel_profiles; // Override what clients ask for
+extern std::unordered_set<uint32_t> voice_mix_channels;                   // Mixed on the server instead of forwarded
 
 void init(const std::string &configPath);
 void readConfig(const std::string &configPath);
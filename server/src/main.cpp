@@ -1,4 +1,5 @@
 #include "DbManager.h"
+#include "attachments.h"
 #include "audio_server.h"
 #include "common_data.h"
 #include "config.h"
@@ -6,6 +7,7 @@
 #include "packets.h"
 #include "utils.h"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <bcrypt.h>
 #include <cstddef>
 #include <cstdint>
@@ -67,6 +69,13 @@ bool authenticate(const int sock, uint32_t &userId) {
     return result;
 }
 
+void send_attachment_ack(int sock, const std::string &hash, uint64_t offset, AttachmentStatus status) {
+    send_packet(sock, PacketType::ATTACHMENT_ACK, NULL, 0);
+    send_string(sock, hash);
+    send_packet(sock, PacketType::UINT64, offset);
+    send_packet(sock, PacketType::CODE, static_cast<uint8_t>(status));
+}
+
 void broadcast(const MessageInfo &msg) {
     std::lock_guard<std::mutex> lock(clients_mutex);
     for (Client_t client : clients) {
@@ -90,7 +99,8 @@ void handle_client(int sock) {
     LOG_INFO("Waiting for messages");
     std::vector<char> buffer;
     PacketType pType;
-    while (true) {
+    bool connected = true;
+    while (connected) {
         buffer.clear();
         if (!recv_packet(sock, pType, buffer)) {
             LOG_INFO("Client Disconnected");
@@ -211,6 +221,102 @@ void handle_client(int sock) {
 
             break;
         }
+        case PacketType::VOICE_SESSION: {
+            uint32_t channelId;
+            VoiceCodecParams requested;
+            recv_uint(sock, channelId);
+            recv_uint(sock, requested.frame_samples);
+            recv_uint(sock, requested.bitrate);
+            recv_uint(sock, requested.complexity);
+
+            VoiceSessionInfo vs = AudioServer::createSession(userId, channelId, requested);
+
+            send_packet(sock, PacketType::VOICE_SESSION, NULL, 0);
+            send_packet(sock, PacketType::UINT, vs.channel);
+            send_packet(sock, PacketType::UINT, vs.ssrc);
+            send_packet(sock, PacketType::UINT64, vs.key);
+            send_packet(sock, PacketType::UINT, vs.codec.frame_samples);
+            send_packet(sock, PacketType::UINT, vs.codec.bitrate);
+            send_packet(sock, PacketType::UINT, vs.codec.complexity);
+            break;
+        }
+        case PacketType::ATTACHMENT_UPLOAD: {
+            std::string hash;
+            uint64_t size = 0;
+            recv_string(sock, hash);
+            recv_uint64(sock, size);
+
+            uint64_t offset;
+            AttachmentStatus status = Attachments::beginUpload(userId, hash, size, offset);
+            send_attachment_ack(sock, hash, offset, status);
+            break;
+        }
+        case PacketType::ATTACHMENT_CHUNK: {
+            std::string hash;
+            uint64_t offset = 0;
+            recv_string(sock, hash);
+            recv_uint64(sock, offset);
+
+            // Never let the client decide how much we allocate
+            std::vector<char> chunk;
+            PacketType p;
+            // An oversize chunk is left unread, the stream can't be trusted after it
+            if (!recv_packet(sock, p, chunk, ATTACHMENT_CHUNK_SIZE) || p != PacketType::BUFFER) {
+                LOG_ERROR("Invalid attachment chunk, closing the connection");
+                connected = false;
+                break;
+            }
+
+            uint64_t newOffset;
+            AttachmentStatus status = Attachments::writeChunk(hash, offset, chunk.data(), chunk.size(), newOffset);
+            send_attachment_ack(sock, hash, newOffset, status);
+            break;
+        }
+        case PacketType::ATTACHMENT_GET: {
+            std::string hash;
+            uint64_t offset = 0;
+            uint64_t length = 0; // 0 means until the end
+            recv_string(sock, hash);
+            recv_uint64(sock, offset);
+            recv_uint64(sock, length);
+
+            uint64_t size;
+            int fd = Attachments::open(hash, size);
+
+            // The status comes first, a missing attachment gets no size, range or data
+            send_packet(sock, PacketType::ATTACHMENT_GET, NULL, 0);
+            send_string(sock, hash);
+            if (fd < 0) {
+                send_packet(sock, PacketType::CODE, static_cast<uint8_t>(AttachmentStatus::NOT_FOUND));
+                break;
+            }
+            send_packet(sock, PacketType::CODE, static_cast<uint8_t>(AttachmentStatus::COMPLETE));
+
+            offset = std::min(offset, size);
+            if (length == 0 || length > size - offset) {
+                length = size - offset;
+            }
+
+            send_packet(sock, PacketType::UINT64, size);
+            send_packet(sock, PacketType::UINT64, offset);
+            send_packet(sock, PacketType::UINT64, length);
+
+            // Range is streamed straight from disk in chunk sized packets. The client
+            // was promised length bytes, if they can't all be sent the connection is done
+            while (length > 0) {
+                uint32_t n = static_cast<uint32_t>(std::min<uint64_t>(length, ATTACHMENT_CHUNK_SIZE));
+                if (!send_file_packet(sock, PacketType::BUFFER, fd, offset, n)) {
+                    LOG_ERROR("Failed to send attachment " + hash + ", closing the connection");
+                    connected = false;
+                    break;
+                }
+                offset += n;
+                length -= n;
+            }
+
+            close(fd);
+            break;
+        }
         default: {
             LOG_WARNING("Unrecognized packet type");
             break;
@@ -231,6 +337,7 @@ int main() {
     Config::init("./configFile.yml");
     DbManager::init();
     img_store_path = Config::storage_path + "images/";
+    Attachments::init(Config::storage_path + "attachments/");
 
     int server_main_socket;
     int client_new_socket;
@@ -0,0 +1,1025 @@
+#include "voice_relay.h"
+#include "channel_mixer.h"
+#include "config.h"
+#include "logger.h"
+#include "voice_packets.h"
+#include "voice_sessions.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_EVENTS 64
+#define UDP_BATCH 32                  // Datagrams per wakeup, so TCP clients of the same worker don't starve
+#define MAX_PENDING_BYTES (32 * 1024) // Per TCP listener, beyond this its frames are dropped
+#define SPEAKER_TIMEOUT_S 10          // Forget per-speaker state after this long without frames
+#define REPLAY_WINDOW 64              // Frames, older ones or repeats inside it are dropped
+
+// Active speaker selection
+#define LOUDNESS_WINDOW 9600 // Samples (200ms) the level is smoothed over
+#define HYSTERESIS_DB 6.0f   // How much louder a speaker must be to take a forwarded slot
+#define STALE_SPEAKER_MS 1000 // Active speakers quiet for this long (not even keepalives) give up their slot
+
+// Server side mixing
+#define MAX_MIX_CATCHUP 4 // Ticks run at once after the worker fell behind, the rest are skipped
+#define LOAD_LOG_S 10     // How often per-channel load is logged
+
+namespace {
+
+struct Connection {
+    int fd;
+    uint32_t ssrc = 0; // 0 until the HELLO arrives
+    uint32_t channel = 0;
+    char in[sizeof(uint16_t) + VOICE_MAX_FRAME];
+    size_t in_len = 0;
+    std::vector<char> out; // Pending output, only whole frames are ever queued
+    size_t out_pos = 0;
+};
+
+struct QueuedFrame {
+    uint32_t channel;
+    uint16_t len;
+    char data[VOICE_MAX_FRAME];
+};
+
+// Per-speaker state, only touched by the worker that owns the speaker's channel
+struct SpeakerState {
+    uint32_t userId;
+    uint16_t highest_seq;
+    uint64_t seen; // Bit i set: highest_seq - i already forwarded
+    bool silent;   // Last forwarded frame was a silence keepalive
+    std::chrono::steady_clock::time_point last_seen;
+    uint32_t channel;
+    uint32_t last_timestamp = 0;
+    float loudness = -1.0f;  // Smoothed dB above silence, negative until the first frame
+    bool forwarding = false; // Listeners are receiving this speaker
+};
+
+// Work a channel cost its worker, to tell which channels are worth mixing on the server
+struct ChannelLoad {
+    bool mixed = false;
+    uint64_t busy_ns = 0;
+    uint64_t frames_in = 0;
+    uint64_t frames_out = 0;
+    uint64_t ticks = 0;
+    uint64_t encodes = 0;
+};
+
+enum class FrameResult {
+    CONTINUE,
+    CLOSE,
+    MIGRATE, // Authenticated, but its channel lives on another worker
+};
+
+class RelayWorker {
+  public:
+    RelayWorker(int udp_socket, bool udp_reader, bool sweeper);
+    ~RelayWorker();
+
+    void start();
+    void join();
+    void wake();
+
+    // Both can be called from any thread
+    void adopt(std::unique_ptr<Connection> c);
+    void pushFrame(uint32_t channel, const char *frame, uint16_t len);
+
+  private:
+    int epoll_fd;
+    int event_fd;
+    int timer_fd; // Mixing tick, only armed while this worker mixes a channel
+    int udp_socket; // Its own SO_REUSEPORT socket, or the first worker's when it has none
+    bool udp_reader;
+    bool sweeper; // Expires quiet sessions, only one worker needs to
+    std::thread thread;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::unordered_map<uint32_t, SpeakerState> speakers;                // By ssrc
+    std::unordered_map<uint32_t, std::vector<uint32_t>> active_speakers; // By channel, ssrcs being forwarded
+    std::unordered_map<uint32_t, std::unique_ptr<ChannelMixer>> mixers;  // By channel, those mixed here
+    std::unordered_map<uint32_t, ChannelLoad> channel_load;              // Since the last load log
+    std::vector<VoiceReportBlock> mix_reports;
+
+    std::mutex inbox_mutex;
+    std::atomic<bool> wake_pending{false};
+    std::vector<std::unique_ptr<Connection>> inbox_connections;
+    std::vector<QueuedFrame> inbox_frames;
+    std::vector<QueuedFrame> local_frames; // Swapped with inbox_frames, so steady state doesn't allocate
+
+    void run();
+    void drainInbox();
+    void readUdp();
+    bool readTcp(Connection &c);
+    bool processInput(Connection &c);
+    FrameResult handleTcpFrame(Connection &c, char *frame, uint16_t len);
+    bool flushTcp(Connection &c);
+    void closeConnection(int fd);
+    void setWriteInterest(Connection &c, bool enable);
+    void dispatchFrame(uint32_t channel, char *frame, uint16_t len);
+    void relayFrame(uint32_t channel, char *frame, uint16_t len);
+    void relayReport(uint32_t channel, const char *frame, uint16_t len);
+    bool acceptSequence(SpeakerState &s, uint16_t seq);
+    void updateLoudness(SpeakerState &s, uint32_t timestamp, uint8_t level);
+    bool selectSpeaker(uint32_t ssrc, SpeakerState &s, std::chrono::steady_clock::time_point now);
+    void stopForwarding(uint32_t ssrc, SpeakerState &s);
+    void dropSpeaker(uint32_t ssrc, const SpeakerState &s);
+    void expireSpeakers(std::chrono::steady_clock::time_point now);
+    ChannelMixer *mixerFor(uint32_t channel);
+    void setMixTimer(bool enable);
+    void mixTick();
+    void sendMixReports();
+    void logLoad(std::chrono::steady_clock::duration interval);
+    void fanOut(uint32_t channel, uint32_t speaker, const char *frame, uint16_t len);
+    void sendTo(uint32_t channel, uint32_t ssrc, const char *frame, uint16_t len);
+    void deliver(const VoiceListener &l, const char *frame, uint16_t len);
+    void queueTcp(const VoiceListener &l, const char *frame, uint16_t len);
+};
+
+std::vector<std::unique_ptr<RelayWorker>> workers;
+std::vector<int> udp_sockets; // One per worker where SO_REUSEPORT allows it
+std::atomic<unsigned> next_worker{0};
+std::atomic<bool> running{false};
+
+RelayWorker &workerFor(uint32_t channel) {
+    // Fibonacci hashing so consecutive channel ids spread over the workers
+    return *workers[(channel * 2654435761u) % workers.size()];
+}
+
+RelayWorker::RelayWorker(int udp, bool reader, bool sweep) : udp_socket(udp), udp_reader(reader), sweeper(sweep) {
+    epoll_fd = epoll_create1(0);
+    event_fd = eventfd(0, EFD_NONBLOCK);
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = event_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev);
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    if (udp_reader) {
+        ev.data.fd = udp_socket;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udp_socket, &ev);
+    }
+}
+
+RelayWorker::~RelayWorker() {
+    for (const auto &[fd, c] : connections) {
+        close(fd);
+    }
+
+    close(timer_fd);
+    close(event_fd);
+    close(epoll_fd);
+}
+
+void RelayWorker::start() {
+    thread = std::thread(&RelayWorker::run, this);
+}
+
+void RelayWorker::join() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void RelayWorker::wake() {
+    // Coalesce wakeups, one eventfd write per drain is enough
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        write(event_fd, &one, sizeof(one));
+    }
+}
+
+void RelayWorker::adopt(std::unique_ptr<Connection> c) {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        inbox_connections.push_back(std::move(c));
+    }
+    wake();
+}
+
+void RelayWorker::pushFrame(uint32_t channel, const char *frame, uint16_t len) {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        QueuedFrame &f = inbox_frames.emplace_back();
+        f.channel = channel;
+        f.len = len;
+        std::memcpy(f.data, frame, len);
+    }
+    wake();
+}
+
+void RelayWorker::run() {
+    epoll_event events[MAX_EVENTS];
+    auto last_sweep = std::chrono::steady_clock::now();
+    auto last_load_log = last_sweep;
+
+    while (running.load()) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == event_fd) {
+                uint64_t count;
+                read(event_fd, &count, sizeof(count));
+                wake_pending.store(false);
+                drainInbox();
+                continue;
+            }
+
+            if (fd == udp_socket) {
+                readUdp();
+                continue;
+            }
+
+            if (fd == timer_fd) {
+                uint64_t expirations = 0;
+                read(timer_fd, &expirations, sizeof(expirations));
+                for (uint64_t t = 0; t < std::min<uint64_t>(expirations, MAX_MIX_CATCHUP); t++) {
+                    mixTick();
+                }
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue;
+            }
+
+            Connection &c = *it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                LOG_INFO("Client disconnected from voice");
+                closeConnection(fd);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !flushTcp(c)) {
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                readTcp(c);
+            }
+        }
+
+        // UDP has no disconnect, one worker expires quiet sessions
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sweep > std::chrono::seconds(1)) {
+            if (sweeper) {
+                VoiceSessions::expire();
+            }
+            expireSpeakers(now);
+            sendMixReports();
+            last_sweep = now;
+        }
+
+        if (now - last_load_log > std::chrono::seconds(LOAD_LOG_S)) {
+            logLoad(now - last_load_log);
+            last_load_log = now;
+        }
+    }
+}
+
+void RelayWorker::drainInbox() {
+    std::vector<std::unique_ptr<Connection>> adopted;
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        adopted.swap(inbox_connections);
+        local_frames.swap(inbox_frames);
+    }
+
+    for (std::unique_ptr<Connection> &c : adopted) {
+        int fd = c->fd;
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN | (c->out_pos < c->out.size() ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+        Connection &ref = *c;
+        connections[fd] = std::move(c);
+
+        // A migrated connection may already hold complete frames
+        processInput(ref);
+    }
+
+    for (QueuedFrame &f : local_frames) {
+        dispatchFrame(f.channel, f.data, f.len);
+    }
+    local_frames.clear();
+}
+
+void RelayWorker::readUdp() {
+    char frame[VOICE_MAX_FRAME];
+
+    for (int i = 0; i < UDP_BATCH; i++) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(udp_socket, frame, sizeof(frame), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (len < 0) {
+            return;
+        }
+
+        // Runt datagram
+        if (len < (ssize_t)sizeof(VoicePacketHeader)) {
+            continue;
+        }
+
+        VoicePacketHeader h;
+        std::memcpy(&h, frame, sizeof(h));
+        uint32_t ssrc = ntohl(h.ssrc);
+        uint32_t channel;
+
+        switch (static_cast<VoicePacketType>(h.type)) {
+        case VoicePacketType::HELLO: {
+            if (!VoiceSessions::authenticate(frame, len, ssrc, channel) || !VoiceSessions::bindUdp(ssrc, from)) {
+                break;
+            }
+
+            VoicePacketHeader ack = {};
+            ack.type = static_cast<uint8_t>(VoicePacketType::HELLO_ACK);
+            ack.ssrc = htonl(ssrc);
+            sendto(udp_socket, &ack, sizeof(ack), MSG_DONTWAIT, (struct sockaddr *)&from, from_len);
+            break;
+        }
+        case VoicePacketType::AUDIO:
+        case VoicePacketType::REPORT: {
+            if (!VoiceSessions::checkUdp(ssrc, from, channel)) {
+                break;
+            }
+
+            RelayWorker &owner = workerFor(channel);
+            if (&owner == this) {
+                dispatchFrame(channel, frame, len);
+            } else {
+                owner.pushFrame(channel, frame, len);
+            }
+            break;
+        }
+        case VoicePacketType::BYE: {
+            if (VoiceSessions::checkUdp(ssrc, from, channel)) {
+                LOG_INFO("Client left voice");
+                VoiceSessions::remove(ssrc);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+bool RelayWorker::readTcp(Connection &c) {
+    while (true) {
+        ssize_t n = recv(c.fd, c.in + c.in_len, sizeof(c.in) - c.in_len, 0);
+        if (n == 0) {
+            LOG_INFO("Client disconnected from voice");
+            closeConnection(c.fd);
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            closeConnection(c.fd);
+            return false;
+        }
+
+        c.in_len += n;
+        if (!processInput(c)) {
+            return false;
+        }
+    }
+}
+
+// Handles every complete frame in the input buffer. Returns false if the connection went away
+bool RelayWorker::processInput(Connection &c) {
+    size_t pos = 0;
+    FrameResult result = FrameResult::CONTINUE;
+
+    while (result == FrameResult::CONTINUE && c.in_len - pos >= sizeof(uint16_t)) {
+        uint16_t len_net;
+        std::memcpy(&len_net, c.in + pos, sizeof(len_net));
+        uint16_t len = ntohs(len_net);
+
+        if (len < sizeof(VoicePacketHeader) || len > VOICE_MAX_FRAME) {
+            LOG_WARNING("Invalid voice frame length");
+            result = FrameResult::CLOSE;
+            break;
+        }
+        if (c.in_len - pos < sizeof(uint16_t) + len) {
+            break;
+        }
+
+        result = handleTcpFrame(c, c.in + pos + sizeof(uint16_t), len);
+        pos += sizeof(uint16_t) + len;
+    }
+
+    if (result == FrameResult::CLOSE) {
+        closeConnection(c.fd);
+        return false;
+    }
+
+    std::memmove(c.in, c.in + pos, c.in_len - pos);
+    c.in_len -= pos;
+
+    if (result == FrameResult::MIGRATE) {
+        // Hand it over with whatever is still buffered
+        int fd = c.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+        std::unique_ptr<Connection> owned = std::move(connections[fd]);
+        connections.erase(fd);
+        workerFor(owned->channel).adopt(std::move(owned));
+        return false;
+    }
+
+    return true;
+}
+
+FrameResult RelayWorker::handleTcpFrame(Connection &c, char *frame, uint16_t len) {
+    if (c.ssrc == 0) {
+        uint32_t ssrc, channel;
+        if (!VoiceSessions::authenticate(frame, len, ssrc, channel)) {
+            LOG_WARNING("Voice client presented an invalid session");
+            return FrameResult::CLOSE;
+        }
+
+        c.ssrc = ssrc;
+        c.channel = channel;
+        VoiceSessions::bindTcp(ssrc, c.fd);
+        LOG_INFO("Client connected over TCP, receiving audio...");
+
+        return &workerFor(channel) == this ? FrameResult::CONTINUE : FrameResult::MIGRATE;
+    }
+
+    VoicePacketHeader *h = reinterpret_cast<VoicePacketHeader *>(frame);
+    if (h->type == static_cast<uint8_t>(VoicePacketType::BYE)) {
+        return FrameResult::CLOSE;
+    }
+    if (h->type != static_cast<uint8_t>(VoicePacketType::AUDIO) && h->type != static_cast<uint8_t>(VoicePacketType::REPORT)) {
+        return FrameResult::CONTINUE;
+    }
+
+    // The connection is already authenticated, don't trust the client's ssrc
+    h->ssrc = htonl(c.ssrc);
+    dispatchFrame(c.channel, frame, len);
+
+    return FrameResult::CONTINUE;
+}
+
+bool RelayWorker::flushTcp(Connection &c) {
+    while (c.out_pos < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            closeConnection(c.fd);
+            return false;
+        }
+        c.out_pos += n;
+    }
+
+    c.out.clear();
+    c.out_pos = 0;
+    setWriteInterest(c, false);
+    return true;
+}
+
+void RelayWorker::closeConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) {
+        return;
+    }
+
+    if (it->second->ssrc != 0) {
+        VoiceSessions::remove(it->second->ssrc);
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+}
+
+void RelayWorker::setWriteInterest(Connection &c, bool enable) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+    ev.data.fd = c.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// Authenticated frames from a member of a channel this worker owns
+void RelayWorker::dispatchFrame(uint32_t channel, char *frame, uint16_t len) {
+    const VoicePacketHeader *h = reinterpret_cast<const VoicePacketHeader *>(frame);
+    auto start = std::chrono::steady_clock::now();
+
+    if (h->type == static_cast<uint8_t>(VoicePacketType::REPORT)) {
+        relayReport(channel, frame, len);
+    } else {
+        relayFrame(channel, frame, len);
+    }
+
+    ChannelLoad &load = channel_load[channel];
+    load.frames_in++;
+    load.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Splits a listener's report and hands each speaker the block about them
+void RelayWorker::relayReport(uint32_t channel, const char *frame, uint16_t len) {
+    // Listeners of a mixed channel only hear the server, their reports are about our own streams
+    if (Config::voice_mix_channels.count(channel)) {
+        return;
+    }
+
+    const VoicePacketHeader *h = reinterpret_cast<const VoicePacketHeader *>(frame);
+    size_t blocks = (len - sizeof(VoicePacketHeader)) / sizeof(VoiceReportBlock);
+
+    char out[sizeof(VoicePacketHeader) + sizeof(VoiceReportBlock)];
+    VoicePacketHeader header = {};
+    header.type = static_cast<uint8_t>(VoicePacketType::REPORT);
+    header.ssrc = h->ssrc; // Who is reporting
+    std::memcpy(out, &header, sizeof(header));
+
+    for (size_t i = 0; i < blocks; i++) {
+        VoiceReportBlock block;
+        std::memcpy(&block, frame + sizeof(VoicePacketHeader) + i * sizeof(block), sizeof(block));
+        std::memcpy(out + sizeof(header), &block, sizeof(block));
+        sendTo(channel, ntohl(block.ssrc), out, sizeof(out));
+    }
+}
+
+// Per-frame decisions for an authenticated AUDIO frame, then fan-out
+void RelayWorker::relayFrame(uint32_t channel, char *frame, uint16_t len) {
+    VoicePacketHeader *h = reinterpret_cast<VoicePacketHeader *>(frame);
+    const unsigned char *payload = reinterpret_cast<const unsigned char *>(frame + sizeof(VoicePacketHeader));
+
+    // Only whole, well formed Opus packets go out
+    if (opus_packet_samples(payload, len - sizeof(VoicePacketHeader)) < 0) {
+        return;
+    }
+
+    uint32_t ssrc = ntohl(h->ssrc);
+    uint16_t seq = ntohs(h->seq);
+    auto now = std::chrono::steady_clock::now();
+
+    auto it = speakers.find(ssrc);
+    if (it == speakers.end()) {
+        uint32_t userId;
+        if (!VoiceSessions::userOf(ssrc, userId)) {
+            return;
+        }
+
+        SpeakerState state = {};
+        state.userId = userId;
+        state.highest_seq = seq;
+        state.channel = channel;
+        it = speakers.emplace(ssrc, state).first;
+    }
+
+    SpeakerState &s = it->second;
+    if (!acceptSequence(s, seq)) {
+        return;
+    }
+    s.last_seen = now;
+
+    bool silence = h->flags & VOICE_FLAG_SILENCE;
+    updateLoudness(s, ntohl(h->timestamp), silence ? VOICE_LEVEL_SILENT : h->level);
+
+    // Only the loudest few in the channel reach listeners
+    if (!selectSpeaker(ssrc, s, now)) {
+        stopForwarding(ssrc, s);
+        return;
+    }
+
+    // Listeners only need to hear that a speaker went quiet once, the
+    // keepalives after that just keep the session alive
+    if (silence && s.silent) {
+        return;
+    }
+    s.silent = silence;
+
+    // Listeners missed everything since the speaker was last forwarded, that gap is not loss
+    if (!s.forwarding) {
+        h->flags |= VOICE_FLAG_TALKSPURT;
+        s.forwarding = true;
+    }
+
+    // Mixed channels decode now and send on the mixing tick
+    if (Config::voice_mix_channels.count(channel)) {
+        if (ChannelMixer *mixer = mixerFor(channel)) {
+            mixer->push(ssrc, *h, payload, len - sizeof(VoicePacketHeader));
+        }
+        return;
+    }
+
+    // Listeners tell speakers apart by ssrc and know who is talking from the user id
+    h->speaker = htonl(s.userId);
+    fanOut(channel, ssrc, frame, len);
+}
+
+// Replay window like SRTP's: reordered frames pass, repeats and very late ones don't
+bool RelayWorker::acceptSequence(SpeakerState &s, uint16_t seq) {
+    int16_t delta = static_cast<int16_t>(seq - s.highest_seq);
+
+    if (delta > 0) {
+        s.seen = delta >= REPLAY_WINDOW ? 1 : (s.seen << delta) | 1;
+        s.highest_seq = seq;
+        return true;
+    }
+
+    int back = -delta;
+    if (back >= REPLAY_WINDOW || (s.seen & (1ull << back))) {
+        return false;
+    }
+
+    s.seen |= 1ull << back;
+    return true;
+}
+
+// Smoothed over the speaker's own timeline, so a keepalive after a long silence pulls it straight down
+void RelayWorker::updateLoudness(SpeakerState &s, uint32_t timestamp, uint8_t level) {
+    float db = (float)(VOICE_LEVEL_SILENT - std::min<uint8_t>(level, VOICE_LEVEL_SILENT));
+
+    if (s.loudness < 0.0f) {
+        s.loudness = db;
+        s.last_timestamp = timestamp;
+        return;
+    }
+
+    // Reordered frame, the level already moved past it
+    int32_t elapsed = static_cast<int32_t>(timestamp - s.last_timestamp);
+    if (elapsed <= 0) {
+        return;
+    }
+
+    float alpha = std::min(1.0f, (float)elapsed / LOUDNESS_WINDOW);
+    s.loudness += (db - s.loudness) * alpha;
+    s.last_timestamp = timestamp;
+}
+
+// Keeps the channel's forwarded set at the N loudest, with some hysteresis so it doesn't flap
+bool RelayWorker::selectSpeaker(uint32_t ssrc, SpeakerState &s, std::chrono::steady_clock::time_point now) {
+    if (Config::voice_max_speakers == 0) {
+        return true;
+    }
+
+    std::vector<uint32_t> &active = active_speakers[s.channel];
+    if (std::find(active.begin(), active.end(), ssrc) != active.end()) {
+        return true;
+    }
+
+    if (active.size() < Config::voice_max_speakers) {
+        active.push_back(ssrc);
+        return true;
+    }
+
+    // Speakers that went away entirely count as silent
+    auto effective = [&](uint32_t other) {
+        const SpeakerState &o = speakers.at(other);
+        return now - o.last_seen > std::chrono::milliseconds(STALE_SPEAKER_MS) ? -1.0f : o.loudness;
+    };
+
+    auto weakest = std::min_element(active.begin(), active.end(), [&](uint32_t a, uint32_t b) {
+        return effective(a) < effective(b);
+    });
+
+    if (s.loudness <= effective(*weakest) + HYSTERESIS_DB) {
+        return false;
+    }
+
+    stopForwarding(*weakest, speakers.at(*weakest));
+    *weakest = ssrc;
+    return true;
+}
+
+void RelayWorker::stopForwarding(uint32_t ssrc, SpeakerState &s) {
+    s.forwarding = false;
+
+    auto it = mixers.find(s.channel);
+    if (it != mixers.end()) {
+        it->second->removeSpeaker(ssrc);
+    }
+}
+
+void RelayWorker::dropSpeaker(uint32_t ssrc, const SpeakerState &s) {
+    auto mixer = mixers.find(s.channel);
+    if (mixer != mixers.end()) {
+        mixer->second->removeSpeaker(ssrc);
+    }
+
+    auto it = active_speakers.find(s.channel);
+    if (it == active_speakers.end()) {
+        return;
+    }
+
+    std::vector<uint32_t> &active = it->second;
+    active.erase(std::remove(active.begin(), active.end(), ssrc), active.end());
+    if (active.empty()) {
+        active_speakers.erase(it);
+    }
+}
+
+void RelayWorker::expireSpeakers(std::chrono::steady_clock::time_point now) {
+    for (auto it = speakers.begin(); it != speakers.end();) {
+        if (now - it->second.last_seen > std::chrono::seconds(SPEAKER_TIMEOUT_S)) {
+            dropSpeaker(it->first, it->second);
+            it = speakers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // A mixer with nobody left to mix only costs ticks
+    for (auto it = mixers.begin(); it != mixers.end();) {
+        if (it->second->empty()) {
+            it = mixers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (mixers.empty()) {
+        setMixTimer(false);
+    }
+}
+
+ChannelMixer *RelayWorker::mixerFor(uint32_t channel) {
+    auto it = mixers.find(channel);
+    if (it != mixers.end()) {
+        return it->second.get();
+    }
+
+    std::unique_ptr<ChannelMixer> mixer = std::make_unique<ChannelMixer>();
+    if (!mixer->init()) {
+        return nullptr;
+    }
+
+    if (mixers.empty()) {
+        setMixTimer(true);
+    }
+    LOG_INFO("Mixing voice channel " + std::to_string(channel) + " on the server");
+    return mixers.emplace(channel, std::move(mixer)).first->second.get();
+}
+
+void RelayWorker::setMixTimer(bool enable) {
+    itimerspec spec = {};
+    if (enable) {
+        long tick_ns = (long)(MIX_TICK_SAMPLES * 1000000000LL / 48000);
+        spec.it_interval.tv_nsec = tick_ns;
+        spec.it_value.tv_nsec = tick_ns;
+    }
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+// Mixes every channel this worker owns and sends each listener the stream meant for them
+void RelayWorker::mixTick() {
+    for (auto &[channel, mixer] : mixers) {
+        auto start = std::chrono::steady_clock::now();
+        const std::vector<MixOutput> &outputs = mixer->tick();
+        ChannelLoad &load = channel_load[channel];
+
+        std::shared_ptr<const ListenerList> list = VoiceSessions::listeners(channel);
+        if (list) {
+            // Entry 0 is the channel mix, the rest are for specific listeners
+            for (const VoiceListener &l : *list) {
+                const MixOutput *out = &outputs[0];
+                for (size_t i = 1; i < outputs.size(); i++) {
+                    if (outputs[i].ssrc == l.ssrc) {
+                        out = &outputs[i];
+                        break;
+                    }
+                }
+
+                if (out->len > 0) {
+                    deliver(l, out->data, out->len);
+                    load.frames_out++;
+                }
+            }
+        }
+
+        load.mixed = true;
+        load.ticks++;
+        load.encodes += mixer->encodes();
+        load.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+// The server is the only listener of a mixed channel's speakers, so it reports to them itself
+void RelayWorker::sendMixReports() {
+    char out[sizeof(VoicePacketHeader) + sizeof(VoiceReportBlock)];
+    VoicePacketHeader header = {};
+    header.type = static_cast<uint8_t>(VoicePacketType::REPORT);
+    std::memcpy(out, &header, sizeof(header));
+
+    for (auto &[channel, mixer] : mixers) {
+        mix_reports.clear();
+        mixer->reports(mix_reports);
+
+        for (const VoiceReportBlock &block : mix_reports) {
+            std::memcpy(out + sizeof(header), &block, sizeof(block));
+            sendTo(channel, ntohl(block.ssrc), out, sizeof(out));
+        }
+    }
+}
+
+// What each channel cost since the last log, to decide where server mixing pays off
+void RelayWorker::logLoad(std::chrono::steady_clock::duration interval) {
+    double seconds = std::chrono::duration<double>(interval).count();
+
+    for (const auto &[channel, load] : channel_load) {
+        std::string line = "Voice channel " + std::to_string(channel) + (load.mixed ? " (mixed)" : " (forwarded)") + ": " +
+                           std::to_string(100.0 * load.busy_ns / (seconds * 1e9)) + "% of a core, " +
+                           std::to_string((uint64_t)(load.frames_in / seconds)) + " frames/s in, " +
+                           std::to_string((uint64_t)(load.frames_out / seconds)) + " out";
+        if (load.mixed && load.ticks > 0) {
+            line += ", " + std::to_string((double)load.encodes / load.ticks) + " encodes per tick";
+        }
+        LOG_INFO(line);
+    }
+
+    channel_load.clear();
+}
+
+// Sends a frame to everyone in the channel but its speaker, bridging between
+// UDP and TCP listeners. Mix-minus leaves the speaker out the same way
+void RelayWorker::fanOut(uint32_t channel, uint32_t speaker, const char *frame, uint16_t len) {
+    std::shared_ptr<const ListenerList> list = VoiceSessions::listeners(channel);
+    if (!list) {
+        return;
+    }
+
+    uint64_t sent = 0;
+    for (const VoiceListener &l : *list) {
+        if (l.ssrc == speaker) {
+            continue;
+        }
+        deliver(l, frame, len);
+        sent++;
+    }
+    channel_load[channel].frames_out += sent;
+}
+
+void RelayWorker::sendTo(uint32_t channel, uint32_t ssrc, const char *frame, uint16_t len) {
+    std::shared_ptr<const ListenerList> list = VoiceSessions::listeners(channel);
+    if (!list) {
+        return;
+    }
+
+    for (const VoiceListener &l : *list) {
+        if (l.ssrc == ssrc) {
+            deliver(l, frame, len);
+            return;
+        }
+    }
+}
+
+void RelayWorker::deliver(const VoiceListener &l, const char *frame, uint16_t len) {
+    if (l.tcp_socket >= 0) {
+        queueTcp(l, frame, len);
+    } else {
+        sendto(udp_socket, frame, len, MSG_DONTWAIT, (const struct sockaddr *)&l.udp_addr, sizeof(l.udp_addr));
+    }
+}
+
+// Never blocks and never closes, errors show up as EPOLLERR/EPOLLHUP later
+void RelayWorker::queueTcp(const VoiceListener &l, const char *frame, uint16_t len) {
+    // A snapshot can outlive the connection, make sure the fd still belongs to this listener
+    auto it = connections.find(l.tcp_socket);
+    if (it == connections.end() || it->second->ssrc != l.ssrc) {
+        return; // Gone, or still migrating to this worker
+    }
+
+    Connection &c = *it->second;
+    int fd = c.fd;
+    size_t pending = c.out.size() - c.out_pos;
+    size_t total = sizeof(uint16_t) + len;
+
+    // Slow listener, drop the frame for it rather than stalling the channel
+    if (pending + total > MAX_PENDING_BYTES) {
+        return;
+    }
+
+    char buf[sizeof(uint16_t) + VOICE_MAX_FRAME];
+    uint16_t len_net = htons(len);
+    std::memcpy(buf, &len_net, sizeof(len_net));
+    std::memcpy(buf + sizeof(len_net), frame, len);
+
+    if (pending > 0) {
+        c.out.insert(c.out.end(), buf, buf + total);
+        return;
+    }
+
+    ssize_t n = send(fd, buf, total, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n == (ssize_t)total) {
+        return;
+    }
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return;
+        }
+        n = 0;
+    }
+
+    c.out.assign(buf + n, buf + total);
+    c.out_pos = 0;
+    setWriteInterest(c, true);
+}
+
+} // namespace
+
+namespace VoiceRelay {
+
+bool start(sockaddr_in &addr, unsigned n_workers) {
+    n_workers = std::max(1u, n_workers);
+
+    // The kernel spreads datagrams over the sockets by address, so each client
+    // always lands on the same worker and its frames stay in order
+    for (unsigned i = 0; i < n_workers; i++) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) {
+            break;
+        }
+
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+        if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(sock);
+            break;
+        }
+
+        // Binding to port 0 picks one, the other sockets join it
+        if (i == 0) {
+            socklen_t len = sizeof(addr);
+            getsockname(sock, (struct sockaddr *)&addr, &len);
+        }
+        udp_sockets.push_back(sock);
+    }
+
+    if (udp_sockets.empty()) {
+        LOG_ERROR("Voice relay could not bind its UDP socket");
+        return false;
+    }
+    if (udp_sockets.size() < n_workers) {
+        LOG_WARNING("No SO_REUSEPORT, only " + std::to_string(udp_sockets.size()) + " voice worker(s) read UDP");
+    }
+
+    running.store(true);
+    for (unsigned i = 0; i < n_workers; i++) {
+        bool reader = i < udp_sockets.size();
+        workers.push_back(std::make_unique<RelayWorker>(reader ? udp_sockets[i] : udp_sockets[0], reader, i == 0));
+    }
+
+    for (auto &w : workers) {
+        w->start();
+    }
+
+    LOG_INFO("Voice relay running on " + std::to_string(n_workers) + " workers");
+    return true;
+}
+
+void stop() {
+    running.store(false);
+
+    for (auto &w : workers) {
+        w->wake();
+    }
+    for (auto &w : workers) {
+        w->join();
+    }
+
+    workers.clear();
+
+    for (int sock : udp_sockets) {
+        close(sock);
+    }
+    udp_sockets.clear();
+}
+
+void addConnection(int sock) {
+    // Round robin until the HELLO tells us which worker owns its channel
+    std::unique_ptr<Connection> c = std::make_unique<Connection>();
+    c->fd = sock;
+    workers[next_worker++ % workers.size()]->adopt(std::move(c));
+}
+
+} // namespace VoiceRelay
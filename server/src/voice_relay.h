@@ -0,0 +1,16 @@
+#pragma once
+#include <netinet/in.h>
+
+// Event driven voice relay. A handful of worker threads each run an epoll
+// loop, every channel is pinned to one worker (by hash) that does all of its
+// fan-out. Each worker reads its own SO_REUSEPORT UDP socket, so ingress
+// scales with the workers too. A frame that arrives on a worker other than
+// its channel's is handed over through that worker's inbox. Sockets are
+// non-blocking and each TCP listener has its own bounded output queue, so a
+// slow listener only loses its own frames.
+namespace VoiceRelay {
+// Binds a UDP socket per worker to addr, filling in the port if it was 0
+bool start(sockaddr_in &addr, unsigned n_workers);
+void stop();
+void addConnection(int sock); // Freshly accepted TCP fallback connection
+}; // namespace VoiceRelay
@@ -0,0 +1,260 @@
+#include "voice_sessions.h"
+#include "logger.h"
+#include "voice_packets.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#define SESSION_TIMEOUT_S 10 // UDP sessions without traffic are dropped after this
+
+namespace {
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct VoiceSession {
+    uint32_t userId;
+    uint32_t channel;
+    uint64_t key;
+    int tcp_socket = -1; // Set when the client fell back to TCP
+    bool udp_bound = false;
+    sockaddr_in udp_addr = {};
+    std::shared_ptr<std::atomic<int64_t>> last_seen_ns; // Shared with the published binding
+};
+
+// What the per-frame path needs to know about a joined session
+struct SessionBinding {
+    uint32_t userId;
+    uint32_t channel;
+    bool udp_bound;
+    sockaddr_in udp_addr;
+    std::shared_ptr<std::atomic<int64_t>> last_seen_ns; // The only thing written in place, relaxed
+};
+
+// Channel members and session bindings as of the last join or leave, never
+// changed once published
+struct Snapshot {
+    std::unordered_map<uint32_t, std::shared_ptr<const ListenerList>> channels;
+    std::unordered_map<uint32_t, SessionBinding> bindings; // By ssrc
+};
+
+std::unordered_map<uint32_t, VoiceSession> sessions; // By ssrc
+std::mutex clients_mutex;                            // Serializes writers, the per-frame path never takes it
+
+// RCU style: readers grab the current snapshot, writers copy it, change one
+// session and swap the new one in. Old snapshots die with their last reader.
+// libstdc++'s atomic<shared_ptr> is not lock free, loads and stores take a
+// spinlock inside the atomic for a few instructions, but never clients_mutex.
+std::atomic<std::shared_ptr<const Snapshot>> snapshot{std::make_shared<const Snapshot>()};
+
+bool sameAddress(const sockaddr_in &a, const sockaddr_in &b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+ssize_t findClientIndex(const ListenerList &list, uint32_t ssrc) {
+    ssize_t index = 0;
+    for (const VoiceListener &l : list) {
+        if (l.ssrc == ssrc) {
+            return index;
+        }
+        index++;
+    }
+
+    return -1;
+}
+
+// Requires clients_mutex. Replaces a channel's list in a copy of the snapshot
+void setListeners(Snapshot &next, uint32_t channel, ListenerList list) {
+    if (list.empty()) {
+        next.channels.erase(channel);
+    } else {
+        next.channels[channel] = std::make_shared<const ListenerList>(std::move(list));
+    }
+}
+
+// Requires clients_mutex
+ListenerList currentListeners(const Snapshot &current, uint32_t channel) {
+    auto it = current.channels.find(channel);
+    return it == current.channels.end() ? ListenerList() : *it->second;
+}
+
+// Requires clients_mutex
+void joinChannel(uint32_t ssrc, const VoiceSession &s) {
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*snapshot.load());
+
+    VoiceListener l = {ssrc, s.tcp_socket, s.udp_addr};
+    ListenerList list = currentListeners(*next, s.channel);
+    ssize_t index = findClientIndex(list, ssrc);
+    if (index == -1) {
+        list.push_back(l);
+    } else {
+        list[index] = l;
+    }
+    setListeners(*next, s.channel, std::move(list));
+    next->bindings[ssrc] = {s.userId, s.channel, s.udp_bound, s.udp_addr, s.last_seen_ns};
+
+    snapshot.store(std::move(next));
+}
+
+// Requires clients_mutex
+void removeSession(uint32_t ssrc) {
+    auto it = sessions.find(ssrc);
+    if (it == sessions.end()) {
+        return;
+    }
+
+    std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*snapshot.load());
+    uint32_t channel = it->second.channel;
+    ListenerList list = currentListeners(*next, channel);
+    ssize_t index = findClientIndex(list, ssrc);
+    if (index != -1) {
+        list.erase(list.begin() + index);
+        setListeners(*next, channel, std::move(list));
+    }
+    next->bindings.erase(ssrc);
+
+    snapshot.store(std::move(next));
+    sessions.erase(it);
+}
+
+} // namespace
+
+namespace VoiceSessions {
+
+VoiceSessionInfo create(uint32_t userId, uint32_t channel) {
+    static std::mt19937_64 rng(std::random_device{}());
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+
+    uint32_t ssrc;
+    do {
+        ssrc = static_cast<uint32_t>(rng());
+    } while (ssrc == 0 || sessions.count(ssrc));
+
+    VoiceSession s;
+    s.userId = userId;
+    s.channel = channel;
+    s.key = rng();
+    s.last_seen_ns = std::make_shared<std::atomic<int64_t>>(nowNs());
+    sessions[ssrc] = s;
+
+    return {channel, ssrc, s.key};
+}
+
+bool authenticate(const char *frame, size_t len, uint32_t &ssrc, uint32_t &channel) {
+    VoicePacketHeader h;
+    uint64_t key;
+    if (len < sizeof(h) + sizeof(key)) {
+        return false;
+    }
+
+    std::memcpy(&h, frame, sizeof(h));
+    std::memcpy(&key, frame + sizeof(h), sizeof(key));
+    if (h.type != static_cast<uint8_t>(VoicePacketType::HELLO)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+
+    ssrc = ntohl(h.ssrc);
+    auto it = sessions.find(ssrc);
+    if (it == sessions.end() || it->second.key != key) {
+        return false;
+    }
+
+    channel = it->second.channel;
+    return true;
+}
+
+void bindTcp(uint32_t ssrc, int sock) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+
+    auto it = sessions.find(ssrc);
+    if (it == sessions.end()) {
+        return;
+    }
+
+    // TCP wins if a UDP hello got through but its ack did not
+    it->second.tcp_socket = sock;
+    it->second.udp_bound = false;
+    joinChannel(ssrc, it->second);
+}
+
+bool bindUdp(uint32_t ssrc, const sockaddr_in &addr) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+
+    auto it = sessions.find(ssrc);
+    if (it == sessions.end() || it->second.tcp_socket >= 0) {
+        return false;
+    }
+
+    it->second.udp_addr = addr;
+    it->second.udp_bound = true;
+    it->second.last_seen_ns->store(nowNs(), std::memory_order_relaxed);
+    joinChannel(ssrc, it->second);
+    return true;
+}
+
+// Runs for every UDP datagram, so it only reads the published snapshot
+bool checkUdp(uint32_t ssrc, const sockaddr_in &from, uint32_t &channel) {
+    std::shared_ptr<const Snapshot> current = snapshot.load();
+
+    auto it = current->bindings.find(ssrc);
+    if (it == current->bindings.end() || !it->second.udp_bound || !sameAddress(it->second.udp_addr, from)) {
+        return false;
+    }
+
+    it->second.last_seen_ns->store(nowNs(), std::memory_order_relaxed);
+    channel = it->second.channel;
+    return true;
+}
+
+bool userOf(uint32_t ssrc, uint32_t &userId) {
+    std::shared_ptr<const Snapshot> current = snapshot.load();
+
+    auto it = current->bindings.find(ssrc);
+    if (it == current->bindings.end()) {
+        return false;
+    }
+
+    userId = it->second.userId;
+    return true;
+}
+
+void remove(uint32_t ssrc) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    removeSession(ssrc);
+}
+
+void expire() {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+
+    int64_t now = nowNs();
+    std::vector<uint32_t> expired;
+    for (const auto &[ssrc, s] : sessions) {
+        if (s.tcp_socket < 0 && now - s.last_seen_ns->load(std::memory_order_relaxed) > SESSION_TIMEOUT_S * 1000000000LL) {
+            expired.push_back(ssrc);
+        }
+    }
+
+    for (const uint32_t ssrc : expired) {
+        LOG_INFO("Voice session " + std::to_string(ssrc) + " timed out");
+        removeSession(ssrc);
+    }
+}
+
+std::shared_ptr<const ListenerList> listeners(uint32_t channel) {
+    std::shared_ptr<const Snapshot> current = snapshot.load();
+    auto it = current->channels.find(channel);
+    return it == current->channels.end() ? nullptr : it->second;
+}
+
+} // namespace VoiceSessions
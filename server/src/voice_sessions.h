@@ -0,0 +1,42 @@
+#pragma once
+#include "common_data.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <vector>
+
+// Where a channel member wants its frames delivered
+struct VoiceListener {
+    uint32_t ssrc;
+    int tcp_socket; // -1 when on UDP
+    sockaddr_in udp_addr;
+};
+
+// Immutable once published, membership changes swap in a new list
+using ListenerList = std::vector<VoiceListener>;
+
+// Voice sessions handed out over the text connection and the channel
+// membership derived from them. Everything here is safe to call from any thread.
+namespace VoiceSessions {
+VoiceSessionInfo create(uint32_t userId, uint32_t channel);
+
+// Checks a HELLO frame, returns the session it belongs to
+bool authenticate(const char *frame, size_t len, uint32_t &ssrc, uint32_t &channel);
+
+// Bind a transport to an authenticated session and join its channel
+void bindTcp(uint32_t ssrc, int sock);
+bool bindUdp(uint32_t ssrc, const sockaddr_in &addr);
+
+// Validates the sender of a UDP frame and returns its channel. Per-frame, reads the snapshot only
+bool checkUdp(uint32_t ssrc, const sockaddr_in &from, uint32_t &channel);
+
+// User behind a joined session, for stamping forwarded frames. Reads the snapshot only
+bool userOf(uint32_t ssrc, uint32_t &userId);
+
+void remove(uint32_t ssrc);
+void expire(); // Drops UDP sessions that went quiet
+
+// Snapshot of a channel's members without taking the sessions lock, nullptr if nobody is in it
+std::shared_ptr<const ListenerList> listeners(uint32_t channel);
+}; // namespace VoiceSessions